@@ -0,0 +1,921 @@
+/**
+ * Benchmarks `wgroff`, `wman` and `wapropos` on a corpus made by `wgen`.
+ *
+ * Every benchmark runs a tool many times, and reports the latency
+ * percentiles of a run and the number of pages processed per second,
+ * once with the corpus evicted from the page cache before every run (cold)
+ * and once after a warm up run (warm). The results can be saved as JSON
+ * lines, and compared against saved results to catch regressions.
+ *
+ * @author Mrigank Kumar
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define WBENCH_FAILURE 1  /* Exit status for failure, or a regression */
+#define WBENCH_SUCCESS 0  /* Exit status for success */
+
+#define SCCP static const char*  /* To reduce line length */
+/* (SCCP = Static Const Char Pointer) */
+
+#define MAX_STR_LENGTH 256  /* Maximum length of a str or char[] */
+#define MAX_RESULTS 16      /* Most results in a results file */
+
+#define IS_NULL(x) if (NULL == x)       /* Descriptive to avoid mistakes */
+#define IS_NOT_NULL(x) if (NULL != x)   /* Descriptive to avoid mistakes */
+#define IF_FORMAT_FAILED(x) if (x < 0)  /* Descriptive to avoid mistakes */
+
+#define RUNS_FLAG "-n"       /* CLA to set the number of runs */
+#define OUTPUT_FLAG "-o"     /* CLA to save the results */
+#define BASELINE_FLAG "-b"   /* CLA to compare against saved results */
+#define TOLERANCE_FLAG "-t"  /* CLA to set the allowed slowdown, in % */
+
+#define DEFAULT_RUNS 50       /* Runs per benchmark */
+#define DEFAULT_TOLERANCE 25  /* Allowed slowdown of the median, in % */
+#define BATCH_RUNS 5          /* Runs of a whole corpus `wgroff --batch` */
+#define BENCH_SEED 537        /* Seed for picking pages and keywords */
+#define DIR_MODE 0755         /* Permissions of the directories made */
+
+#define MIN_SECTION 1  /* Minimum section value */
+#define MAX_SECTION 9  /* Maximum section value */
+
+#define NS_PER_MS 1e6  /* Nanoseconds per millisecond */
+#define NS_PER_S 1e9   /* Nanoseconds per second */
+
+#define COLD "cold"  /* Corpus evicted from the page cache before every run */
+#define WARM "warm"  /* Corpus in the page cache */
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////        Format Strings        /////////////////////////
+
+// If the program was used incorrectly
+SCCP INVALID_USE = "Usage: ./wbench [-n <runs>] [-o <results>] [-b <baseline>] "
+                   "[-t <tolerance %>] <tools dir> <corpus dir>\n";
+
+// If a tool wasn't built
+SCCP ERROR_NO_TOOL = "No executable `%s`, build the tools first\n";
+
+// If the corpus has no infiles
+SCCP ERROR_NO_CORPUS = "No infiles in `%s/input_files`, run ./wgen first\n";
+
+// If opendir failed
+SCCP ERROR_IN_OPENDIR = "Error in opening directory `%s`\n";
+
+// If a file couldn't be opened
+SCCP ERROR_IN_FOPEN = "Couldn't open file `%s`\n";
+
+// If malloc failed
+SCCP ERROR_IN_MALLOC = "malloc failed in function `%s`\n";
+
+// If sprintf failed
+SCCP ERROR_IN_FORMAT = "Couldn't write to formatted string in func `%s`\n";
+
+// If a tool failed
+SCCP ERROR_IN_RUN = "`%s` failed, status %i\n";
+
+// Heading of the results table
+SCCP RESULTS_HEADER = "%-16s %-5s %6s %10s %10s %10s %10s %12s\n";
+
+// A row of the results table
+SCCP RESULTS_ROW = "%-16s %-5s %6i %10.3f %10.3f %10.3f %10.3f %12.1f\n";
+
+// A result, as a JSON line
+SCCP RESULT_JSON = "{\"bench\":\"%s\",\"cache\":\"%s\",\"pages\":%i,\"runs\":%i,"
+                   "\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,"
+                   "\"max_ms\":%.3f,\"pages_per_sec\":%.1f}\n";
+
+// To read a result back from a JSON line
+SCCP RESULT_JSON_SCAN = "{\"bench\":\"%31[^\"]\",\"cache\":\"%7[^\"]\",\"pages\":%i,"
+                        "\"runs\":%i,\"p50_ms\":%lf,\"p90_ms\":%lf,\"p99_ms\":%lf,"
+                        "\"max_ms\":%lf,\"pages_per_sec\":%lf}";
+
+// A benchmark that got slower than the baseline
+SCCP REGRESSION = "REGRESSION %s (%s): p50 %.3f ms, baseline %.3f ms\n";
+
+// Once the comparison found no regressions
+SCCP NO_REGRESSIONS = "No regressions against `%s` (tolerance %i%%)\n";
+
+// Directories and files inside the corpus
+SCCP INPUT_DIR = "input_files";
+SCCP RENDER_DIR = "rendered";
+SCCP MAN_PAGES_DIR = "man_pages";
+SCCP SECTION_DIR = "man_pages/man%i";
+SCCP MAN_PAGE_PATH = "man_pages/man%i/%s";
+SCCP INFILE_PATH = "../input_files/%s";
+SCCP CHILD_PATH = "%s/%s";
+SCCP APROPOS_INDEX = "man_pages/.wapropos.index";
+
+/////////////////////////      End Format Strings      /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////           Helpers            /////////////////////////
+
+typedef struct {
+    char bench[32];        /* The name of the benchmark */
+    char cache[8];         /* COLD or WARM */
+    int pages;             /* Pages processed by one run */
+    int runs;              /* Number of timed runs */
+    double p50_ms;         /* Median latency of a run */
+    double p90_ms;         /* 90th percentile latency of a run */
+    double p99_ms;         /* 99th percentile latency of a run */
+    double max_ms;         /* Slowest run */
+    double pages_per_sec;  /* Pages processed per second over all runs */
+} Result;
+
+typedef struct {
+    char** names;     /* The names of the entries */
+    int n;            /* The number of entries */
+    int capacity;     /* The capacity of `names` */
+} NameList;
+
+typedef struct {
+    char wgroff[PATH_MAX];    /* Absolute path to wgroff */
+    char wman[PATH_MAX];      /* Absolute path to wman */
+    char wapropos[PATH_MAX];  /* Absolute path to wapropos */
+} Tools;
+
+/**
+ * Gets the next random number, with xorshift64*
+ *
+ * @param  state The state of the generator, never 0
+ * @return       A random number
+ */
+uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ull;
+}
+
+/**
+ * Gets a monotonic timestamp
+ *
+ * @return The timestamp in nanoseconds
+ */
+int64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/**
+ * Adds a name to the list
+ *
+ * @param list The list
+ * @param name The name, copied
+ */
+void add_name(NameList* list, const char* name) {
+    if (list->n == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->names = realloc(list->names, sizeof(char*) * list->capacity);
+
+        IS_NULL(list->names) {
+            fprintf(stderr, ERROR_IN_MALLOC, "add_name");
+            exit(WBENCH_FAILURE);
+        }
+    }
+
+    list->names[list->n] = strdup(name);
+
+    IS_NULL(list->names[list->n]) {
+        fprintf(stderr, ERROR_IN_MALLOC, "add_name");
+        exit(WBENCH_FAILURE);
+    }
+
+    list->n++;
+}
+
+/**
+ * Orders names alphabetically, for qsort
+ */
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/**
+ * Lists the files in a directory, skipping hidden ones, in sorted order
+ *
+ * @param list To store the names
+ * @param dir  The directory
+ */
+void list_dir(NameList* list, const char* dir) {
+    DIR* handle = opendir(dir);
+
+    IS_NULL(handle) {
+        fprintf(stderr, ERROR_IN_OPENDIR, dir);
+        exit(WBENCH_FAILURE);
+    }
+
+    struct dirent* entry;
+
+    while (NULL != (entry = readdir(handle))) {
+        if (entry->d_name[0] != '.') { add_name(list, entry->d_name); }
+    }
+
+    closedir(handle);
+
+    qsort(list->names, list->n, sizeof(char*), compare_names);
+}
+
+/**
+ * Releases the names in the list
+ *
+ * @param list The list
+ */
+void free_names(NameList* list) {
+    for (int i = 0; i < list->n; i++) { free(list->names[i]); }
+
+    free(list->names);
+    list->names = NULL;
+    list->n = list->capacity = 0;
+}
+
+/**
+ * Evicts every file under `path` from the page cache, so the next run
+ * reads the corpus from disk. Only clean pages can be evicted, so `sync`
+ * once before the first call.
+ *
+ * @param path The file or directory to evict
+ */
+void evict_path(const char* path) {
+    struct stat st;
+
+    if (lstat(path, &st) < 0) { return; }
+
+    if (S_ISREG(st.st_mode)) {
+        int fd = open(path, O_RDONLY);
+
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode)) { return; }
+
+    DIR* dir = opendir(path);
+
+    IS_NULL(dir) { return; }
+
+    struct dirent* entry;
+    char child[PATH_MAX];
+
+    while (NULL != (entry = readdir(dir))) {
+        if (0 == strcmp(entry->d_name, ".") || 0 == strcmp(entry->d_name, "..")) {
+            continue;
+        }
+
+        if (snprintf(child, sizeof(child), CHILD_PATH, path, entry->d_name)
+            < (int) sizeof(child)) {
+            evict_path(child);
+        }
+    }
+
+    closedir(dir);
+}
+
+/**
+ * Runs a tool to completion, with its output discarded
+ *
+ * @param  dir  The directory to run the tool in
+ * @param  argv The tool and its arguments, NULL terminated
+ * @return      The time the run took, in nanoseconds
+ */
+int64_t run_tool(const char* dir, char* const argv[]) {
+    int64_t start = now_ns();
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("fork");
+        exit(WBENCH_FAILURE);
+    }
+
+    if (0 == pid) {
+        int null = open("/dev/null", O_WRONLY);
+
+        if (null < 0 || chdir(dir) < 0) { _exit(127); }
+
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        close(null);
+
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            exit(WBENCH_FAILURE);
+        }
+    }
+
+    int64_t elapsed = now_ns() - start;
+
+    if (!WIFEXITED(status) || 0 != WEXITSTATUS(status)) {
+        fprintf(stderr, ERROR_IN_RUN, argv[0], WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        exit(WBENCH_FAILURE);
+    }
+
+    return elapsed;
+}
+
+/////////////////////////         End Helpers          /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////          Benchmarks          /////////////////////////
+
+typedef struct {
+    const char* name;  /* The name of the benchmark */
+    const char* dir;   /* The directory to run the tool in */
+    int pages;         /* Pages processed by one run */
+    int runs;          /* Number of timed runs */
+    /* Fills in the arguments of run `i`, NULL terminated */
+    void (*make_argv)(const void* ctx, int i, char* argv[], char* buffer);
+    const void* ctx;   /* Passed to `make_argv` */
+} Bench;
+
+/**
+ * Orders latencies, for qsort
+ */
+static int compare_latencies(const void* a, const void* b) {
+    int64_t x = *(const int64_t*) a;
+    int64_t y = *(const int64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Gets a percentile of sorted latencies, by nearest rank
+ *
+ * @param  sorted The latencies, sorted
+ * @param  n      The number of latencies
+ * @param  p      The percentile, in [0, 100]
+ * @return        The percentile, in milliseconds
+ */
+double percentile_ms(const int64_t* sorted, int n, int p) {
+    int rank = (p * n + 99) / 100;
+
+    return sorted[rank > 0 ? rank - 1 : 0] / NS_PER_MS;
+}
+
+/**
+ * Runs one benchmark, cold or warm
+ *
+ * @param result To store the result
+ * @param bench  The benchmark
+ * @param cache  COLD to evict the corpus before every run, WARM to keep
+ *               it in the page cache
+ */
+void run_bench(Result* result, const Bench* bench, const char* cache) {
+    int64_t* latencies = malloc(sizeof(int64_t) * bench->runs);
+    char* argv[8];
+    char buffer[2 * PATH_MAX];
+    int64_t total = 0;
+    int cold = 0 == strcmp(cache, COLD);
+
+    IS_NULL(latencies) {
+        fprintf(stderr, ERROR_IN_MALLOC, "run_bench");
+        exit(WBENCH_FAILURE);
+    }
+
+    // Lets the tool build anything it builds lazily, like the wman index,
+    // so cold runs only measure reading the corpus from disk
+    bench->make_argv(bench->ctx, 0, argv, buffer);
+    run_tool(bench->dir, argv);
+
+    if (cold) { sync(); }
+
+    for (int i = 0; i < bench->runs; i++) {
+        bench->make_argv(bench->ctx, i, argv, buffer);
+
+        if (cold) { evict_path("."); }
+
+        latencies[i] = run_tool(bench->dir, argv);
+        total += latencies[i];
+    }
+
+    qsort(latencies, bench->runs, sizeof(int64_t), compare_latencies);
+
+    strncpy(result->bench, bench->name, sizeof(result->bench) - 1);
+    result->bench[sizeof(result->bench) - 1] = '\0';
+    strcpy(result->cache, cache);
+    result->pages = bench->pages;
+    result->runs = bench->runs;
+    result->p50_ms = percentile_ms(latencies, bench->runs, 50);
+    result->p90_ms = percentile_ms(latencies, bench->runs, 90);
+    result->p99_ms = percentile_ms(latencies, bench->runs, 99);
+    result->max_ms = latencies[bench->runs - 1] / NS_PER_MS;
+    result->pages_per_sec = (double) bench->pages * bench->runs * NS_PER_S / total;
+
+    free(latencies);
+
+    printf(RESULTS_ROW, result->bench, result->cache, result->runs,
+           result->p50_ms, result->p90_ms, result->p99_ms, result->max_ms,
+           result->pages_per_sec);
+    fflush(stdout);
+}
+
+typedef struct {
+    const Tools* tools;        /* The tools */
+    const NameList* infiles;   /* The infiles of the corpus */
+    const NameList* pages;     /* The man pages, as "<section> <name>" */
+    const NameList* keywords;  /* Keywords from the NAME sections */
+    int* picks;                /* The random entry used by each run */
+} BenchContext;
+
+/**
+ * `wgroff <infile>`, one random infile per run
+ */
+void wgroff_argv(const void* ctx, int i, char* argv[], char* buffer) {
+    const BenchContext* c = ctx;
+
+    IF_FORMAT_FAILED(sprintf(buffer, INFILE_PATH, c->infiles->names[c->picks[i] % c->infiles->n])) {
+        fprintf(stderr, ERROR_IN_FORMAT, "wgroff_argv");
+        exit(WBENCH_FAILURE);
+    }
+
+    argv[0] = (char*) c->tools->wgroff;
+    argv[1] = buffer;
+    argv[2] = NULL;
+}
+
+/**
+ * `wgroff --batch <input_files>`, the whole corpus per run
+ */
+void wgroff_batch_argv(const void* ctx, int i, char* argv[], char* buffer) {
+    const BenchContext* c = ctx;
+
+    (void) i;
+
+    IF_FORMAT_FAILED(sprintf(buffer, INFILE_PATH, "")) {
+        fprintf(stderr, ERROR_IN_FORMAT, "wgroff_batch_argv");
+        exit(WBENCH_FAILURE);
+    }
+
+    argv[0] = (char*) c->tools->wgroff;
+    argv[1] = "--batch";
+    argv[2] = buffer;
+    argv[3] = NULL;
+}
+
+/**
+ * `wman <section> <page>`, one random page per run
+ */
+void wman_argv(const void* ctx, int i, char* argv[], char* buffer) {
+    const BenchContext* c = ctx;
+    const char* page = c->pages->names[c->picks[i] % c->pages->n];
+
+    // "<section> <name>" becomes two arguments
+    strcpy(buffer, page);
+    buffer[1] = '\0';
+
+    argv[0] = (char*) c->tools->wman;
+    argv[1] = buffer;
+    argv[2] = buffer + 2;
+    argv[3] = NULL;
+}
+
+/**
+ * `wman <page>`, one random page per run, resolved without a section
+ */
+void wman_any_argv(const void* ctx, int i, char* argv[], char* buffer) {
+    wman_argv(ctx, i, argv, buffer);
+
+    argv[1] = argv[2];
+    argv[2] = NULL;
+}
+
+/**
+ * `wapropos <keyword>`, one random keyword per run
+ */
+void wapropos_argv(const void* ctx, int i, char* argv[], char* buffer) {
+    const BenchContext* c = ctx;
+
+    (void) buffer;
+
+    argv[0] = (char*) c->tools->wapropos;
+    argv[1] = c->keywords->names[c->picks[i] % c->keywords->n];
+    argv[2] = NULL;
+}
+
+/**
+ * Moves the rendered pages into `man_pages/man<section>/`, where `wman`
+ * and `wapropos` look for them, and lists them as "<section> <name>"
+ *
+ * @param pages To store the pages
+ */
+void install_pages(NameList* pages) {
+    NameList rendered = { NULL, 0, 0 };
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    list_dir(&rendered, RENDER_DIR);
+
+    if (mkdir(MAN_PAGES_DIR, DIR_MODE) < 0 && errno != EEXIST) {
+        fprintf(stderr, ERROR_IN_OPENDIR, MAN_PAGES_DIR);
+        exit(WBENCH_FAILURE);
+    }
+
+    for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+        IF_FORMAT_FAILED(sprintf(to, SECTION_DIR, section)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "install_pages");
+            exit(WBENCH_FAILURE);
+        }
+
+        if (mkdir(to, DIR_MODE) < 0 && errno != EEXIST) {
+            fprintf(stderr, ERROR_IN_OPENDIR, to);
+            exit(WBENCH_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < rendered.n; i++) {
+        char* name = rendered.names[i];
+        size_t len = strlen(name);
+
+        // Outfiles are named "<name>.<section>"
+        if (len < 3 || name[len - 2] != '.' || name[len - 1] < '1' || name[len - 1] > '9') {
+            continue;
+        }
+
+        int section = name[len - 1] - '0';
+
+        if (snprintf(from, sizeof(from), CHILD_PATH, RENDER_DIR, name) >= (int) sizeof(from)
+            || snprintf(to, sizeof(to), MAN_PAGE_PATH, section, name) >= (int) sizeof(to)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "install_pages");
+            exit(WBENCH_FAILURE);
+        }
+
+        if (rename(from, to) < 0) {
+            fprintf(stderr, ERROR_IN_FOPEN, from);
+            exit(WBENCH_FAILURE);
+        }
+
+        name[len - 2] = '\0';
+
+        IF_FORMAT_FAILED(sprintf(to, "%i %s", section, name)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "install_pages");
+            exit(WBENCH_FAILURE);
+        }
+
+        add_name(pages, to);
+    }
+
+    free_names(&rendered);
+}
+
+/**
+ * Collects the keywords to search for, one word from the NAME description
+ * of every infile, so every keyword is on at least one page
+ *
+ * @param keywords To store the keywords
+ * @param infiles  The infiles of the corpus
+ * @param state    The state of the generator
+ */
+void collect_keywords(NameList* keywords, const NameList* infiles, uint64_t* state) {
+    char path[PATH_MAX];
+    char* line = NULL;
+    size_t size = 0;
+
+    for (int i = 0; i < infiles->n; i++) {
+        if (snprintf(path, sizeof(path), CHILD_PATH, INPUT_DIR, infiles->names[i])
+            >= (int) sizeof(path)) {
+            continue;
+        }
+
+        FILE* handle = fopen(path, "r");
+
+        IS_NULL(handle) { continue; }
+
+        // The NAME description follows the first " - "
+        char* dash = NULL;
+
+        while (getline(&line, &size, handle) > 0 && NULL == (dash = strstr(line, " - "))) {}
+
+        fclose(handle);
+
+        IS_NULL(dash) { continue; }
+
+        char* words[MAX_STR_LENGTH];
+        int n = 0;
+
+        for (char* word = strtok(dash + 3, " \n"); NULL != word && n < MAX_STR_LENGTH;
+             word = strtok(NULL, " \n")) {
+            words[n++] = word;
+        }
+
+        if (n > 0) { add_name(keywords, words[next_random(state) % n]); }
+    }
+
+    free(line);
+}
+
+/////////////////////////        End Benchmarks        /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////           Results            /////////////////////////
+
+/**
+ * Saves the results as JSON lines
+ *
+ * @param  path    The file to save to
+ * @param  results The results
+ * @param  n       The number of results
+ * @return         0 on success, -1 otherwise
+ */
+int save_results(const char* path, const Result* results, int n) {
+    FILE* handle = fopen(path, "w");
+
+    IS_NULL(handle) { return -1; }
+
+    for (int i = 0; i < n; i++) {
+        const Result* r = &results[i];
+
+        fprintf(handle, RESULT_JSON, r->bench, r->cache, r->pages, r->runs,
+                r->p50_ms, r->p90_ms, r->p99_ms, r->max_ms, r->pages_per_sec);
+    }
+
+    return 0 == fclose(handle) ? 0 : -1;
+}
+
+/**
+ * Loads results saved by `save_results`
+ *
+ * @param  path    The file to load
+ * @param  results To store the results, at least MAX_RESULTS long
+ * @return         The number of results, -1 if the file couldn't be read
+ */
+int load_results(const char* path, Result* results) {
+    FILE* handle = fopen(path, "r");
+    char* line = NULL;
+    size_t size = 0;
+    int n = 0;
+
+    IS_NULL(handle) { return -1; }
+
+    while (n < MAX_RESULTS && getline(&line, &size, handle) > 0) {
+        Result* r = &results[n];
+
+        if (9 == sscanf(line, RESULT_JSON_SCAN, r->bench, r->cache, &r->pages,
+                        &r->runs, &r->p50_ms, &r->p90_ms, &r->p99_ms,
+                        &r->max_ms, &r->pages_per_sec)) {
+            n++;
+        }
+    }
+
+    free(line);
+    fclose(handle);
+
+    return n;
+}
+
+/**
+ * Compares the results against a baseline. A benchmark regressed if its
+ * median latency is more than `tolerance` % above the baseline's. Results
+ * for a different number of pages aren't comparable, and are skipped.
+ *
+ * @param  results  The results
+ * @param  n        The number of results
+ * @param  baseline The baseline results
+ * @param  n_base   The number of baseline results
+ * @param  tolerance The allowed slowdown, in %
+ * @return          The number of regressions
+ */
+int compare_results(const Result* results, int n, const Result* baseline,
+                    int n_base, int tolerance) {
+    int regressions = 0;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n_base; j++) {
+            const Result* r = &results[i];
+            const Result* b = &baseline[j];
+
+            if (0 != strcmp(r->bench, b->bench) || 0 != strcmp(r->cache, b->cache)
+                || r->pages != b->pages) {
+                continue;
+            }
+
+            if (r->p50_ms > b->p50_ms * (100 + tolerance) / 100) {
+                printf(REGRESSION, r->bench, r->cache, r->p50_ms, b->p50_ms);
+                regressions++;
+            }
+        }
+    }
+
+    return regressions;
+}
+
+/////////////////////////         End Results          /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////             MAIN             /////////////////////////
+
+/**
+ * Resolves a tool in the tools directory to an absolute path
+ *
+ * @param path  To store the absolute path
+ * @param dir   The tools directory
+ * @param name  The name of the tool
+ */
+void find_tool(char* path, const char* dir, const char* name) {
+    char relative[PATH_MAX];
+
+    if (snprintf(relative, sizeof(relative), CHILD_PATH, dir, name) >= (int) sizeof(relative)
+        || NULL == realpath(relative, path) || 0 != access(path, X_OK)) {
+        fprintf(stderr, ERROR_NO_TOOL, relative);
+        exit(WBENCH_FAILURE);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int runs = DEFAULT_RUNS;
+    int tolerance = DEFAULT_TOLERANCE;
+    const char* output = NULL;
+    const char* baseline_path = NULL;
+    int arg = 1;
+
+    // Usage was: ./wbench [-n <runs>] [-o <results>] [-b <baseline>] [-t <%>] ...
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (0 == strcmp(argv[arg], RUNS_FLAG)) {
+            runs = atoi(argv[arg + 1]);
+        } else if (0 == strcmp(argv[arg], OUTPUT_FLAG)) {
+            output = argv[arg + 1];
+        } else if (0 == strcmp(argv[arg], BASELINE_FLAG)) {
+            baseline_path = argv[arg + 1];
+        } else if (0 == strcmp(argv[arg], TOLERANCE_FLAG)) {
+            tolerance = atoi(argv[arg + 1]);
+        } else {
+            break;
+        }
+    }
+
+    if (argc - arg != 2 || runs <= 0 || tolerance < 0) {
+        printf("%s", INVALID_USE);
+        return WBENCH_FAILURE;
+    }
+
+    // The results file is relative to where wbench was started
+    char output_path[PATH_MAX];
+
+    IS_NOT_NULL(output) {
+        if (output[0] != '/') {
+            char cwd[PATH_MAX];
+
+            if (NULL == getcwd(cwd, sizeof(cwd))
+                || snprintf(output_path, sizeof(output_path), CHILD_PATH, cwd, output)
+                   >= (int) sizeof(output_path)) {
+                fprintf(stderr, ERROR_IN_FORMAT, "main");
+                return WBENCH_FAILURE;
+            }
+
+            output = output_path;
+        }
+    }
+
+    Result baseline[MAX_RESULTS];
+    int n_base = 0;
+
+    IS_NOT_NULL(baseline_path) {
+        if ((n_base = load_results(baseline_path, baseline)) < 0) {
+            fprintf(stderr, ERROR_IN_FOPEN, baseline_path);
+            return WBENCH_FAILURE;
+        }
+    }
+
+    Tools tools;
+
+    find_tool(tools.wgroff, argv[arg], "wgroff");
+    find_tool(tools.wman, argv[arg], "wman");
+    find_tool(tools.wapropos, argv[arg], "wapropos");
+
+    // The tools look for ./man_pages, so everything runs in the corpus
+    if (chdir(argv[arg + 1]) < 0) {
+        fprintf(stderr, ERROR_IN_OPENDIR, argv[arg + 1]);
+        return WBENCH_FAILURE;
+    }
+
+    NameList infiles = { NULL, 0, 0 };
+    NameList pages = { NULL, 0, 0 };
+    NameList keywords = { NULL, 0, 0 };
+    uint64_t state = BENCH_SEED;
+
+    list_dir(&infiles, INPUT_DIR);
+
+    if (0 == infiles.n) {
+        fprintf(stderr, ERROR_NO_CORPUS, argv[arg + 1]);
+        return WBENCH_FAILURE;
+    }
+
+    collect_keywords(&keywords, &infiles, &state);
+
+    if (mkdir(RENDER_DIR, DIR_MODE) < 0 && errno != EEXIST) {
+        fprintf(stderr, ERROR_IN_OPENDIR, RENDER_DIR);
+        return WBENCH_FAILURE;
+    }
+
+    int* picks = malloc(sizeof(int) * runs);
+
+    IS_NULL(picks) {
+        fprintf(stderr, ERROR_IN_MALLOC, "main");
+        return WBENCH_FAILURE;
+    }
+
+    for (int i = 0; i < runs; i++) { picks[i] = next_random(&state) % INT_MAX; }
+
+    BenchContext ctx = { &tools, &infiles, &pages, &keywords, picks };
+    Result results[MAX_RESULTS];
+    int n_results = 0;
+
+    printf(RESULTS_HEADER, "bench", "cache", "runs", "p50 ms", "p90 ms",
+           "p99 ms", "max ms", "pages/s");
+
+    Bench wgroff = { "wgroff", RENDER_DIR, 1, runs, wgroff_argv, &ctx };
+    Bench batch = { "wgroff_batch", RENDER_DIR, infiles.n, BATCH_RUNS, wgroff_batch_argv, &ctx };
+
+    run_bench(&results[n_results++], &wgroff, COLD);
+    run_bench(&results[n_results++], &wgroff, WARM);
+    run_bench(&results[n_results++], &batch, COLD);
+    run_bench(&results[n_results++], &batch, WARM);
+
+    // The last batch run rendered every page
+    install_pages(&pages);
+
+    Bench wman = { "wman", ".", 1, runs, wman_argv, &ctx };
+    Bench wman_any = { "wman_any", ".", 1, runs, wman_any_argv, &ctx };
+    Bench scan = { "wapropos_scan", ".", pages.n, runs, wapropos_argv, &ctx };
+    Bench indexed = { "wapropos_index", ".", pages.n, runs, wapropos_argv, &ctx };
+
+    run_bench(&results[n_results++], &wman, COLD);
+    run_bench(&results[n_results++], &wman, WARM);
+    run_bench(&results[n_results++], &wman_any, COLD);
+    run_bench(&results[n_results++], &wman_any, WARM);
+
+    // A stale index from an earlier run would turn the scan into a lookup
+    unlink(APROPOS_INDEX);
+
+    run_bench(&results[n_results++], &scan, COLD);
+    run_bench(&results[n_results++], &scan, WARM);
+
+    char* build_index[] = { tools.wapropos, "--build-index", NULL };
+    run_tool(".", build_index);
+
+    run_bench(&results[n_results++], &indexed, COLD);
+    run_bench(&results[n_results++], &indexed, WARM);
+
+    int status = WBENCH_SUCCESS;
+
+    IS_NOT_NULL(output) {
+        if (save_results(output, results, n_results) < 0) {
+            fprintf(stderr, ERROR_IN_FOPEN, output);
+            status = WBENCH_FAILURE;
+        }
+    }
+
+    IS_NOT_NULL(baseline_path) {
+        if (compare_results(results, n_results, baseline, n_base, tolerance) > 0) {
+            status = WBENCH_FAILURE;
+        } else {
+            printf(NO_REGRESSIONS, baseline_path, tolerance);
+        }
+    }
+
+    free(picks);
+    free_names(&infiles);
+    free_names(&pages);
+    free_names(&keywords);
+
+    return status;
+}
+
+/////////////////////////           END MAIN           /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
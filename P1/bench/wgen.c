@@ -0,0 +1,433 @@
+/**
+ * Generates a synthetic corpus of `wgroff` infiles, to benchmark
+ * `wgroff`, `wman` and `wapropos` at scale.
+ *
+ * Every page has the title header, NAME, SYNOPSIS and DESCRIPTION
+ * sections of the pages in `input_files`, with about as many font escapes.
+ * Words are drawn from a fixed vocabulary with a skewed distribution, so
+ * like real pages, a few words are on most pages and most words are rare.
+ * The same seed always generates the same corpus.
+ *
+ * @author Mrigank Kumar
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+#define WGEN_FAILURE 1  /* Exit status for failure */
+#define WGEN_SUCCESS 0  /* Exit status for success */
+
+#define SCCP static const char*  /* To reduce line length */
+/* (SCCP = Static Const Char Pointer) */
+
+#define MAX_STR_LENGTH 256  /* Maximum length of a str or char[] */
+
+#define IS_NULL(x) if (NULL == x)       /* Descriptive to avoid mistakes */
+#define IF_FORMAT_FAILED(x) if (x < 0)  /* Descriptive to avoid mistakes */
+
+#define SEED_FLAG "-s"     /* CLA to set the seed */
+#define DEFAULT_SEED 537   /* Seed if none is given */
+#define DIR_MODE 0755      /* Permissions of the output directory */
+
+#define MIN_SECTION 1  /* Minimum section value */
+#define MAX_SECTION 9  /* Maximum section value */
+
+#define NAME_WORDS_MIN 4         /* Fewest words in the NAME description */
+#define NAME_WORDS_MAX 12        /* Most words in the NAME description */
+#define SYNOPSIS_ARGS_MAX 4      /* Most arguments in the SYNOPSIS */
+#define PARAGRAPHS_MIN 1         /* Fewest paragraphs in the DESCRIPTION */
+#define PARAGRAPHS_MAX 8         /* Most paragraphs in the DESCRIPTION */
+#define PARAGRAPH_LINES_MIN 2    /* Fewest lines in a paragraph */
+#define PARAGRAPH_LINES_MAX 9    /* Most lines in a paragraph */
+#define LINE_LENGTH 72           /* Lines are wrapped at this length */
+#define ESCAPE_ONE_IN 30         /* About one word in this many has a font */
+#define MENTION_ONE_IN 60        /* About one word in this many is a page name */
+#define COMMENT_ONE_IN 8         /* About one page in this many has a comment */
+#define OPTIONS_ONE_IN 3         /* About one page in this many has OPTIONS */
+
+#define ARRAY_LENGTH(x) (sizeof(x) / sizeof((x)[0]))
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////        Format Strings        /////////////////////////
+
+// If the program was used incorrectly
+SCCP INVALID_USE = "Usage: ./wgen [-s <seed>] <pages> <dir>\n";
+
+// If the output directory couldn't be created
+SCCP ERROR_IN_MKDIR = "Couldn't create directory `%s`\n";
+
+// If an infile couldn't be written
+SCCP ERROR_IN_FOPEN_W = "Couldn't write to file `%s`\n";
+
+// If malloc failed
+SCCP ERROR_IN_MALLOC = "malloc failed in function `%s`\n";
+
+// If sprintf failed
+SCCP ERROR_IN_FORMAT = "Couldn't write to formatted string in func `%s`\n";
+
+// Once the corpus was generated
+SCCP WGEN_DONE = "Generated %i pages in `%s`\n";
+
+// A generated infile
+SCCP INFILE_PATH = "%s/%s.txt";
+
+// The title header, name, section and date
+SCCP TITLE_HEADER = ".TH %s %i 2023-%02i-%02i\n";
+
+// The fonts a word can be set in, paired with their reset
+SCCP FONTS[] = { "/fB", "/fI", "/fU" };
+SCCP FONT_RESET = "/fP";
+
+// Syllables that page names are made of
+SCCP SYLLABLES[] = {
+    "ab", "ch", "di", "ex", "fo", "gr", "ho", "in", "jo", "ke", "lo", "mk",
+    "ne", "op", "pr", "qu", "re", "st", "tr", "un", "vi", "wa", "xe", "zi",
+};
+
+// Words that descriptions are made of, most common first
+SCCP WORDS[] = {
+    "the", "a", "of", "to", "is", "and", "in", "file", "for", "or", "this",
+    "be", "by", "with", "that", "on", "an", "if", "not", "from", "are",
+    "program", "it", "as", "which", "given", "can", "when", "each", "page",
+    "should", "name", "then", "system", "print", "manual", "output", "input",
+    "user", "section", "list", "string", "directory", "option", "value",
+    "error", "message", "command", "line", "found", "read", "write", "search",
+    "display", "return", "number", "first", "simplified", "version",
+    "default", "format", "character", "status", "process", "memory", "buffer",
+    "device", "network", "socket", "signal", "thread", "lock", "queue",
+    "table", "entry", "index", "keyword", "pattern", "match", "terminal",
+    "session", "shell", "script", "library", "function", "call", "argument",
+    "variable", "environment", "path", "mode", "permission", "owner", "group",
+    "time", "date", "clock", "timer", "event", "handler", "loop", "block",
+    "stream", "pipe", "descriptor", "offset", "length", "size", "limit",
+    "range", "key", "hash", "tree", "node", "link", "mount", "volume",
+    "partition", "sector", "cache", "frame", "map", "region", "heap",
+    "stack", "pointer", "address", "register", "interrupt", "kernel", "module",
+    "driver", "service", "daemon", "client", "server", "request", "response",
+    "header", "payload", "packet", "checksum", "encode", "decode",
+    "compress", "archive", "extract", "install", "remove", "update", "upgrade",
+    "configure", "build", "compile", "debug", "trace", "profile",
+    "benchmark", "measure", "report", "summary", "detail", "verbose", "quiet",
+    "recursive", "parallel", "sequential", "concurrent", "atomic", "volatile",
+    "persistent", "temporary", "hidden", "visible", "readonly", "writable",
+    "executable", "symbolic", "absolute", "relative", "canonical", "unicode",
+    "locale", "collation", "timezone", "calendar", "scheduler", "priority",
+    "affinity", "quota", "journal", "snapshot", "replica", "shard", "ledger",
+};
+
+/////////////////////////      End Format Strings      /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////        Random Numbers        /////////////////////////
+
+/**
+ * Gets the next random number, with xorshift64*
+ *
+ * @param  state The state of the generator, never 0
+ * @return       A random number
+ */
+uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ull;
+}
+
+/**
+ * Gets a random number in [min, max]
+ *
+ * @param  state The state of the generator
+ * @param  min   The smallest number
+ * @param  max   The largest number
+ * @return       A random number in [min, max]
+ */
+int random_between(uint64_t* state, int min, int max) {
+    return min + (int) (next_random(state) % (uint64_t) (max - min + 1));
+}
+
+/**
+ * Gets a random word, where earlier words are much more likely than later
+ * ones, roughly like the words of real pages
+ *
+ * @param  state The state of the generator
+ * @return       A random word
+ */
+const char* random_word(uint64_t* state) {
+    uint64_t n = ARRAY_LENGTH(WORDS);
+    uint64_t a = next_random(state) % n;
+    uint64_t b = next_random(state) % n;
+
+    // The product of two uniform numbers is skewed towards 0
+    return WORDS[a * b / n];
+}
+
+/**
+ * Gets a random section, most pages are in sections 1 and 3 like real ones
+ *
+ * @param  state The state of the generator
+ * @return       A random section
+ */
+int random_section(uint64_t* state) {
+    static const int weights[MAX_SECTION + 1] = { 0, 30, 10, 30, 4, 8, 2, 8, 6, 2 };
+    int pick = random_between(state, 1, 100);
+
+    for (int section = MIN_SECTION; section < MAX_SECTION; section++) {
+        pick -= weights[section];
+
+        if (pick <= 0) { return section; }
+    }
+
+    return MAX_SECTION;
+}
+
+/////////////////////////      End Random Numbers      /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////        Page Generator        /////////////////////////
+
+typedef struct {
+    FILE* handle;  /* The infile being written */
+    int column;    /* The length of the current line */
+} Writer;
+
+/**
+ * Makes the name of page `id`. Names are a random syllable followed by the
+ * id spelled in syllables, so every page has a different name.
+ *
+ * @param str   To store the name
+ * @param id    The id of the page
+ * @param state The state of the generator
+ */
+void page_name(char* str, int id, uint64_t* state) {
+    int n = ARRAY_LENGTH(SYLLABLES);
+
+    strcpy(str, SYLLABLES[random_between(state, 0, n - 1)]);
+
+    do {
+        strcat(str, SYLLABLES[id % n]);
+        id /= n;
+    } while (id > 0);
+}
+
+/**
+ * Writes a word to the current line, starting a new line if it doesn't fit
+ *
+ * @param out  The infile being written
+ * @param word The word to write
+ */
+void write_word(Writer* out, const char* word) {
+    int len = strlen(word);
+
+    if (out->column > 0 && out->column + 1 + len > LINE_LENGTH) {
+        fputc('\n', out->handle);
+        out->column = 0;
+    }
+
+    if (out->column > 0) {
+        fputc(' ', out->handle);
+        out->column++;
+    }
+
+    fputs(word, out->handle);
+    out->column += len;
+}
+
+/**
+ * Writes a random word of running text. Some words are set in a font, and
+ * some are the names of other pages, like the references in real pages.
+ *
+ * @param out   The infile being written
+ * @param names The names of the pages generated so far
+ * @param n     The number of names
+ * @param state The state of the generator
+ */
+void write_text_word(Writer* out, char (*names)[MAX_STR_LENGTH], int n,
+                     uint64_t* state) {
+    char word[2 * MAX_STR_LENGTH];
+    const char* text = random_word(state);
+
+    if (n > 0 && 0 == random_between(state, 0, MENTION_ONE_IN - 1)) {
+        text = names[random_between(state, 0, n - 1)];
+    }
+
+    if (0 == random_between(state, 0, ESCAPE_ONE_IN - 1)) {
+        const char* font = FONTS[random_between(state, 0, ARRAY_LENGTH(FONTS) - 1)];
+
+        IF_FORMAT_FAILED(sprintf(word, "%s%s%s", font, text, FONT_RESET)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "write_text_word");
+            exit(WGEN_FAILURE);
+        }
+
+        text = word;
+    }
+
+    write_word(out, text);
+}
+
+/**
+ * Ends the current line, if anything was written to it
+ *
+ * @param out The infile being written
+ */
+void end_line(Writer* out) {
+    if (out->column > 0) { fputc('\n', out->handle); }
+
+    out->column = 0;
+}
+
+/**
+ * Writes one infile
+ *
+ * @param handle The infile
+ * @param names  The names of every page, this page is `names[id]`
+ * @param id     The id of the page
+ * @param state  The state of the generator
+ */
+void write_page(FILE* handle, char (*names)[MAX_STR_LENGTH], int id,
+                uint64_t* state) {
+    Writer out = { .handle = handle, .column = 0 };
+    const char* name = names[id];
+
+    fprintf(handle, TITLE_HEADER, name, random_section(state),
+            random_between(state, 1, 12), random_between(state, 1, 28));
+
+    if (0 == random_between(state, 0, COMMENT_ONE_IN - 1)) {
+        fputs("# Generated by wgen\n", handle);
+    }
+
+    // The NAME description is a single line, like wapropos expects
+    fputs(".SH name\n", handle);
+    fprintf(handle, "%s -", name);
+
+    for (int i = random_between(state, NAME_WORDS_MIN, NAME_WORDS_MAX); i > 0; i--) {
+        fprintf(handle, " %s", random_word(state));
+    }
+
+    fputs("\n.SH synopsis\n", handle);
+    fprintf(handle, "/fB%s/fP", name);
+
+    for (int i = random_between(state, 0, SYNOPSIS_ARGS_MAX); i > 0; i--) {
+        fprintf(handle, " [/fI%s/fP]", random_word(state));
+    }
+
+    fputs("\n.SH description\n", handle);
+
+    for (int p = random_between(state, PARAGRAPHS_MIN, PARAGRAPHS_MAX); p > 0; p--) {
+        int words = random_between(state, PARAGRAPH_LINES_MIN, PARAGRAPH_LINES_MAX)
+                    * LINE_LENGTH / 6;
+
+        for (int i = 0; i < words; i++) { write_text_word(&out, names, id, state); }
+
+        end_line(&out);
+
+        if (p > 1) { fputc('\n', handle); }
+    }
+
+    if (0 == random_between(state, 0, OPTIONS_ONE_IN - 1)) {
+        fputs(".SH options\n", handle);
+
+        for (int i = random_between(state, 1, 6); i > 0; i--) {
+            fprintf(handle, "/fB-%c/fP ", 'a' + random_between(state, 0, 25));
+
+            for (int j = random_between(state, 3, 12); j > 0; j--) {
+                fprintf(handle, "%s%s", random_word(state), j > 1 ? " " : "\n");
+            }
+        }
+    }
+}
+
+/**
+ * Generates the corpus
+ *
+ * @param  n_pages The number of pages to generate
+ * @param  dir     The directory to write the infiles to
+ * @param  seed    The seed of the generator
+ * @return         WGEN_SUCCESS or WGEN_FAILURE
+ */
+int generate(int n_pages, const char* dir, uint64_t seed) {
+    uint64_t state = seed ? seed : DEFAULT_SEED;
+    char (*names)[MAX_STR_LENGTH] = malloc(sizeof(*names) * (n_pages ? n_pages : 1));
+    char path[2 * MAX_STR_LENGTH];
+
+    IS_NULL(names) {
+        fprintf(stderr, ERROR_IN_MALLOC, "generate");
+        return WGEN_FAILURE;
+    }
+
+    if (mkdir(dir, DIR_MODE) < 0 && errno != EEXIST) {
+        fprintf(stderr, ERROR_IN_MKDIR, dir);
+        free(names);
+        return WGEN_FAILURE;
+    }
+
+    for (int id = 0; id < n_pages; id++) { page_name(names[id], id, &state); }
+
+    for (int id = 0; id < n_pages; id++) {
+        if (snprintf(path, sizeof(path), INFILE_PATH, dir, names[id]) >= (int) sizeof(path)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "generate");
+            free(names);
+            return WGEN_FAILURE;
+        }
+
+        FILE* handle = fopen(path, "w");
+
+        IS_NULL(handle) {
+            fprintf(stderr, ERROR_IN_FOPEN_W, path);
+            free(names);
+            return WGEN_FAILURE;
+        }
+
+        write_page(handle, names, id, &state);
+
+        if (0 != fclose(handle)) {
+            fprintf(stderr, ERROR_IN_FOPEN_W, path);
+            free(names);
+            return WGEN_FAILURE;
+        }
+    }
+
+    free(names);
+
+    printf(WGEN_DONE, n_pages, dir);
+
+    return WGEN_SUCCESS;
+}
+
+/////////////////////////      End Page Generator      /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////             MAIN             /////////////////////////
+
+int main(int argc, char* argv[]) {
+    uint64_t seed = DEFAULT_SEED;
+    int arg = 1;
+
+    // Usage was: ./wgen -s <seed> <pages> <dir>
+    if (argc == 5 && 0 == strcmp(argv[1], SEED_FLAG)) {
+        seed = strtoull(argv[2], NULL, 10);
+        arg = 3;
+    }
+
+    if (argc - arg != 2 || atoi(argv[arg]) < 0) {
+        printf("%s", INVALID_USE);
+        return WGEN_FAILURE;
+    }
+
+    return generate(atoi(argv[arg]), argv[arg + 1], seed);
+}
+
+/////////////////////////           END MAIN           /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
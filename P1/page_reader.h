@@ -0,0 +1,172 @@
+/**
+ * Zero-copy reader for manual pages, shared by `wapropos` and `wman`.
+ *
+ * Regular files are memory mapped, anything else (like a pipe) is read
+ * in large chunks into a heap buffer. Either way the whole page is
+ * available as one block of bytes, and callers walk it through line views
+ * that point into that block, so lines have no length limit.
+ *
+ * @author Mrigank Kumar
+ */
+
+#ifndef PAGE_READER_H_
+#define PAGE_READER_H_
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PAGE_READ_CHUNK 65536  /* Bytes per read() when a page can't be mapped */
+
+typedef struct {
+    char* data;   /* The contents of the page, NOT NUL terminated */
+    size_t size;  /* The size of the page in bytes */
+    int mapped;   /* Whether `data` is a mapping or a heap buffer */
+} Page;
+
+typedef struct {
+    const char* start;  /* The start of the line, inside the page */
+    size_t len;         /* The length of the line, including its newline */
+} LineView;
+
+/**
+ * Reads a page that can't be mapped, like a pipe, into a heap buffer
+ *
+ * @param  page To store the contents
+ * @param  fd   The descriptor to read from
+ * @return      0 on success, -1 if reading or allocating failed
+ */
+static inline int page_read_fd(Page* page, int fd) {
+    size_t capacity = PAGE_READ_CHUNK;
+    ssize_t n;
+
+    page->data = malloc(capacity);
+    page->size = 0;
+    page->mapped = 0;
+
+    if (NULL == page->data) { return -1; }
+
+    while (0 != (n = read(fd, page->data + page->size, capacity - page->size))) {
+        if (n < 0) {
+            free(page->data);
+            page->data = NULL;
+            return -1;
+        }
+
+        page->size += n;
+
+        if (page->size == capacity) {
+            capacity *= 2;
+
+            char* data = realloc(page->data, capacity);
+
+            if (NULL == data) {
+                free(page->data);
+                page->data = NULL;
+                return -1;
+            }
+
+            page->data = data;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Makes the whole file behind `fd` available as one block of bytes.
+ * The descriptor can be closed as soon as this returns.
+ *
+ * @param  page To store the contents
+ * @param  fd   The descriptor of the page
+ * @return      0 on success, -1 otherwise
+ */
+static inline int page_from_fd(Page* page, int fd) {
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) { return -1; }
+
+    if (!S_ISREG(st.st_mode)) { return page_read_fd(page, fd); }
+
+    page->size = st.st_size;
+    page->mapped = 0;
+    page->data = NULL;
+
+    // mmap can't map an empty file, but there is nothing to read either
+    if (0 == page->size) { return 0; }
+
+    page->data = mmap(NULL, page->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (MAP_FAILED == page->data) {
+        // Some filesystems don't support mmap, so read it instead
+        page->data = NULL;
+        return page_read_fd(page, fd);
+    }
+
+    page->mapped = 1;
+
+    return 0;
+}
+
+/**
+ * Opens the page at `path`
+ *
+ * @param  page To store the contents
+ * @param  path The filepath to the page
+ * @return      0 on success, -1 if the page couldn't be opened or read
+ */
+static inline int page_open(Page* page, const char* path) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) { return -1; }
+
+    int status = page_from_fd(page, fd);
+
+    close(fd);
+
+    return status;
+}
+
+/**
+ * Releases the contents of the page
+ *
+ * @param page The page to release
+ */
+static inline void page_close(Page* page) {
+    if (page->mapped) {
+        munmap(page->data, page->size);
+    } else {
+        free(page->data);
+    }
+
+    page->data = NULL;
+    page->size = 0;
+}
+
+/**
+ * Gets a view of the line starting at `*cursor`, and moves the cursor
+ * to the start of the following line.
+ *
+ * @param  page   The page to read from
+ * @param  cursor The offset of the line in the page, start with 0
+ * @param  line   To store the view of the line
+ * @return        1 if a line was read, 0 at the end of the page
+ */
+static inline int page_next_line(const Page* page, size_t* cursor, LineView* line) {
+    if (*cursor >= page->size) { return 0; }
+
+    const char* start = page->data + *cursor;
+    const char* newline = memchr(start, '\n', page->size - *cursor);
+
+    line->start = start;
+    line->len = (NULL == newline) ? page->size - *cursor : (size_t) (newline + 1 - start);
+
+    *cursor += line->len;
+
+    return 1;
+}
+
+#endif
@@ -4,12 +4,29 @@
  * @author Mrigank Kumar
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "page_reader.h"
+
 #define SCCP static const char*  /* To reduce line length */
 /* (SCCP = Static Const Char Pointer) */
 
@@ -21,6 +38,8 @@
 
 #define MAX_FILENAME_LENGTH 100  /* Maximum length of the name of a file */
 #define MAX_STR_LENGTH 256       /* Maximum length of a str or char[] */
+#define MAX_PATH_LENGTH (MAX_FILENAME_LENGTH + MAX_STR_LENGTH)  /* base + file */
+#define INDEX_FILE_MODE 0644  /* Permissions of the index and its lock */
 
 #define IS_NULL(x) if (NULL == x)       /* Descriptive to avoid mistakes */
 #define IS_NOT_NULL(x) if (NULL != x)   /* Descriptive to avoid mistakes */
@@ -32,6 +51,42 @@
 #define DESCRIPTION "DESCRIPTION"  /* To find the description section */
 #define NAME "NAME"                /* To find the name section */
 
+#define BUILD_INDEX_FLAG "--build-index"  /* CLA to build the search index */
+#define UPDATE_FLAG "--update"            /* CLA to refresh the search index */
+#define DAEMON_FLAG "--daemon"            /* CLA to run the query daemon */
+#define THREADS_FLAG "-j"                 /* CLA to set the number of threads */
+#define AND_FLAG "-a"                     /* CLA to find pages with all terms */
+#define OR_FLAG "-o"                      /* CLA to find pages with any term */
+#define FUZZY_FLAG "-f"                   /* CLA to find terms close to the keyword */
+#define QUERY_PREFIX '*'                  /* Marks a query term as a prefix */
+
+#define PAGES_INITIAL_CAPACITY 128  /* Pages collected before growing */
+
+#define DAEMON_BACKLOG 64           /* Pending connections to the daemon */
+#define DAEMON_MAX_REQUEST 65536    /* Maximum size of a request, in bytes */
+#define DAEMON_MAX_ARGS 256         /* Maximum number of arguments in a request */
+#define DAEMON_TIMEOUT_SEC 1        /* Seconds to wait for a slow client */
+#define DAEMON_WORKERS 4            /* Processes answering queries at once */
+
+/* Events that may change what the pages of a section contain */
+#define SECTION_EVENTS (IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE \
+                        | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#define WATCH_BUFFER_SIZE 4096  /* Bytes of watch events read at once */
+
+#define INDEX_MAGIC 0x49504157  /* "WAPI" in little endian */
+#define INDEX_VERSION 5         /* Bumped whenever the index layout changes */
+#define MAX_REMOVED_FRACTION 4  /* Rebuild once 1/4 of the doc ids are removed */
+
+#define DICT_BLOCK_SIZE 16  /* Terms per front coded dictionary block */
+#define SKIP_INTERVAL 64    /* Doc ids between two skip table entries */
+
+#define TRIGRAM_PAD NULL_TERMINATOR  /* Pads terms so their ends form trigrams */
+#define MAX_FUZZY_DISTANCE 2         /* Most edits between a keyword and a term */
+#define TRIGRAMS_PER_EDIT 4          /* Most trigrams an edit can change */
+
+#define TERM_TABLE_INITIAL_CAPACITY 4096  /* Slots in the builder hash table */
+#define POSTINGS_INITIAL_CAPACITY 4       /* Doc ids per term before growing */
+
 #define FILE_EXTENSION_SEPARATOR '.'  /* The file extension character */
 #define NULL_TERMINATOR '\0'          /* String terminator character */
 #define SPACE ' '                     /* The space character */
@@ -40,7 +95,9 @@
 /////////////////////////        Format Strings        /////////////////////////
 
 // If the program was invoked incorrectly
-SCCP INVALID_USE = "Usage: ./wapropos <keyword>\n";
+SCCP INVALID_USE = "Usage: ./wapropos [-j <threads>] <keyword>  or  "
+                   "./wapropos -a|-o <term>[*] ...  or  ./wapropos -f <keyword>  or  "
+                   "./wapropos --build-index|--update  or  ./wapropos --daemon\n";
 
 // If no arguments were provided
 SCCP NO_ARG = "wapropos what?\n";
@@ -57,6 +114,33 @@ SCCP ERROR_IN_FOPEN = "File `%s` was found, but could not be opened to read\n";
 // If opendir failed
 SCCP ERROR_IN_OPENDIR = "Error in opening directory `%s`\n";
 
+// If a worker thread could not be started
+SCCP ERROR_IN_PTHREAD = "Couldn't start worker thread %i\n";
+
+// If a term query was run before building the index
+SCCP NO_INDEX = "No search index, run ./wapropos --build-index first\n";
+
+// If the index is older than the pages
+SCCP STALE_INDEX = "The search index is out of date, run ./wapropos --update\n";
+
+// If the index could not be written
+SCCP ERROR_IN_INDEX_WRITE = "Couldn't write the index to `%s`\n";
+
+// If malloc failed
+SCCP ERROR_IN_MALLOC = "malloc failed in function `%s`\n";
+
+// After the index was built
+SCCP INDEX_BUILT = "Indexed %i pages (%i terms) into `%s`\n";
+
+// After the index was updated
+SCCP INDEX_UPDATED = "Updated `%s`: %i new, %i changed, %i removed pages\n";
+
+// If the daemon's socket could not be set up
+SCCP ERROR_IN_SOCKET = "Couldn't listen on `%s`\n";
+
+// Once the daemon is ready for queries
+SCCP DAEMON_LISTENING = "Listening on `%s`\n";
+
 // Output wapropos
 SCCP WAPROPOS_OUTPUT = "%s (%i) - %s";
 
@@ -65,10 +149,21 @@ SCCP WAPROPOS_OUTPUT = "%s (%i) - %s";
 /* Link: https://stackoverflow.com/q/12971499/10812282 */
 #if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
 SCCP BASE_FILEPATH = ".\\man_pages\\man%i\\";
+SCCP MAN_PAGES_DIRPATH = ".\\man_pages\\";
+SCCP INDEX_FILEPATH = ".\\man_pages\\.wapropos.index";
+SCCP INDEX_LOCK_FILEPATH = ".\\man_pages\\.wapropos.lock";
+SCCP SOCKET_FILEPATH = ".\\man_pages\\.wapropos.sock";
 #else
 SCCP BASE_FILEPATH = "./man_pages/man%i/";
+SCCP MAN_PAGES_DIRPATH = "./man_pages/";
+SCCP INDEX_FILEPATH = "./man_pages/.wapropos.index";
+SCCP INDEX_LOCK_FILEPATH = "./man_pages/.wapropos.lock";
+SCCP SOCKET_FILEPATH = "./man_pages/.wapropos.sock";
 #endif
 
+// Each writer builds the index in its own file, then renames it into place
+SCCP INDEX_TMP_FILEPATH = "%s.%i.tmp";
+
 /////////////////////////      End Format Strings      /////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -129,6 +224,176 @@ void print_apropos(char* name, int section) {
 ////////////////////////////////////////////////////////////////////////////////
 
 
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////        Keyword Matcher       /////////////////////////
+
+typedef struct {
+    const char* keyword;  /* The keyword to search for */
+    size_t len;           /* Length of the keyword */
+    size_t skip[256];     /* Horspool shift for every possible last byte */
+} Matcher;
+
+typedef struct {
+    const char* name;  /* The NAME one-liner, NULL if the page has none */
+    size_t name_len;   /* Length of the one-liner, including its newline */
+    const char* desc;  /* The DESCRIPTION lines, NULL if the page has none */
+    size_t desc_len;   /* Length of the indented DESCRIPTION lines */
+} PageSections;
+
+/**
+ * Preprocesses the keyword once per query, building the Horspool skip table
+ *
+ * For every byte, the skip table holds how far the keyword can be shifted
+ * when that byte is under the last character of the keyword. Bytes that
+ * don't occur in the keyword shift it by its full length.
+ *
+ * @param matcher To store the preprocessed keyword
+ * @param keyword The keyword to search for, must outlive the matcher
+ */
+void matcher_init(Matcher* matcher, const char* keyword) {
+    matcher->keyword = keyword;
+    matcher->len = strlen(keyword);
+
+    for (int c = 0; c < 256; c++) { matcher->skip[c] = matcher->len; }
+
+    // The last character is left out, so a mismatch always moves forward
+    for (size_t i = 0; i + 1 < matcher->len; i++) {
+        matcher->skip[(unsigned char) keyword[i]] = matcher->len - 1 - i;
+    }
+}
+
+/**
+ * Finds the first occurrence of the keyword in `text`
+ *
+ * @param  matcher The preprocessed keyword
+ * @param  text    The text to search in, need not be NUL terminated
+ * @param  len     The length of `text`
+ * @return         The start of the first match, NULL if there is none
+ */
+const char* matcher_find(const Matcher* matcher, const char* text, size_t len) {
+    size_t n = matcher->len;
+
+    // Same as strstr, an empty keyword is found everywhere
+    if (0 == n) { return text; }
+
+    if (n > len) { return NULL; }
+
+    // memchr is already vectorized by libc
+    if (1 == n) { return memchr(text, matcher->keyword[0], len); }
+
+    unsigned char last = matcher->keyword[n - 1];
+
+    for (size_t pos = 0; pos + n <= len;) {
+        unsigned char c = text[pos + n - 1];
+
+        if (c == last && 0 == memcmp(text + pos, matcher->keyword, n - 1)) {
+            return text + pos;
+        }
+
+        pos += matcher->skip[c];
+    }
+
+    return NULL;
+}
+
+/**
+ * Whether the keyword occurs within a single line of `text`
+ * A keyword containing a newline can't be found across two lines, as the
+ * pages used to be searched one line at a time.
+ *
+ * @param  matcher The preprocessed keyword
+ * @param  text    The lines to search in
+ * @param  len     The length of `text`
+ * @return         _TRUE_ if the keyword was found, _FALSE_ otherwise
+ */
+static int matcher_in_lines(const Matcher* matcher, const char* text, size_t len) {
+    const char* end = text + len;
+    const char* match;
+
+    while (NULL != (match = matcher_find(matcher, text, end - text))) {
+        // Only a trailing newline is allowed, like in an fgets buffer
+        if (matcher->len < 2 || NULL == memchr(match, '\n', matcher->len - 1)) {
+            return _TRUE_;
+        }
+
+        text = match + 1;
+    }
+
+    return _FALSE_;
+}
+
+/**
+ * Whether the line contains the given heading
+ *
+ * @param  line    The start of the line
+ * @param  len     The length of the line
+ * @param  heading The heading to look for
+ * @return         _TRUE_ if `heading` occurs in the line, _FALSE_ otherwise
+ */
+static inline int line_has(const char* line, size_t len, const char* heading) {
+    size_t n = strlen(heading);
+
+    for (const char* c = line; (c = memchr(c, heading[0], line + len - c));) {
+        if ((size_t) (line + len - c) < n) { break; }
+        if (0 == memcmp(c, heading, n)) { return _TRUE_; }
+        c++;
+    }
+
+    return _FALSE_;
+}
+
+/**
+ * Finds the NAME one-liner and the DESCRIPTION lines of a page
+ *
+ * Section headings are the lines without leading spaces. The one-liner is
+ * the line right after the NAME heading, and the description is every
+ * indented line right after the DESCRIPTION heading. Anything after the
+ * DESCRIPTION heading is ignored, including a later NAME heading.
+ *
+ * @param sections To store the sections found, these point into `page`
+ * @param page     The page to search in
+ */
+void find_page_sections(PageSections* sections, const Page* page) {
+    size_t cursor = 0;
+    LineView line;
+
+    sections->name = NULL;
+    sections->name_len = 0;
+    sections->desc = NULL;
+    sections->desc_len = 0;
+
+    while (page_next_line(page, &cursor, &line)) {
+        // The section headings do not have leading spaces
+        if (line.start[0] == SPACE) { continue; }
+
+        if (line_has(line.start, line.len, NAME)) {
+            // The very next line after NAME should be the one-liner
+            if (!page_next_line(page, &cursor, &line)) {
+                // THIS SHOULD IDEALLY NEVER EXECUTE
+                fprintf(stderr, "%s\n", "Name section not found. Aborting");
+                exit(WAPROPOS_FAILURE);
+            }
+
+            sections->name = line.start;
+            sections->name_len = line.len;
+        }
+        else if (line_has(line.start, line.len, DESCRIPTION)) {
+            sections->desc = page->data + cursor;
+
+            // The description runs until the next line without indentation
+            while (page_next_line(page, &cursor, &line) && line.start[0] == SPACE) {
+                sections->desc_len += line.len;
+            }
+
+            return;
+        }
+    }
+}
+
+/////////////////////////      End Keyword Matcher     /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////        Search Function       /////////////////////////
 
@@ -146,70 +411,57 @@ static inline void join_file_to_base(char* str, char* base, char* filename) {
     }
 }
 
+/**
+ * realloc, but exits the program if the allocation failed
+ *
+ * @param  ptr  The memory to resize, or NULL to allocate
+ * @param  size The new size in bytes
+ * @param  func The name of the calling function, for the error message
+ * @return      The resized memory
+ */
+static void* checked_realloc(void* ptr, size_t size, const char* func) {
+    void* mem = realloc(ptr, size);
+
+    IS_NULL(mem) {
+        fprintf(stderr, ERROR_IN_MALLOC, func);
+        exit(WAPROPOS_FAILURE);
+    }
+
+    return mem;
+}
+
 /**
  * Checks whether the given file contains the keyword
  *
  * If it does, this function returns the one line name section
  *
- * @param  handle  The file to search for the keyword in
- * @param  keyword The keyword to search for
+ * The preprocessed keyword is matched against the NAME one-liner and then
+ * against the DESCRIPTION lines as a single block of the mapped page,
+ * instead of calling `strstr` on every line.
+ *
+ * @param  page    The page to search for the keyword in
+ * @param  matcher The preprocessed keyword to search for
  * @return         The heap allocated char array containing the
  *                 name one-liner if the keyword was found.
  *                 NULL otherwise.
  */
-char* contains_keyword(FILE* handle, char* keyword) {
-    char buffer[MAX_STR_LENGTH];
-    int to_check = _FALSE_;
+char* contains_keyword(const Page* page, const Matcher* matcher) {
+    PageSections sections;
+    find_page_sections(&sections, page);
 
     char* name = NULL;
 
-    while (NULL != fgets(buffer, MAX_STR_LENGTH, handle)) {
-        // The section headings do not have leading spaces
-        if (buffer[0] == SPACE) { continue; }
-        // Names are supposed to be one liners, so check them immediately
-        if (strstr(buffer, NAME) != NULL) {
-            name = malloc(sizeof(char) * MAX_STR_LENGTH);
-
-            // malloc success check
-            IS_NULL(name) {
-                fprintf(stderr, "malloc failed in function `contains_keyword`");
-                free(name);
-                exit(WAPROPOS_FAILURE);
-            }
-
-            // The very next line after NAME should be the one-liner
-            if(NULL == fgets(name, MAX_STR_LENGTH, handle)) {
-                // THIS SHOULD IDEALLY NEVER EXECUTE
-                fprintf(stderr, "%s\n", "Name section not found. Aborting");
-                free(name);
-                exit(WAPROPOS_FAILURE);
-            }
-
-            // If the NAME section contains the keyword,
-            // skip checking the DESCRIPTION
-            if (strstr(name, keyword) != NULL) { return name; }
-        }
-        // Descriptions are longer, check them in an different (outer) loop.
-        else if (strstr(buffer, "DESCRIPTION") != NULL) {
-            to_check = _TRUE_;
-            break;
-        }
-    }
-
-    // If we never found a description section,
-    // and didn't return early from the NAME section
-    if (_FALSE_ == to_check) { return NULL; }
-
-    // Only checking the description section now
-    // If there's a section after description, this code will check that too,
-    // so a potential bug here.
-    while (NULL != fgets(buffer, MAX_STR_LENGTH, handle)) {
-        if (buffer[0] != SPACE) { break; }
-        if (strstr(buffer, keyword)) { return name; }
+    // A page without a name is never printed
+    if (NULL != sections.name
+        && (matcher_in_lines(matcher, sections.name, sections.name_len)
+            || (NULL != sections.desc
+                && matcher_in_lines(matcher, sections.desc, sections.desc_len)))) {
+        name = checked_realloc(NULL, sections.name_len + 1, "contains_keyword");
+        memcpy(name, sections.name, sections.name_len);
+        name[sections.name_len] = NULL_TERMINATOR;
     }
 
-    // If `keyword` wasn't found, return NULL
-    return NULL;
+    return name;
 }
 
 /**
@@ -227,15 +479,19 @@ int search_keyword(char* keyword) {
     struct dirent* entry;
 
     // For file operations
-    FILE* handle;
+    Page page;
 
     // Count number of instances found
     int count = 0;
 
+    // Preprocess the keyword once for all pages
+    Matcher matcher;
+    matcher_init(&matcher, keyword);
+
     // Look through every man_pages section, i.e man`i` for i in [1, 9]
     for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
         // Store the name of the file
-        char filename[MAX_FILENAME_LENGTH];
+        char filename[MAX_PATH_LENGTH];
 
         // Store the name of the base directory
         char base[MAX_FILENAME_LENGTH];
@@ -268,18 +524,15 @@ int search_keyword(char* keyword) {
             // If we don't have read access, we can't read!
             if (access(filename, R_OK)) continue;
 
-            // Get a file handle
-            handle = fopen(filename, "r");
-
-            // NULL check, esnure fopen worked
-            IS_NULL(handle) {
+            // Map the page, ensure it worked
+            if (page_open(&page, filename) < 0) {
                 fprintf(stderr, ERROR_IN_FOPEN, filename);
                 exit(WAPROPOS_FAILURE);
             }
 
             // If the file contains the keyword, this var will contain
             // the `name_one_liner`, the one-line content of the NAME portion
-            char* name = contains_keyword(handle, keyword);
+            char* name = contains_keyword(&page, &matcher);
 
             // NULL means keyword was not found in this file
             IS_NOT_NULL(name) {
@@ -291,8 +544,8 @@ int search_keyword(char* keyword) {
                 count++; // increment number of files found with `keyword`
             }
 
-            // Close the file handle
-            fclose(handle);
+            // Unmap the page
+            page_close(&page);
         }
 
         // Close the directory
@@ -308,26 +561,3331 @@ int search_keyword(char* keyword) {
 
 
 ////////////////////////////////////////////////////////////////////////////////
-/////////////////////////             MAIN             /////////////////////////
+/////////////////////////        Parallel Search       /////////////////////////
+
+typedef struct {
+    int section;  /* The section the page was found in */
+    char* path;   /* The filepath to the page */
+} PageEntry;
+
+typedef struct {
+    PageEntry* pages;      /* Every page to search, in print order */
+    size_t n_pages;        /* The number of pages */
+    Matcher* matcher;      /* The preprocessed keyword to search for */
+    char** names;          /* Result of `contains_keyword` for each page */
+    char* done;            /* Whether each page has been searched */
+    size_t next;           /* The next page to hand out to a worker */
+    pthread_mutex_t lock;  /* Guards `names`, `done` and `next` */
+    pthread_cond_t cond;   /* Signalled whenever a page is done */
+} ScanPool;
 
-int main(int argc, char* argv[]) {
-    // Arg parse
-    switch (argc - 1) {
-        case 0: // Usage was : ./wapropos
-            _PRINTF_(NO_ARG);
-            break;
-        case 1: // Usage was: ./wapropos <keyword>
-            // If no file contain the specified keyword
-            if(0 == search_keyword(argv[1])) { _PRINTF_(KEYWORD_NOT_FOUND); }
+/**
+ * Lists every readable manual page, in the order `search_keyword` visits them
+ *
+ * @param  pages To store the heap allocated array of pages
+ * @return       The number of pages found
+ */
+size_t collect_pages(PageEntry** pages) {
+    DIR* dir;
+    struct dirent* entry;
 
-            break;
-        default: // Usage was: ./wapropos <arg1> <arg2> ... <argc-1>
-            _PRINTF_(INVALID_USE);
-            break;
+    size_t n_pages = 0;
+    size_t capacity = 0;
+
+    *pages = NULL;
+
+    for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+        char filename[MAX_PATH_LENGTH];
+        char base[MAX_FILENAME_LENGTH];
+
+        IF_FORMAT_FAILED(sprintf(base, BASE_FILEPATH, section)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "collect_pages");
+            exit(WAPROPOS_FAILURE);
+        }
+
+        dir = opendir(base);
+
+        IS_NULL(dir) {
+            fprintf(stderr, ERROR_IN_OPENDIR, base);
+            exit(WAPROPOS_FAILURE);
+        }
+
+        while (NULL != (entry = readdir(dir))) {
+            // Ignore hidden files, cwd and parent
+            if (entry->d_name[0] == '.') continue;
+
+            join_file_to_base(filename, base, entry->d_name);
+
+            if (access(filename, R_OK)) continue;
+
+            if (n_pages == capacity) {
+                capacity = capacity ? capacity * 2 : PAGES_INITIAL_CAPACITY;
+                *pages = checked_realloc(*pages, sizeof(PageEntry) * capacity,
+                                         "collect_pages");
+            }
+
+            (*pages)[n_pages].section = section;
+            (*pages)[n_pages].path = strdup(filename);
+
+            IS_NULL((*pages)[n_pages].path) {
+                fprintf(stderr, ERROR_IN_MALLOC, "collect_pages");
+                exit(WAPROPOS_FAILURE);
+            }
+
+            n_pages++;
+        }
+
+        closedir(dir);
     }
 
-    // Program succeeded
-    return WAPROPOS_SUCCESS;
+    return n_pages;
+}
+
+/**
+ * Frees the pages returned by `collect_pages`
+ *
+ * @param pages   The pages to free
+ * @param n_pages The number of pages
+ */
+void destroy_pages(PageEntry* pages, size_t n_pages) {
+    for (size_t i = 0; i < n_pages; i++) { free(pages[i].path); }
+
+    free(pages);
+}
+
+/**
+ * Worker thread for `search_keyword_parallel`
+ * Repeatedly claims the next unsearched page until none are left.
+ *
+ * @param  arg The shared ScanPool
+ * @return     NULL
+ */
+static void* scan_worker(void* arg) {
+    ScanPool* pool = arg;
+
+    while (_TRUE_) {
+        pthread_mutex_lock(&pool->lock);
+        size_t i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (i >= pool->n_pages) { break; }
+
+        Page page;
+
+        if (page_open(&page, pool->pages[i].path) < 0) {
+            fprintf(stderr, ERROR_IN_FOPEN, pool->pages[i].path);
+            exit(WAPROPOS_FAILURE);
+        }
+
+        char* name = contains_keyword(&page, pool->matcher);
+
+        page_close(&page);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->names[i] = name;
+        pool->done[i] = _TRUE_;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Same as `search_keyword`, but spreads the pages over `n_threads` workers
+ *
+ * The main thread prints the results as soon as every page before them
+ * has been searched, so the output order is identical to `search_keyword`.
+ *
+ * @param  keyword   The keyword to search for
+ * @param  n_threads The number of worker threads
+ * @return           The number of files containing the given keyword.
+ */
+int search_keyword_parallel(char* keyword, int n_threads) {
+    Matcher matcher;
+    matcher_init(&matcher, keyword);
+
+    ScanPool pool = { .matcher = &matcher, .next = 0 };
+
+    pool.n_pages = collect_pages(&pool.pages);
+
+    // No point in starting more workers than there are pages
+    if ((size_t) n_threads > pool.n_pages) { n_threads = pool.n_pages; }
+
+    pool.names = calloc(pool.n_pages + 1, sizeof(char*));
+    pool.done = calloc(pool.n_pages + 1, sizeof(char));
+
+    pthread_t* threads = calloc(n_threads + 1, sizeof(pthread_t));
+
+    if (NULL == pool.names || NULL == pool.done || NULL == threads) {
+        fprintf(stderr, ERROR_IN_MALLOC, "search_keyword_parallel");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    for (int i = 0; i < n_threads; i++) {
+        if (0 != pthread_create(&threads[i], NULL, scan_worker, &pool)) {
+            fprintf(stderr, ERROR_IN_PTHREAD, i);
+            exit(WAPROPOS_FAILURE);
+        }
+    }
+
+    int count = 0;
+
+    // Print in page order, waiting for pages that are still being searched
+    for (size_t i = 0; i < pool.n_pages; i++) {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.done[i]) { pthread_cond_wait(&pool.cond, &pool.lock); }
+        pthread_mutex_unlock(&pool.lock);
+
+        IS_NOT_NULL(pool.names[i]) {
+            print_apropos(pool.names[i], pool.pages[i].section);
+            free(pool.names[i]);
+            count++;
+        }
+    }
+
+    for (int i = 0; i < n_threads; i++) { pthread_join(threads[i], NULL); }
+
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.cond);
+
+    free(threads);
+    free(pool.names);
+    free(pool.done);
+    destroy_pages(pool.pages, pool.n_pages);
+
+    return count;
+}
+
+/////////////////////////      End Parallel Search     /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Index Layout         /////////////////////////
+
+/**
+ * On-disk layout of the search index built by `wapropos --build-index`
+ * All offsets are in bytes from the start of their region, and all fixed
+ * width integers are stored in host byte order.
+ *
+ *     IndexHeader
+ *     IndexDoc[n_docs]            One entry per indexed page
+ *     IndexBlock[n_blocks]        Where every dictionary block starts
+ *     IndexTrigram[n_trigrams]    Every trigram of the terms, sorted
+ *     uint8_t[]                   The dictionary
+ *     uint8_t[]                   The posting lists
+ *     uint8_t[]                   The term lists of the trigrams
+ *     char[]                      String pool, every string is NUL terminated
+ *
+ * The dictionary holds the terms sorted as unsigned bytes, front coded in
+ * blocks of DICT_BLOCK_SIZE terms. Every term is stored as
+ *
+ *     varint shared   Bytes shared with the previous term, 0 for the
+ *                     first term of a block so blocks can be binary searched
+ *     varint suffix   Length of the rest of the term
+ *     char[suffix]    The rest of the term
+ *     varint n_docs   Number of pages containing the term
+ *     varint n_bytes  Size of the term's posting list
+ *
+ * A posting list is the sorted doc ids of a term, stored as varint deltas.
+ * Lists longer than SKIP_INTERVAL start with a skip table, with one
+ * IndexSkip for every SKIP_INTERVAL doc ids after the first, so an
+ * intersection can jump over the doc ids it doesn't need.
+ *
+ * For fuzzy search, every term is lowercased and padded with TRIGRAM_PAD
+ * on both ends, so a term of length n has n trigrams. A trigram's term
+ * list is the sorted ordinals (positions in the dictionary) of the terms
+ * containing it, stored as varint deltas.
+ *
+ * A full build numbers the pages in scan order. `--update` keeps the doc
+ * ids of unchanged pages, gives new pages the next free doc ids and leaves
+ * removed pages behind as doc ids in no posting list, so `rank` remembers
+ * the scan order results are printed in.
+ *
+ * Only the NAME one-liner and the DESCRIPTION lines of a page are indexed,
+ * which is the same text `contains_keyword` searches in. A term is a
+ * maximal run of word characters, so a keyword consisting of only word
+ * characters is found in a page iff it is a substring of one of its terms.
+ */
+typedef struct {
+    uint32_t magic;         /* Always INDEX_MAGIC */
+    uint32_t version;       /* Always INDEX_VERSION */
+    uint32_t n_docs;        /* Number of indexed pages */
+    uint32_t n_terms;       /* Number of distinct terms */
+    uint32_t n_blocks;      /* Number of dictionary blocks */
+    uint32_t max_term_len;  /* Length of the longest term */
+    uint32_t n_removed;     /* Number of doc ids of removed pages */
+    uint32_t in_order;      /* Whether doc ids are in scan order */
+    uint32_t n_trigrams;    /* Number of distinct trigrams */
+    uint32_t reserved;      /* Padding, always 0 */
+    uint64_t docs_off;      /* Offset of the IndexDoc table */
+    uint64_t blocks_off;    /* Offset of the IndexBlock table */
+    uint64_t trigrams_off;  /* Offset of the IndexTrigram table */
+    uint64_t dict_off;      /* Offset of the dictionary */
+    uint64_t postings_off;  /* Offset of the posting lists */
+    uint64_t term_lists_off;  /* Offset of the trigrams' term lists */
+    uint64_t strings_off;   /* Offset of the string pool */
+    uint64_t size;          /* Total size of the file */
+    int64_t dir_mtime[MAX_SECTION + 1][2];  /* mtime of man<i>, -1 if missing */
+} IndexHeader;
+
+typedef struct {
+    uint32_t section;    /* The section the page was found in, 0 if removed */
+    uint32_t rank;       /* Position of the page in scan order */
+    uint32_t path_off;   /* Offset of the page's filepath in the string pool */
+    uint32_t name_off;   /* Offset of the NAME one-liner in the string pool */
+    uint64_t size;       /* Size of the page when it was indexed */
+    int64_t mtime_sec;   /* Modification time of the page when it was indexed */
+    int64_t mtime_nsec;  /* Nanoseconds of the modification time */
+} IndexDoc;
+
+typedef struct {
+    uint32_t dict_off;  /* Offset of the block's first term in the dictionary */
+    uint32_t post_off;  /* Offset of the block's first posting list */
+} IndexBlock;
+
+typedef struct {
+    uint32_t trigram;   /* Three lowercased bytes, the first in the high bits */
+    uint32_t n_terms;   /* Number of terms containing the trigram */
+    uint32_t list_off;  /* Offset of the term list */
+} IndexTrigram;
+
+typedef struct {
+    uint32_t base;  /* The last doc id before the skipped to chunk */
+    uint32_t off;   /* Offset of the chunk, from the end of the skip table */
+} IndexSkip;
+
+typedef struct {
+    uint8_t* data;    /* The encoded bytes */
+    size_t len;       /* Number of bytes used */
+    size_t capacity;  /* Number of bytes allocated */
+} ByteBuffer;
+
+/**
+ * Whether the given character is part of a term.
+ * Bytes >= 0x80 are treated as word characters so UTF-8 text stays intact.
+ *
+ * @param  c The character to check
+ * @return   _TRUE_ if `c` is a word character, _FALSE_ otherwise
+ */
+static inline int is_word_char(unsigned char c) {
+    return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+/**
+ * Gets the `i`th trigram of a term. The term is lowercased and padded
+ * with TRIGRAM_PAD on both ends, so every byte is the middle of a trigram
+ * and a term of length `len` has `len` trigrams.
+ *
+ * @param  term The term
+ * @param  len  The length of the term
+ * @param  i    The byte in the middle of the trigram
+ * @return      The trigram, the first byte in the high bits
+ */
+static inline uint32_t trigram_at(const char* term, size_t len, size_t i) {
+    uint32_t before = 0 == i ? TRIGRAM_PAD : tolower((unsigned char) term[i - 1]);
+    uint32_t middle = tolower((unsigned char) term[i]);
+    uint32_t after = len - 1 == i ? TRIGRAM_PAD : tolower((unsigned char) term[i + 1]);
+
+    return before << 16 | middle << 8 | after;
+}
+
+/**
+ * Makes room for `n` more bytes at the end of the buffer
+ *
+ * @param  buffer The buffer to grow
+ * @param  n      The number of bytes needed
+ * @return        Where the next byte should be written
+ */
+static uint8_t* buffer_reserve(ByteBuffer* buffer, size_t n) {
+    if (buffer->len + n > buffer->capacity) {
+        while (buffer->len + n > buffer->capacity) {
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2
+                                                : MAX_STR_LENGTH;
+        }
+
+        buffer->data = checked_realloc(buffer->data, buffer->capacity,
+                                       "buffer_reserve");
+    }
+
+    return buffer->data + buffer->len;
+}
+
+/**
+ * Appends bytes to the end of the buffer
+ *
+ * @param buffer The buffer to append to
+ * @param data   The bytes to append
+ * @param n      The number of bytes
+ */
+static inline void buffer_append(ByteBuffer* buffer, const void* data, size_t n) {
+    memcpy(buffer_reserve(buffer, n), data, n);
+    buffer->len += n;
+}
+
+/**
+ * Appends a varint, 7 bits per byte with the high bit set on all but the
+ * last byte, so small numbers take a single byte.
+ *
+ * @param buffer The buffer to append to
+ * @param value  The number to encode
+ */
+static void put_varint(ByteBuffer* buffer, uint64_t value) {
+    uint8_t* out = buffer_reserve(buffer, 10);
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    out[n++] = (uint8_t) value;
+    buffer->len += n;
+}
+
+/**
+ * Decodes the varint at `*pos`, and moves `*pos` past it
+ *
+ * @param  pos The position of the varint
+ * @return     The decoded number
+ */
+static inline uint64_t get_varint(const uint8_t** pos) {
+    uint64_t value = 0;
+    int shift = 0;
+
+    while (**pos & 0x80) {
+        value |= (uint64_t) (*(*pos)++ & 0x7f) << shift;
+        shift += 7;
+    }
+
+    return value | (uint64_t) *(*pos)++ << shift;
+}
+
+/**
+ * Gets the mtime of every section's directory. The index is current as
+ * long as none of them changed, since adding, removing or renaming a page
+ * changes the mtime of its directory.
+ *
+ * @param mtimes To store the mtimes, -1 for sections that don't exist
+ */
+void section_mtimes(int64_t mtimes[MAX_SECTION + 1][2]) {
+    char base[MAX_FILENAME_LENGTH];
+    struct stat st;
+
+    memset(mtimes, 0, sizeof(int64_t) * (MAX_SECTION + 1) * 2);
+
+    for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+        IF_FORMAT_FAILED(sprintf(base, BASE_FILEPATH, section)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "section_mtimes");
+            exit(WAPROPOS_FAILURE);
+        }
+
+        if (stat(base, &st) < 0) {
+            mtimes[section][0] = mtimes[section][1] = -1;
+            continue;
+        }
+
+        mtimes[section][0] = st.st_mtim.tv_sec;
+        mtimes[section][1] = st.st_mtim.tv_nsec;
+    }
+}
+
+/////////////////////////       End Index Layout       /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Index Builder        /////////////////////////
+
+typedef struct {
+    char* term;          /* The term, NUL terminated */
+    uint32_t len;        /* Length of the term */
+    uint32_t* docs;      /* Doc ids of the pages containing the term */
+    uint32_t n_docs;     /* Number of doc ids in `docs` */
+    uint32_t capacity;   /* Capacity of `docs` */
+} BuildTerm;
+
+typedef struct {
+    BuildTerm** slots;   /* Open addressing hash table */
+    uint32_t capacity;   /* Number of slots, always a power of 2 */
+    uint32_t n_terms;    /* Number of occupied slots */
+} TermTable;
+
+typedef struct {
+    int section;         /* The section the page was found in, 0 if removed */
+    uint32_t rank;       /* Position of the page in scan order */
+    const char* path;    /* The filepath to the page */
+    char* name;          /* The NAME one-liner of the page, NULL if none */
+    uint64_t size;       /* Size of the page when it was indexed */
+    int64_t mtime_sec;   /* Modification time of the page when it was indexed */
+    int64_t mtime_nsec;  /* Nanoseconds of the modification time */
+} BuildDoc;
+
+typedef struct {
+    ByteBuffer dict;        /* The front coded dictionary */
+    ByteBuffer postings;    /* The posting lists */
+    ByteBuffer blocks;      /* An IndexBlock for every DICT_BLOCK_SIZE terms */
+    ByteBuffer prev;        /* The previous term, to front code against */
+    ByteBuffer trigrams;    /* (trigram << 32 | term ordinal) of every term */
+    uint32_t n_terms;       /* Number of terms written */
+    uint32_t max_term_len;  /* Length of the longest term written */
+} DictWriter;
+
+/**
+ * FNV-1a hash of the first `len` bytes of `str`
+ *
+ * @param  str The string to hash
+ * @param  len The number of bytes to hash
+ * @return     The hash
+ */
+static inline uint32_t hash_term(const char* str, size_t len) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Doubles the capacity of the term table, rehashing every term
+ *
+ * @param table The table to grow
+ */
+static void term_table_grow(TermTable* table) {
+    uint32_t capacity = table->capacity ? table->capacity * 2
+                                        : TERM_TABLE_INITIAL_CAPACITY;
+
+    BuildTerm** slots = calloc(capacity, sizeof(BuildTerm*));
+
+    IS_NULL(slots) {
+        fprintf(stderr, ERROR_IN_MALLOC, "term_table_grow");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        BuildTerm* term = table->slots[i];
+
+        IS_NULL(term) { continue; }
+
+        uint32_t slot = hash_term(term->term, term->len) & (capacity - 1);
+
+        // linear probing
+        while (NULL != slots[slot]) { slot = (slot + 1) & (capacity - 1); }
+
+        slots[slot] = term;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+}
+
+/**
+ * Records that the page `doc` contains the given term
+ *
+ * Pages are indexed in increasing doc id order, so the posting lists stay
+ * sorted, and a repeated term in the same page only has to check the
+ * last doc id.
+ *
+ * @param table The table to add the term to
+ * @param str   The start of the term (need not be NUL terminated)
+ * @param len   The length of the term
+ * @param doc   The doc id of the page containing the term
+ */
+static void term_table_add(TermTable* table, const char* str, size_t len,
+                           uint32_t doc) {
+    // Keep the load factor under 1/2
+    if (2 * (table->n_terms + 1) > table->capacity) { term_table_grow(table); }
+
+    uint32_t slot = hash_term(str, len) & (table->capacity - 1);
+    BuildTerm* term;
+
+    while (NULL != (term = table->slots[slot])) {
+        if (term->len == len && 0 == memcmp(term->term, str, len)) { break; }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    // First time seeing this term
+    IS_NULL(term) {
+        term = checked_realloc(NULL, sizeof(BuildTerm), "term_table_add");
+        term->term = checked_realloc(NULL, len + 1, "term_table_add");
+        memcpy(term->term, str, len);
+        term->term[len] = NULL_TERMINATOR;
+        term->len = len;
+        term->docs = NULL;
+        term->n_docs = 0;
+        term->capacity = 0;
+
+        table->slots[slot] = term;
+        table->n_terms++;
+    }
+
+    // Already recorded for this page
+    if (term->n_docs > 0 && term->docs[term->n_docs - 1] == doc) { return; }
+
+    if (term->n_docs == term->capacity) {
+        term->capacity = term->capacity ? term->capacity * 2
+                                        : POSTINGS_INITIAL_CAPACITY;
+        term->docs = checked_realloc(term->docs,
+                                     sizeof(uint32_t) * term->capacity,
+                                     "term_table_add");
+    }
+
+    term->docs[term->n_docs++] = doc;
+}
+
+/**
+ * Frees every term in the table, and the table's slots
+ *
+ * @param table The table to free
+ */
+static void term_table_destroy(TermTable* table) {
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        BuildTerm* term = table->slots[i];
+
+        IS_NULL(term) { continue; }
+
+        free(term->term);
+        free(term->docs);
+        free(term);
+    }
+
+    free(table->slots);
+}
+
+/**
+ * Splits the text into terms, and adds every term to the table
+ *
+ * @param table The table to add the terms to
+ * @param text  The text to tokenize, need not be NUL terminated
+ * @param len   The length of `text`
+ * @param doc   The doc id of the page the text belongs to
+ */
+static void tokenize_text(TermTable* table, const char* text, size_t len,
+                          uint32_t doc) {
+    const char* end = text + len;
+    const char* start = NULL;
+
+    for (const char* c = text;; c++) {
+        if (c < end && is_word_char(*c)) {
+            IS_NULL(start) { start = c; }
+            continue;
+        }
+
+        IS_NOT_NULL(start) {
+            term_table_add(table, start, c - start, doc);
+
+            // "\033[1mword" leaves "1mword", so also index "word" for
+            // term queries. It's a substring, so substring search is unchanged
+            if (start > text && (start[-1] == '[' || start[-1] == ';')) {
+                const char* word = start;
+
+                for (; word < c && isdigit((unsigned char) *word); word++);
+
+                if (word > start && word + 1 < c && *word == 'm') {
+                    term_table_add(table, word + 1, c - word - 1, doc);
+                }
+            }
+
+            start = NULL;
+        }
+
+        if (c == end) { break; }
+    }
+}
+
+/**
+ * Tokenizes the NAME and DESCRIPTION sections of the given file
+ *
+ * The sections are found with `find_page_sections`, same as
+ * `contains_keyword`, so the index answers a query the same way a scan
+ * of the page would.
+ *
+ * @param  page  The page to index
+ * @param  table The table to add the terms to
+ * @param  doc   The doc id of the page
+ * @return       The heap allocated NAME one-liner if the page can show
+ *               up in the results. NULL otherwise.
+ */
+char* index_page(const Page* page, TermTable* table, uint32_t doc) {
+    PageSections sections;
+    find_page_sections(&sections, page);
+
+    char* name = NULL;
+
+    // A page without a name is never printed, don't bother
+    IS_NOT_NULL(sections.name) {
+        tokenize_text(table, sections.name, sections.name_len, doc);
+
+        IS_NOT_NULL(sections.desc) {
+            tokenize_text(table, sections.desc, sections.desc_len, doc);
+        }
+
+        name = checked_realloc(NULL, sections.name_len + 1, "index_page");
+        memcpy(name, sections.name, sections.name_len);
+        name[sections.name_len] = NULL_TERMINATOR;
+    }
+
+    return name;
+}
+
+/**
+ * Compares two terms as unsigned bytes, for qsort
+ */
+static int compare_build_terms(const void* a, const void* b) {
+    return strcmp((*(BuildTerm* const*) a)->term, (*(BuildTerm* const*) b)->term);
+}
+
+// The temporary file `write_index` is writing, removed if a write fails
+static char index_tmp_path[MAX_PATH_LENGTH];
+
+/**
+ * Writes `size` bytes to the index file, exits if the write failed
+ *
+ * @param handle The index file
+ * @param data   The bytes to write
+ * @param size   The number of bytes to write
+ */
+static inline void write_or_die(FILE* handle, const void* data, size_t size) {
+    if (size > 0 && 1 != fwrite(data, size, 1, handle)) {
+        fprintf(stderr, ERROR_IN_INDEX_WRITE, index_tmp_path);
+        unlink(index_tmp_path);
+        exit(WAPROPOS_FAILURE);
+    }
+}
+
+/**
+ * Encodes a sorted list of doc ids as varint deltas, preceded by a skip
+ * table if the list is longer than SKIP_INTERVAL.
+ *
+ * @param out    The buffer to append the posting list to
+ * @param docs   The sorted doc ids
+ * @param n_docs The number of doc ids
+ */
+void encode_postings(ByteBuffer* out, const uint32_t* docs, uint32_t n_docs) {
+    uint32_t n_skips = n_docs > SKIP_INTERVAL ? (n_docs - 1) / SKIP_INTERVAL : 0;
+
+    // The skip table is filled in as the chunks are written
+    size_t skips_at = out->len;
+    buffer_reserve(out, sizeof(IndexSkip) * n_skips);
+    out->len += sizeof(IndexSkip) * n_skips;
+
+    size_t data_at = out->len;
+    uint32_t prev = 0;
+
+    for (uint32_t i = 0; i < n_docs; i++) {
+        if (i > 0 && 0 == i % SKIP_INTERVAL) {
+            IndexSkip skip = { .base = prev, .off = out->len - data_at };
+
+            memcpy(out->data + skips_at, &skip, sizeof(IndexSkip));
+            skips_at += sizeof(IndexSkip);
+        }
+
+        put_varint(out, docs[i] - prev);
+        prev = docs[i];
+    }
+}
+
+/**
+ * Gets the NAME one-liner of a page, empty if the page has none
+ *
+ * @param  doc The page
+ * @return     The one-liner
+ */
+static inline const char* doc_name(const BuildDoc* doc) {
+    return NULL == doc->name ? "" : doc->name;
+}
+
+/**
+ * Appends a term to the dictionary
+ * Terms must be added in sorted order, right after their posting list was
+ * appended to `writer->postings`.
+ *
+ * @param writer  The dictionary being written
+ * @param term    The term (need not be NUL terminated)
+ * @param len     The length of the term
+ * @param n_docs  The number of doc ids in the term's posting list
+ * @param list_at Where the term's posting list starts in `writer->postings`
+ */
+void dict_writer_add(DictWriter* writer, const char* term, uint32_t len,
+                     uint32_t n_docs, size_t list_at) {
+    uint32_t shared = 0;
+
+    if (0 == writer->n_terms % DICT_BLOCK_SIZE) {
+        IndexBlock block = { .dict_off = writer->dict.len, .post_off = list_at };
+        buffer_append(&writer->blocks, &block, sizeof(IndexBlock));
+    } else {
+        while (shared < writer->prev.len && shared < len
+               && writer->prev.data[shared] == (uint8_t) term[shared]) {
+            shared++;
+        }
+    }
+
+    put_varint(&writer->dict, shared);
+    put_varint(&writer->dict, len - shared);
+    buffer_append(&writer->dict, term + shared, len - shared);
+    put_varint(&writer->dict, n_docs);
+    put_varint(&writer->dict, writer->postings.len - list_at);
+
+    writer->prev.len = 0;
+    buffer_append(&writer->prev, term, len);
+
+    if (len > writer->max_term_len) { writer->max_term_len = len; }
+
+    // Remember the term's trigrams, they are grouped by `encode_trigrams`
+    uint64_t* pairs = (uint64_t*) buffer_reserve(&writer->trigrams, len * sizeof(uint64_t));
+
+    for (uint32_t i = 0; i < len; i++) {
+        pairs[i] = (uint64_t) trigram_at(term, len, i) << 32 | writer->n_terms;
+    }
+
+    writer->trigrams.len += len * sizeof(uint64_t);
+
+    writer->n_terms++;
+}
+
+/**
+ * Frees the buffers of the dictionary writer
+ *
+ * @param writer The writer to free
+ */
+void dict_writer_destroy(DictWriter* writer) {
+    free(writer->dict.data);
+    free(writer->postings.data);
+    free(writer->blocks.data);
+    free(writer->prev.data);
+    free(writer->trigrams.data);
+}
+
+/**
+ * Gathers the terms of the table, sorted so they can be front coded
+ *
+ * @param  table   The table to gather the terms of
+ * @param  n_terms To store the number of terms
+ * @return         The heap allocated array of sorted terms
+ */
+BuildTerm** sort_terms(const TermTable* table, uint32_t* n_terms) {
+    BuildTerm** terms = checked_realloc(NULL,
+                                        sizeof(BuildTerm*) * (table->n_terms + 1),
+                                        "sort_terms");
+    *n_terms = 0;
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        IS_NOT_NULL(table->slots[i]) { terms[(*n_terms)++] = table->slots[i]; }
+    }
+
+    qsort(terms, *n_terms, sizeof(BuildTerm*), compare_build_terms);
+
+    return terms;
+}
+
+/**
+ * Front codes the terms of the table into the dictionary, and encodes
+ * their posting lists.
+ *
+ * @param table  The terms of all pages
+ * @param writer The dictionary to write to
+ */
+void encode_dictionary(const TermTable* table, DictWriter* writer) {
+    uint32_t n_terms;
+    BuildTerm** terms = sort_terms(table, &n_terms);
+
+    for (uint32_t i = 0; i < n_terms; i++) {
+        size_t list_at = writer->postings.len;
+        encode_postings(&writer->postings, terms[i]->docs, terms[i]->n_docs);
+
+        dict_writer_add(writer, terms[i]->term, terms[i]->len, terms[i]->n_docs,
+                        list_at);
+    }
+
+    free(terms);
+}
+
+/**
+ * Compares two (trigram, term ordinal) pairs, for qsort
+ */
+static int compare_trigram_pairs(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Groups the trigrams of every term written to the dictionary into the
+ * trigram table, and the term list of every trigram
+ *
+ * @param writer The dictionary, its trigram pairs are sorted inplace
+ * @param table  To store the IndexTrigram table
+ * @param lists  To store the term lists
+ */
+void encode_trigrams(DictWriter* writer, ByteBuffer* table, ByteBuffer* lists) {
+    uint64_t* pairs = (uint64_t*) writer->trigrams.data;
+    size_t n_pairs = writer->trigrams.len / sizeof(uint64_t);
+
+    qsort(pairs, n_pairs, sizeof(uint64_t), compare_trigram_pairs);
+
+    for (size_t i = 0; i < n_pairs;) {
+        IndexTrigram trigram = {
+            .trigram = pairs[i] >> 32,
+            .n_terms = 0,
+            .list_off = lists->len,
+        };
+
+        uint32_t prev = 0;
+
+        // A term with a repeated trigram is listed once
+        for (; i < n_pairs && pairs[i] >> 32 == trigram.trigram; i++) {
+            uint32_t term = (uint32_t) pairs[i];
+
+            if (trigram.n_terms > 0 && term == prev) { continue; }
+
+            put_varint(lists, term - prev);
+            prev = term;
+            trigram.n_terms++;
+        }
+
+        buffer_append(table, &trigram, sizeof(IndexTrigram));
+    }
+}
+
+/**
+ * Serializes the docs and the dictionary into the on-disk index format.
+ * The index is written to a temporary file first and then renamed over
+ * the old index, so concurrent queries never see a partial index.
+ *
+ * @param docs   The indexed pages, in doc id order
+ * @param n_docs The number of indexed pages
+ * @param writer The encoded dictionary and posting lists
+ * @param mtimes The mtimes of the sections, taken before listing them
+ */
+void write_index(BuildDoc* docs, uint32_t n_docs, DictWriter* writer,
+                 int64_t mtimes[MAX_SECTION + 1][2]) {
+    uint32_t n_blocks = writer->blocks.len / sizeof(IndexBlock);
+
+    ByteBuffer trigrams = { .data = NULL, .len = 0, .capacity = 0 };
+    ByteBuffer term_lists = { .data = NULL, .len = 0, .capacity = 0 };
+
+    encode_trigrams(writer, &trigrams, &term_lists);
+
+    uint32_t n_trigrams = trigrams.len / sizeof(IndexTrigram);
+
+    IndexHeader header = {
+        .magic = INDEX_MAGIC,
+        .version = INDEX_VERSION,
+        .n_docs = n_docs,
+        .n_terms = writer->n_terms,
+        .n_blocks = n_blocks,
+        .max_term_len = writer->max_term_len,
+        .n_removed = 0,
+        .in_order = _TRUE_,
+        .n_trigrams = n_trigrams,
+        .reserved = 0,
+    };
+
+    memcpy(header.dir_mtime, mtimes, sizeof(header.dir_mtime));
+
+    header.docs_off = sizeof(IndexHeader);
+    header.blocks_off = header.docs_off + sizeof(IndexDoc) * n_docs;
+    header.trigrams_off = header.blocks_off + sizeof(IndexBlock) * n_blocks;
+    header.dict_off = header.trigrams_off + sizeof(IndexTrigram) * n_trigrams;
+    header.postings_off = header.dict_off + writer->dict.len;
+    header.term_lists_off = header.postings_off + writer->postings.len;
+    header.strings_off = header.term_lists_off + term_lists.len;
+
+    // The string pool holds the paths and names of the pages
+    uint64_t strings_size = 0;
+    uint32_t last_rank = 0;
+
+    for (uint32_t i = 0; i < n_docs; i++) {
+        strings_size += strlen(docs[i].path) + 1 + strlen(doc_name(&docs[i])) + 1;
+
+        if (0 == docs[i].section) {
+            header.n_removed++;
+            continue;
+        }
+
+        // Queries can skip sorting by rank if the doc ids already are
+        if (docs[i].rank < last_rank) { header.in_order = _FALSE_; }
+
+        last_rank = docs[i].rank;
+    }
+
+    header.size = header.strings_off + strings_size;
+
+    if (strings_size > UINT32_MAX || writer->dict.len > UINT32_MAX
+        || writer->postings.len > UINT32_MAX || term_lists.len > UINT32_MAX) {
+        fprintf(stderr, ERROR_IN_INDEX_WRITE, INDEX_FILEPATH);
+        exit(WAPROPOS_FAILURE);
+    }
+
+    IF_FORMAT_FAILED(sprintf(index_tmp_path, INDEX_TMP_FILEPATH, INDEX_FILEPATH,
+                             (int) getpid())) {
+        fprintf(stderr, ERROR_IN_FORMAT, "write_index");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    FILE* handle = fopen(index_tmp_path, "wb");
+
+    IS_NULL(handle) {
+        fprintf(stderr, ERROR_IN_INDEX_WRITE, index_tmp_path);
+        exit(WAPROPOS_FAILURE);
+    }
+
+    write_or_die(handle, &header, sizeof(IndexHeader));
+
+    uint32_t str_off = 0;
+
+    for (uint32_t i = 0; i < n_docs; i++) {
+        IndexDoc doc = {
+            .section = docs[i].section,
+            .rank = docs[i].rank,
+            .size = docs[i].size,
+            .mtime_sec = docs[i].mtime_sec,
+            .mtime_nsec = docs[i].mtime_nsec,
+        };
+
+        doc.path_off = str_off;
+        str_off += strlen(docs[i].path) + 1;
+        doc.name_off = str_off;
+        str_off += strlen(doc_name(&docs[i])) + 1;
+
+        write_or_die(handle, &doc, sizeof(IndexDoc));
+    }
+
+    write_or_die(handle, writer->blocks.data, writer->blocks.len);
+    write_or_die(handle, trigrams.data, trigrams.len);
+    write_or_die(handle, writer->dict.data, writer->dict.len);
+    write_or_die(handle, writer->postings.data, writer->postings.len);
+    write_or_die(handle, term_lists.data, term_lists.len);
+
+    free(trigrams.data);
+    free(term_lists.data);
+
+    for (uint32_t i = 0; i < n_docs; i++) {
+        write_or_die(handle, docs[i].path, strlen(docs[i].path) + 1);
+        write_or_die(handle, doc_name(&docs[i]), strlen(doc_name(&docs[i])) + 1);
+    }
+
+    if (0 != fclose(handle) || 0 != rename(index_tmp_path, INDEX_FILEPATH)) {
+        fprintf(stderr, ERROR_IN_INDEX_WRITE, INDEX_FILEPATH);
+        unlink(index_tmp_path);
+        exit(WAPROPOS_FAILURE);
+    }
+}
+
+/**
+ * Stats and tokenizes a page
+ *
+ * The page is stat'ed before it is read, so if it changes while being
+ * indexed, the next `--update` sees a newer mtime and indexes it again.
+ *
+ * @param doc   The page to index, its section, rank and path must be set
+ * @param table The table to add the terms to
+ * @param id    The doc id of the page
+ */
+void index_doc(BuildDoc* doc, TermTable* table, uint32_t id) {
+    struct stat st;
+    Page page;
+
+    if (stat(doc->path, &st) < 0 || page_open(&page, doc->path) < 0) {
+        fprintf(stderr, ERROR_IN_FOPEN, doc->path);
+        exit(WAPROPOS_FAILURE);
+    }
+
+    doc->size = st.st_size;
+    doc->mtime_sec = st.st_mtim.tv_sec;
+    doc->mtime_nsec = st.st_mtim.tv_nsec;
+    doc->name = index_page(&page, table, id);
+
+    page_close(&page);
+}
+
+/**
+ * Takes the lock every writer of the index holds, so a `--build-index`,
+ * an `--update` and a query updating an out of date index never write it
+ * at the same time. Blocks until the lock is free.
+ *
+ * @return The descriptor holding the lock, -1 if it couldn't be taken,
+ *         in which case the index can't be written either
+ */
+int lock_index() {
+    int fd = open(INDEX_LOCK_FILEPATH, O_RDWR | O_CREAT | O_CLOEXEC, INDEX_FILE_MODE);
+
+    if (fd < 0) { return -1; }
+
+    if (flock(fd, LOCK_EX) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Releases the lock from `lock_index`
+ *
+ * @param fd The descriptor holding the lock
+ */
+void unlock_index(int fd) {
+    if (fd < 0) { return; }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/**
+ * Tokenizes every manual page and writes the search index
+ * Visits the pages in the same order as `search_keyword`
+ *
+ * @param  report Whether to print what was built
+ * @return        The number of pages indexed
+ */
+int build_index(int report) {
+    // Before listing, so a page added meanwhile makes the index out of date
+    int64_t mtimes[MAX_SECTION + 1][2];
+    section_mtimes(mtimes);
+
+    PageEntry* pages;
+    size_t n_pages = collect_pages(&pages);
+
+    TermTable table = { .slots = NULL, .capacity = 0, .n_terms = 0 };
+
+    BuildDoc* docs = checked_realloc(NULL, sizeof(BuildDoc) * (n_pages + 1),
+                                     "build_index");
+
+    // Pages without a NAME are kept too, so `--update` knows they're unchanged
+    for (size_t i = 0; i < n_pages; i++) {
+        docs[i].section = pages[i].section;
+        docs[i].rank = i;
+        docs[i].path = pages[i].path;
+
+        index_doc(&docs[i], &table, i);
+    }
+
+    DictWriter writer = { .n_terms = 0, .max_term_len = 0 };
+
+    encode_dictionary(&table, &writer);
+    write_index(docs, n_pages, &writer, mtimes);
+
+    if (report) { _PRINTF_(INDEX_BUILT, (int) n_pages, writer.n_terms, INDEX_FILEPATH); }
+
+    for (size_t i = 0; i < n_pages; i++) { free(docs[i].name); }
+
+    free(docs);
+    destroy_pages(pages, n_pages);
+    dict_writer_destroy(&writer);
+    term_table_destroy(&table);
+
+    return n_pages;
+}
+
+/////////////////////////       End Index Builder      /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Index Search         /////////////////////////
+
+typedef struct {
+    char* base;                 /* Start of the memory mapped index */
+    size_t size;                /* Size of the mapping */
+    const IndexHeader* header;  /* The header, at the start of the mapping */
+    const IndexDoc* docs;       /* The doc table */
+    const IndexBlock* blocks;   /* Where every dictionary block starts */
+    const IndexTrigram* trigrams;  /* Every trigram of the terms, sorted */
+    const uint8_t* dict;        /* The front coded dictionary */
+    const uint8_t* postings;    /* The posting lists */
+    const uint8_t* term_lists;  /* The term lists of the trigrams */
+    const char* strings;        /* The string pool */
+} Index;
+
+typedef struct {
+    const Index* index;       /* The index the dictionary belongs to */
+    const uint8_t* pos;       /* The next entry in the dictionary */
+    uint64_t post_off;        /* Offset of the next entry's posting list */
+    uint32_t next;            /* Ordinal of the next entry */
+    char* term;               /* The current term, NUL terminated */
+    uint32_t len;             /* Length of the current term */
+    uint32_t n_docs;          /* Number of pages containing the term */
+    const uint8_t* list;      /* The current term's posting list */
+} DictCursor;
+
+typedef struct {
+    const uint8_t* skips;  /* The skip table, NULL if the list has none */
+    uint32_t n_skips;      /* Number of entries in the skip table */
+    const uint8_t* data;   /* Start of the varint deltas */
+    const uint8_t* pos;    /* The next delta to decode */
+    uint32_t n_docs;       /* Number of doc ids in the list */
+    uint32_t consumed;     /* Number of doc ids decoded so far */
+    uint32_t doc;          /* The last decoded doc id */
+} PostingCursor;
+
+typedef struct {
+    uint32_t* docs;   /* Sorted doc ids */
+    size_t n;         /* Number of doc ids */
+    size_t capacity;  /* Capacity of `docs` */
+} DocList;
+
+typedef struct {
+    int is_prefix;         /* Whether the term ended with QUERY_PREFIX */
+    char* term;            /* The term, without QUERY_PREFIX */
+    size_t len;            /* Length of the term */
+    const uint8_t* list;   /* Posting list of an exact term */
+    uint32_t n_docs;       /* Length of the posting list */
+    DocList matches;       /* Pages containing any term with the prefix */
+} QueryTerm;
+
+/**
+ * Memory maps the search index, if one has been built
+ *
+ * A missing, truncated or outdated index is not an error, the caller
+ * just falls back to scanning the manual pages.
+ *
+ * @param  index Where to store the mapped index
+ * @return       _TRUE_ if the index was mapped, _FALSE_ otherwise
+ */
+int load_index(Index* index) {
+    int fd = open(INDEX_FILEPATH, O_RDONLY);
+
+    if (fd < 0) { return _FALSE_; }
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return _FALSE_;
+    }
+
+    index->size = st.st_size;
+    index->base = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+
+    if (MAP_FAILED == index->base) { return _FALSE_; }
+
+    const IndexHeader* header = (const IndexHeader*) index->base;
+
+    if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION
+        || header->size != index->size
+        || header->docs_off + sizeof(IndexDoc) * header->n_docs > header->blocks_off
+        || header->blocks_off + sizeof(IndexBlock) * header->n_blocks > header->trigrams_off
+        || header->trigrams_off + sizeof(IndexTrigram) * header->n_trigrams > header->dict_off
+        || header->dict_off > header->postings_off
+        || header->postings_off > header->term_lists_off
+        || header->term_lists_off > header->strings_off
+        || header->strings_off > header->size) {
+        munmap(index->base, index->size);
+        return _FALSE_;
+    }
+
+    index->header = header;
+    index->docs = (const IndexDoc*) (index->base + header->docs_off);
+    index->blocks = (const IndexBlock*) (index->base + header->blocks_off);
+    index->trigrams = (const IndexTrigram*) (index->base + header->trigrams_off);
+    index->dict = (const uint8_t*) index->base + header->dict_off;
+    index->postings = (const uint8_t*) index->base + header->postings_off;
+    index->term_lists = (const uint8_t*) index->base + header->term_lists_off;
+    index->strings = index->base + header->strings_off;
+
+    return _TRUE_;
+}
+
+/**
+ * Unmaps the search index
+ *
+ * @param index The index to unmap
+ */
+void unload_index(Index* index) {
+    munmap(index->base, index->size);
+}
+
+/**
+ * Whether a page is unchanged since it was indexed
+ *
+ * @param  doc The page as it was indexed
+ * @param  st  The page as it is now
+ * @return     _TRUE_ if the size and mtime are the same, _FALSE_ otherwise
+ */
+static inline int doc_is_current(const IndexDoc* doc, const struct stat* st) {
+    return doc->size == (uint64_t) st->st_size
+           && doc->mtime_sec == st->st_mtim.tv_sec
+           && doc->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+/**
+ * Whether the index was built from the current contents of every section.
+ * Adding, removing or renaming a page changes the mtime of its section,
+ * but editing a page in place only changes the page, so every page is
+ * checked against the size and mtime it was indexed with as well.
+ *
+ * @param  index The mapped index
+ * @return       _TRUE_ if no page was added, removed, renamed or edited since
+ */
+int index_is_current(const Index* index) {
+    int64_t mtimes[MAX_SECTION + 1][2];
+    section_mtimes(mtimes);
+
+    if (0 != memcmp(index->header->dir_mtime, mtimes, sizeof(mtimes))) { return _FALSE_; }
+
+    struct stat st;
+
+    for (uint32_t i = 0; i < index->header->n_docs; i++) {
+        const IndexDoc* doc = &index->docs[i];
+
+        if (0 == doc->section) { continue; }
+
+        if (stat(index->strings + doc->path_off, &st) < 0 || !doc_is_current(doc, &st)) {
+            return _FALSE_;
+        }
+    }
+
+    return _TRUE_;
+}
+
+// Whether the last `acquire_index` found an index that is out of date
+static int index_is_stale = _FALSE_;
+
+// The daemon keeps the index mapped between queries
+static int keep_index = _FALSE_;
+static int index_is_cached = _FALSE_;
+static Index cached_index;
+static struct stat cached_index_stat;
+
+// The daemon only checks every page again once its watch saw a change
+static int index_watch = -1;
+static int cached_index_checked = _FALSE_;
+
+int update_index(int report);
+
+/**
+ * Brings an out of date index up to date for a query, like `--update`
+ * but without printing anything. Queries that find the index stale at the
+ * same time take turns through `lock_index`, so only the first updates it
+ *
+ * @return _TRUE_ if the index is current, _FALSE_ if it can't be updated
+ */
+int refresh_index() {
+    // A query that can't write the index scans the pages instead
+    if (0 != access(MAN_PAGES_DIRPATH, W_OK)) { return _FALSE_; }
+
+    int lock = lock_index();
+    if (lock < 0) { return _FALSE_; }
+
+    Index index;
+    int current = _FALSE_;
+
+    if (load_index(&index)) {
+        current = index_is_current(&index);
+        unload_index(&index);
+    }
+
+    if (!current) {
+        update_index(_FALSE_);
+        current = _TRUE_;
+    }
+
+    unlock_index(lock);
+
+    return current;
+}
+
+/**
+ * Keeps the daemon's mapping of the index in sync with the index file,
+ * mapping it again if the index file was rebuilt since it was mapped
+ */
+void cache_index() {
+    struct stat st;
+
+    if (stat(INDEX_FILEPATH, &st) < 0) {
+        st.st_ino = 0;
+        st.st_size = 0;
+    }
+
+    if (index_is_cached && (st.st_ino != cached_index_stat.st_ino
+                            || st.st_size != cached_index_stat.st_size
+                            || st.st_mtime != cached_index_stat.st_mtime)) {
+        unload_index(&cached_index);
+        index_is_cached = _FALSE_;
+    }
+
+    if (!index_is_cached && 0 != st.st_ino && load_index(&cached_index)) {
+        index_is_cached = _TRUE_;
+        cached_index_checked = _FALSE_;
+        cached_index_stat = st;
+    }
+}
+
+/**
+ * Watches every section for pages being added, removed or edited. Adding
+ * a watch again is harmless, so this also picks up sections that were
+ * created since the last call.
+ */
+void watch_sections() {
+    char base[MAX_FILENAME_LENGTH];
+
+    if (index_watch < 0) { index_watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC); }
+
+    if (index_watch < 0) { return; }
+
+    for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+        IF_FORMAT_FAILED(sprintf(base, BASE_FILEPATH, section)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "watch_sections");
+            exit(WAPROPOS_FAILURE);
+        }
+
+        inotify_add_watch(index_watch, base, SECTION_EVENTS);
+    }
+}
+
+/**
+ * Whether anything changed in the sections since the last call, going by
+ * the events of the watch. Always _TRUE_ if there is no watch.
+ *
+ * @return _TRUE_ if the pages may have changed, _FALSE_ otherwise
+ */
+int sections_changed() {
+    char events[WATCH_BUFFER_SIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = _FALSE_;
+
+    if (index_watch < 0) { return _TRUE_; }
+
+    // Only whether there were events matters, not which
+    while (read(index_watch, events, sizeof(events)) > 0) { changed = _TRUE_; }
+
+    return changed;
+}
+
+/**
+ * `index_is_current` for the daemon's mapping. Checking every page on
+ * every query would cost the daemon most of its speed, so the pages are
+ * only checked again once the watch saw something change in a section.
+ *
+ * @return _TRUE_ if the cached index is current, _FALSE_ otherwise
+ */
+int cached_index_is_current() {
+    if (sections_changed() || !cached_index_checked) {
+        watch_sections();
+        cached_index_checked = index_is_current(&cached_index);
+    }
+
+    return cached_index_checked;
+}
+
+/**
+ * Gets the search index for a query
+ *
+ * Normally this maps the index, but the daemon keeps the mapping around,
+ * and only maps it again if the index file was rebuilt since. An index
+ * that is out of date is updated first, or if that is not possible, not
+ * used, so the query scans the pages instead.
+ *
+ * @param  index Where to store the index
+ * @return       _TRUE_ if there is a current index, _FALSE_ otherwise
+ */
+int acquire_index(Index* index) {
+    index_is_stale = _FALSE_;
+
+    if (!keep_index) {
+        if (!load_index(index)) { return _FALSE_; }
+
+        if (index_is_current(index)) { return _TRUE_; }
+
+        unload_index(index);
+
+        if (refresh_index() && load_index(index)) { return _TRUE_; }
+
+        index_is_stale = _TRUE_;
+
+        return _FALSE_;
+    }
+
+    cache_index();
+
+    if (index_is_cached && !cached_index_is_current()) {
+        unload_index(&cached_index);
+        index_is_cached = _FALSE_;
+
+        if (refresh_index()) { cache_index(); }
+
+        if (!index_is_cached) { index_is_stale = _TRUE_; }
+    }
+
+    *index = cached_index;
+
+    return index_is_cached;
+}
+
+/**
+ * Releases an index from `acquire_index`
+ *
+ * @param index The index to release
+ */
+void release_index(Index* index) {
+    if (!keep_index) { unload_index(index); }
+}
+
+/**
+ * Positions the cursor at the first term of the given dictionary block
+ * The term is decoded by the next call to `dict_next`.
+ *
+ * @param cursor The cursor to position
+ * @param index  The mapped index
+ * @param block  The block to start at
+ */
+void dict_seek(DictCursor* cursor, const Index* index, uint32_t block) {
+    cursor->index = index;
+    cursor->pos = index->dict + index->blocks[block].dict_off;
+    cursor->post_off = index->blocks[block].post_off;
+    cursor->next = block * DICT_BLOCK_SIZE;
+    cursor->len = 0;
+}
+
+/**
+ * Decodes the next term of the dictionary
+ *
+ * @param  cursor The cursor to advance
+ * @return        _TRUE_ if a term was decoded, _FALSE_ at the end
+ */
+int dict_next(DictCursor* cursor) {
+    if (cursor->next >= cursor->index->header->n_terms) { return _FALSE_; }
+
+    uint32_t shared = get_varint(&cursor->pos);
+    uint32_t suffix = get_varint(&cursor->pos);
+
+    memcpy(cursor->term + shared, cursor->pos, suffix);
+    cursor->pos += suffix;
+    cursor->len = shared + suffix;
+    cursor->term[cursor->len] = NULL_TERMINATOR;
+
+    cursor->n_docs = get_varint(&cursor->pos);
+    cursor->list = cursor->index->postings + cursor->post_off;
+    cursor->post_off += get_varint(&cursor->pos);
+    cursor->next++;
+
+    return _TRUE_;
+}
+
+/**
+ * Decodes the given term. Only seeks if the term is behind the cursor or
+ * in another block, so visiting terms in dictionary order decodes every
+ * block at most once. Before the first call, `cursor->next` must be set
+ * to the number of terms, which makes the first call seek.
+ *
+ * @param cursor The cursor to move
+ * @param index  The mapped index
+ * @param term   The ordinal of the term to decode
+ */
+void dict_goto(DictCursor* cursor, const Index* index, uint32_t term) {
+    if (term < cursor->next || term / DICT_BLOCK_SIZE != (cursor->next - 1) / DICT_BLOCK_SIZE) {
+        dict_seek(cursor, index, term / DICT_BLOCK_SIZE);
+    }
+
+    while (cursor->next <= term) { dict_next(cursor); }
+}
+
+/**
+ * Allocates the buffer a DictCursor decodes terms into
+ *
+ * @param  index The mapped index
+ * @return       A buffer big enough for the longest term
+ */
+static inline char* dict_term_buffer(const Index* index) {
+    return checked_realloc(NULL, index->header->max_term_len + 1,
+                           "dict_term_buffer");
+}
+
+/**
+ * Compares two byte strings like strcmp, but with explicit lengths
+ */
+static inline int compare_bytes(const char* a, size_t a_len,
+                                const char* b, size_t b_len) {
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+    return cmp ? cmp : (a_len > b_len) - (a_len < b_len);
+}
+
+/**
+ * Binary searches the dictionary blocks for the last block whose first
+ * term sorts before `key`. Every term >= `key` is in this block or after.
+ *
+ * @param  index The mapped index
+ * @param  key   The term to look for
+ * @param  len   The length of `key`
+ * @return       The block to start scanning at
+ */
+uint32_t dict_find_block(const Index* index, const char* key, size_t len) {
+    uint32_t lo = 0;
+    uint32_t hi = index->header->n_blocks;
+
+    // Invariant: the first term of every block before `lo` is < key
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        // The first term of a block shares nothing with the previous term
+        const uint8_t* pos = index->dict + index->blocks[mid].dict_off;
+        get_varint(&pos);
+        uint32_t first_len = get_varint(&pos);
+
+        if (compare_bytes((const char*) pos, first_len, key, len) < 0) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Starts decoding a posting list
+ *
+ * @param cursor The cursor to initialize
+ * @param list   The encoded posting list
+ * @param n_docs The number of doc ids in the list
+ */
+void posting_open(PostingCursor* cursor, const uint8_t* list, uint32_t n_docs) {
+    cursor->n_skips = n_docs > SKIP_INTERVAL ? (n_docs - 1) / SKIP_INTERVAL : 0;
+    cursor->skips = cursor->n_skips ? list : NULL;
+    cursor->data = list + sizeof(IndexSkip) * cursor->n_skips;
+    cursor->pos = cursor->data;
+    cursor->n_docs = n_docs;
+    cursor->consumed = 0;
+    cursor->doc = 0;
+}
+
+/**
+ * Decodes the next doc id of the list into `cursor->doc`
+ *
+ * @param  cursor The cursor to advance
+ * @return        _TRUE_ if a doc id was decoded, _FALSE_ at the end
+ */
+static inline int posting_next(PostingCursor* cursor) {
+    if (cursor->consumed == cursor->n_docs) { return _FALSE_; }
+
+    cursor->doc += get_varint(&cursor->pos);
+    cursor->consumed++;
+
+    return _TRUE_;
+}
+
+/**
+ * Advances the cursor to the first doc id >= `target`
+ * The skip table is binary searched for the last chunk starting before
+ * `target`, so whole chunks of doc ids are never decoded.
+ *
+ * @param  cursor The cursor to advance
+ * @param  target The doc id to look for
+ * @return        _TRUE_ if such a doc id exists, _FALSE_ otherwise
+ */
+int posting_next_geq(PostingCursor* cursor, uint32_t target) {
+    if (cursor->consumed > 0 && cursor->doc >= target) { return _TRUE_; }
+
+    uint32_t lo = 0;
+    uint32_t hi = cursor->n_skips;
+    IndexSkip skip;
+
+    // Find the first skip whose base is >= target
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        memcpy(&skip, cursor->skips + sizeof(IndexSkip) * mid, sizeof(IndexSkip));
+
+        if (skip.base < target) { lo = mid + 1; } else { hi = mid; }
+    }
+
+    // Jump to the chunk after the last skip whose base is < target
+    if (lo > 0 && lo * SKIP_INTERVAL > cursor->consumed) {
+        memcpy(&skip, cursor->skips + sizeof(IndexSkip) * (lo - 1),
+               sizeof(IndexSkip));
+
+        cursor->pos = cursor->data + skip.off;
+        cursor->doc = skip.base;
+        cursor->consumed = lo * SKIP_INTERVAL;
+    }
+
+    while (posting_next(cursor)) {
+        if (cursor->doc >= target) { return _TRUE_; }
+    }
+
+    return _FALSE_;
+}
+
+/**
+ * Appends every doc id of a posting list to the list of docs
+ *
+ * @param out    The list to append to
+ * @param list   The encoded posting list
+ * @param n_docs The number of doc ids in the list
+ */
+void decode_postings(DocList* out, const uint8_t* list, uint32_t n_docs) {
+    if (out->n + n_docs > out->capacity) {
+        out->capacity = 2 * (out->n + n_docs);
+        out->docs = checked_realloc(out->docs, sizeof(uint32_t) * out->capacity,
+                                    "decode_postings");
+    }
+
+    PostingCursor cursor;
+    posting_open(&cursor, list, n_docs);
+
+    while (posting_next(&cursor)) { out->docs[out->n++] = cursor.doc; }
+}
+
+/**
+ * Compares two doc ids, for qsort
+ */
+static int compare_doc_ids(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Sorts the list, and removes duplicate doc ids
+ *
+ * @param list The list to normalize
+ */
+void sort_doc_list(DocList* list) {
+    if (list->n < 2) { return; }
+
+    qsort(list->docs, list->n, sizeof(uint32_t), compare_doc_ids);
+
+    size_t n = 1;
+
+    for (size_t i = 1; i < list->n; i++) {
+        if (list->docs[i] != list->docs[n - 1]) { list->docs[n++] = list->docs[i]; }
+    }
+
+    list->n = n;
+}
+
+/**
+ * Appends doc ids to the list of docs
+ *
+ * @param out    The list to append to
+ * @param docs   The doc ids to append
+ * @param n_docs The number of doc ids
+ */
+void append_doc_list(DocList* out, const uint32_t* docs, size_t n_docs) {
+    if (out->n + n_docs > out->capacity) {
+        out->capacity = 2 * (out->n + n_docs);
+        out->docs = checked_realloc(out->docs, sizeof(uint32_t) * out->capacity,
+                                    "append_doc_list");
+    }
+
+    memcpy(out->docs + out->n, docs, sizeof(uint32_t) * n_docs);
+    out->n += n_docs;
+}
+
+/**
+ * Compares two (rank, doc id) keys, for qsort
+ */
+static int compare_rank_keys(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Orders a sorted list of docs the way `search_keyword` would print them
+ * After `--update`, doc ids are no longer in scan order, so sort by rank.
+ *
+ * @param index The mapped index
+ * @param list  The docs to order
+ */
+void order_by_rank(const Index* index, DocList* list) {
+    if (index->header->in_order || list->n < 2) { return; }
+
+    uint64_t* keys = checked_realloc(NULL, sizeof(uint64_t) * list->n,
+                                     "order_by_rank");
+
+    for (size_t i = 0; i < list->n; i++) {
+        keys[i] = (uint64_t) index->docs[list->docs[i]].rank << 32 | list->docs[i];
+    }
+
+    qsort(keys, list->n, sizeof(uint64_t), compare_rank_keys);
+
+    for (size_t i = 0; i < list->n; i++) { list->docs[i] = (uint32_t) keys[i]; }
+
+    free(keys);
+}
+
+/**
+ * Prints an indexed page in wapropos format
+ *
+ * @param index The mapped index
+ * @param doc   The doc id of the page
+ */
+static void print_indexed_doc(const Index* index, uint32_t doc) {
+    // `print_apropos` splits the name inplace, so work on a copy
+    char* name = strdup(index->strings + index->docs[doc].name_off);
+
+    IS_NULL(name) {
+        fprintf(stderr, ERROR_IN_MALLOC, "print_indexed_doc");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    print_apropos(name, index->docs[doc].section);
+    free(name);
+}
+
+/**
+ * Binary searches the trigram table
+ *
+ * @param  index   The mapped index
+ * @param  trigram The trigram to look for
+ * @return         The trigram's entry, NULL if no term has it
+ */
+const IndexTrigram* find_trigram(const Index* index, uint32_t trigram) {
+    uint32_t lo = 0;
+    uint32_t hi = index->header->n_trigrams;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (index->trigrams[mid].trigram < trigram) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < index->header->n_trigrams && index->trigrams[lo].trigram == trigram) {
+        return &index->trigrams[lo];
+    }
+
+    return NULL;
+}
+
+/**
+ * Finds the terms that may contain `needle`, using the trigram index. A
+ * term containing the needle has every trigram from the middle of the
+ * needle, so only the terms in all of their term lists are candidates.
+ * The lists are intersected starting from the shortest one. Trigrams
+ * ignore case, so the candidates still have to be checked.
+ *
+ * @param index  The mapped index
+ * @param needle The substring to look for, at least 3 bytes long
+ * @param len    The length of the needle
+ * @param terms  To store the ordinals of the candidate terms, sorted
+ */
+void find_substring_terms(const Index* index, const char* needle, size_t len,
+                          DocList* terms) {
+    const IndexTrigram* shortest = NULL;
+
+    for (size_t i = 1; i + 1 < len; i++) {
+        const IndexTrigram* trigram = find_trigram(index, trigram_at(needle, len, i));
+
+        // No term has this trigram, so no term contains the needle
+        IS_NULL(trigram) { return; }
+
+        if (NULL == shortest || trigram->n_terms < shortest->n_terms) { shortest = trigram; }
+    }
+
+    const uint8_t* pos = index->term_lists + shortest->list_off;
+    uint32_t term = 0;
+
+    for (uint32_t j = 0; j < shortest->n_terms; j++) {
+        term += get_varint(&pos);
+        append_doc_list(terms, &term, 1);
+    }
+
+    for (size_t i = 1; i + 1 < len && terms->n > 0; i++) {
+        const IndexTrigram* trigram = find_trigram(index, trigram_at(needle, len, i));
+
+        if (trigram == shortest) { continue; }
+
+        // Keep the candidates that are in this list too, both are sorted
+        size_t kept = 0;
+        size_t k = 0;
+
+        pos = index->term_lists + trigram->list_off;
+        term = 0;
+
+        for (uint32_t j = 0; j < trigram->n_terms && k < terms->n; j++) {
+            term += get_varint(&pos);
+
+            while (k < terms->n && terms->docs[k] < term) { k++; }
+
+            if (k < terms->n && terms->docs[k] == term) { terms->docs[kept++] = terms->docs[k++]; }
+        }
+
+        terms->n = kept;
+    }
+}
+
+/**
+ * Finds the longest run of word characters in the keyword
+ * This is the most selective part of the keyword to look up in the index.
+ *
+ * @param  keyword The keyword to search for
+ * @param  len     To store the length of the run
+ * @return         The start of the run in `keyword`, NULL if `keyword`
+ *                 has no word characters at all
+ */
+static const char* longest_word_run(const char* keyword, size_t* len) {
+    const char* best = NULL;
+    *len = 0;
+
+    for (const char* c = keyword; NULL_TERMINATOR != *c;) {
+        if (!is_word_char(*c)) { c++; continue; }
+
+        const char* start = c;
+
+        for (; NULL_TERMINATOR != *c && is_word_char(*c); c++);
+
+        if ((size_t) (c - start) > *len) {
+            best = start;
+            *len = c - start;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Answers a keyword query from the search index
+ *
+ * Every term containing the longest word run of `keyword` contributes its
+ * posting list. If the keyword is made up of only word characters, these
+ * pages are exactly the matches, and are printed straight from the index.
+ * Otherwise they are only candidates, and each one is checked with
+ * `contains_keyword` before being printed.
+ *
+ * Runs of 3 or more bytes only check the terms `find_substring_terms`
+ * finds. Shorter runs check every term, most terms contain them anyway.
+ *
+ * @param  index   The mapped search index
+ * @param  keyword The keyword to search for
+ * @return         The number of pages containing the keyword,
+ *                 -1 if the index can't answer this query.
+ */
+int search_index(Index* index, char* keyword) {
+    size_t run_len;
+    const char* run = longest_word_run(keyword, &run_len);
+
+    // Keywords like "-" can't be looked up, they need a full scan
+    IS_NULL(run) { return -1; }
+
+    int exact = (run_len == strlen(keyword));
+
+    char* needle = checked_realloc(NULL, run_len + 1, "search_index");
+    memcpy(needle, run, run_len);
+    needle[run_len] = NULL_TERMINATOR;
+
+    Matcher run_matcher;
+    matcher_init(&run_matcher, needle);
+
+    DocList hits = { .docs = NULL, .n = 0, .capacity = 0 };
+    DictCursor cursor = { .term = dict_term_buffer(index) };
+
+    if (index->header->n_terms > 0 && run_len >= 3) {
+        DocList terms = { .docs = NULL, .n = 0, .capacity = 0 };
+        find_substring_terms(index, needle, run_len, &terms);
+
+        cursor.next = index->header->n_terms;
+
+        for (size_t i = 0; i < terms.n; i++) {
+            dict_goto(&cursor, index, terms.docs[i]);
+
+            if (NULL != matcher_find(&run_matcher, cursor.term, cursor.len)) {
+                decode_postings(&hits, cursor.list, cursor.n_docs);
+            }
+        }
+
+        free(terms.docs);
+    } else if (index->header->n_terms > 0) {
+        dict_seek(&cursor, index, 0);
+
+        while (dict_next(&cursor)) {
+            if (NULL != matcher_find(&run_matcher, cursor.term, cursor.len)) {
+                decode_postings(&hits, cursor.list, cursor.n_docs);
+            }
+        }
+    }
+
+    free(cursor.term);
+    free(needle);
+
+    Matcher matcher;
+    matcher_init(&matcher, keyword);
+
+    // Print in the order `search_keyword` prints in
+    sort_doc_list(&hits);
+    order_by_rank(index, &hits);
+
+    int count = 0;
+
+    for (size_t i = 0; i < hits.n; i++) {
+        const IndexDoc* doc = &index->docs[hits.docs[i]];
+
+        if (exact) {
+            print_indexed_doc(index, hits.docs[i]);
+            count++;
+            continue;
+        }
+
+        const char* path = index->strings + doc->path_off;
+
+        // The page may have been removed since the index was built
+        if (access(path, R_OK)) { continue; }
+
+        Page page;
+
+        if (page_open(&page, path) < 0) {
+            fprintf(stderr, ERROR_IN_FOPEN, path);
+            exit(WAPROPOS_FAILURE);
+        }
+
+        char* name = contains_keyword(&page, &matcher);
+        page_close(&page);
+
+        IS_NULL(name) { continue; }
+
+        print_apropos(name, doc->section);
+        free(name);
+        count++;
+    }
+
+    free(hits.docs);
+
+    return count;
+}
+
+/**
+ * Looks up a query term in the dictionary
+ *
+ * An exact term just remembers where its posting list is, so it can be
+ * walked with skips later. A prefix term unions the posting lists of every
+ * term starting with the prefix into `term->matches`.
+ *
+ * @param index The mapped index
+ * @param term  The query term to look up
+ */
+void resolve_query_term(const Index* index, QueryTerm* term) {
+    term->list = NULL;
+    term->n_docs = 0;
+    term->matches.docs = NULL;
+    term->matches.n = 0;
+    term->matches.capacity = 0;
+
+    if (0 == index->header->n_terms) { return; }
+
+    DictCursor cursor = { .term = dict_term_buffer(index) };
+    dict_seek(&cursor, index, dict_find_block(index, term->term, term->len));
+
+    while (dict_next(&cursor)) {
+        int cmp = compare_bytes(cursor.term, cursor.len, term->term, term->len);
+
+        if (cmp < 0) { continue; }
+
+        if (!term->is_prefix) {
+            if (0 == cmp) {
+                term->list = cursor.list;
+                term->n_docs = cursor.n_docs;
+            }
+
+            break;
+        }
+
+        // Past the last term starting with the prefix
+        if (cursor.len < term->len || 0 != memcmp(cursor.term, term->term, term->len)) {
+            break;
+        }
+
+        decode_postings(&term->matches, cursor.list, cursor.n_docs);
+    }
+
+    free(cursor.term);
+
+    if (term->is_prefix) {
+        sort_doc_list(&term->matches);
+        term->n_docs = term->matches.n;
+    }
+}
+
+/**
+ * Intersects the docs with a query term, keeping only the doc ids that
+ * are also in the term's posting list (or prefix matches).
+ *
+ * @param docs The sorted docs, filtered inplace
+ * @param term The resolved query term
+ */
+void intersect_query_term(DocList* docs, const QueryTerm* term) {
+    size_t n = 0;
+
+    if (term->is_prefix) {
+        // Both sides are sorted, so merge them
+        size_t j = 0;
+
+        for (size_t i = 0; i < docs->n && j < term->matches.n; i++) {
+            while (j < term->matches.n && term->matches.docs[j] < docs->docs[i]) { j++; }
+
+            if (j < term->matches.n && term->matches.docs[j] == docs->docs[i]) {
+                docs->docs[n++] = docs->docs[i];
+            }
+        }
+    } else {
+        PostingCursor cursor;
+        posting_open(&cursor, term->list, term->n_docs);
+
+        for (size_t i = 0; i < docs->n; i++) {
+            if (!posting_next_geq(&cursor, docs->docs[i])) { break; }
+            if (cursor.doc == docs->docs[i]) { docs->docs[n++] = docs->docs[i]; }
+        }
+    }
+
+    docs->n = n;
+}
+
+/**
+ * Orders query terms by the number of pages they match, for qsort
+ */
+static int compare_query_terms(const void* a, const void* b) {
+    uint32_t x = ((const QueryTerm*) a)->n_docs;
+    uint32_t y = ((const QueryTerm*) b)->n_docs;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Answers a multi-term query from the dictionary
+ *
+ * Every term matches pages containing exactly that term, or any term
+ * starting with it if it ends with QUERY_PREFIX. With `match_all`, pages
+ * must match every term. Otherwise pages matching any term are printed.
+ *
+ * @param  index     The mapped index
+ * @param  words     The query terms
+ * @param  n_words   The number of query terms
+ * @param  match_all _TRUE_ to AND the terms, _FALSE_ to OR them
+ * @return           The number of pages printed
+ */
+int search_terms(Index* index, char** words, int n_words, int match_all) {
+    QueryTerm* terms = checked_realloc(NULL, sizeof(QueryTerm) * n_words,
+                                       "search_terms");
+
+    for (int i = 0; i < n_words; i++) {
+        terms[i].term = words[i];
+        terms[i].len = strlen(words[i]);
+        terms[i].is_prefix = terms[i].len > 0
+                             && QUERY_PREFIX == words[i][terms[i].len - 1];
+
+        if (terms[i].is_prefix) { terms[i].len--; }
+
+        resolve_query_term(index, &terms[i]);
+    }
+
+    DocList docs = { .docs = NULL, .n = 0, .capacity = 0 };
+
+    if (match_all) {
+        // Start from the rarest term, so every intersection stays small
+        qsort(terms, n_words, sizeof(QueryTerm), compare_query_terms);
+
+        if (terms[0].is_prefix) {
+            docs = terms[0].matches;
+            terms[0].matches.docs = NULL;
+        } else {
+            decode_postings(&docs, terms[0].list, terms[0].n_docs);
+        }
+
+        for (int i = 1; i < n_words && docs.n > 0; i++) {
+            intersect_query_term(&docs, &terms[i]);
+        }
+    } else {
+        for (int i = 0; i < n_words; i++) {
+            if (terms[i].is_prefix) {
+                append_doc_list(&docs, terms[i].matches.docs, terms[i].matches.n);
+            } else {
+                decode_postings(&docs, terms[i].list, terms[i].n_docs);
+            }
+        }
+
+        sort_doc_list(&docs);
+    }
+
+    order_by_rank(index, &docs);
+
+    for (size_t i = 0; i < docs.n; i++) { print_indexed_doc(index, docs.docs[i]); }
+
+    for (int i = 0; i < n_words; i++) { free(terms[i].matches.docs); }
+
+    free(terms);
+    free(docs.docs);
+
+    return docs.n;
+}
+
+/**
+ * Looks for the keyword using the search index if one was built,
+ * scanning all manual pages otherwise.
+ *
+ * @param  keyword   The keyword to search for
+ * @param  n_threads The number of threads to scan with, if scanning
+ * @return           The number of files containing the given keyword.
+ */
+int run_search(char* keyword, int n_threads) {
+    Index index;
+    int count = -1;
+
+    if (acquire_index(&index)) {
+        count = search_index(&index, keyword);
+        release_index(&index);
+    }
+
+    if (count < 0) {
+        count = n_threads > 1 ? search_keyword_parallel(keyword, n_threads)
+                              : search_keyword(keyword);
+    }
+
+    return count;
+}
+
+/**
+ * Runs an AND or OR query over the terms, which needs a search index
+ *
+ * @param  words     The query terms
+ * @param  n_words   The number of query terms
+ * @param  match_all _TRUE_ to AND the terms, _FALSE_ to OR them
+ * @return           The number of pages found, -1 if there is no index
+ */
+int run_term_search(char** words, int n_words, int match_all) {
+    Index index;
+
+    if (!acquire_index(&index)) { return -1; }
+
+    int count = search_terms(&index, words, n_words, match_all);
+
+    release_index(&index);
+
+    return count;
+}
+
+/////////////////////////       End Index Search       /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Fuzzy Search         /////////////////////////
+
+typedef struct {
+    const uint8_t* list;  /* Posting list of the term */
+    uint32_t n_docs;      /* Length of the posting list */
+    int distance;         /* Edits between the keyword and the term */
+} FuzzyMatch;
+
+/**
+ * Gets the most edits a fuzzy match may be away from a keyword.
+ * Short keywords are within a couple of edits of too many terms.
+ *
+ * @param  len The length of the keyword
+ * @return     The largest allowed edit distance
+ */
+static inline int fuzzy_max_distance(size_t len) {
+    if (len < 3) { return 0; }
+
+    return len < 6 ? 1 : MAX_FUZZY_DISTANCE;
+}
+
+/**
+ * Edit distance between the keyword and a term, ignoring case. Swapping
+ * two adjacent characters counts as one edit, like the other typos.
+ *
+ * @param  a     The lowercased keyword
+ * @param  a_len The length of the keyword
+ * @param  b     The term
+ * @param  b_len The length of the term
+ * @param  max   The largest distance of interest
+ * @param  rows  Scratch space, at least 3 * (b_len + 1) long
+ * @return       The edit distance, or max + 1 if it is more than `max`
+ */
+static int bounded_distance(const char* a, size_t a_len, const char* b,
+                            size_t b_len, int max, int* rows) {
+    size_t diff = a_len > b_len ? a_len - b_len : b_len - a_len;
+
+    if (diff > (size_t) max) { return max + 1; }
+
+    int* before = rows;
+    int* prev = rows + b_len + 1;
+    int* curr = rows + 2 * (b_len + 1);
+
+    for (size_t j = 0; j <= b_len; j++) { prev[j] = j; }
+
+    for (size_t i = 1; i <= a_len; i++) {
+        int row_min = curr[0] = i;
+
+        for (size_t j = 1; j <= b_len; j++) {
+            int b_j = tolower((unsigned char) b[j - 1]);
+            int cost = a[i - 1] != b_j;
+            int best = prev[j - 1] + cost;
+
+            if (prev[j] + 1 < best) { best = prev[j] + 1; }
+            if (curr[j - 1] + 1 < best) { best = curr[j - 1] + 1; }
+
+            // Adjacent characters swapped
+            if (i > 1 && j > 1 && a[i - 1] == tolower((unsigned char) b[j - 2])
+                && a[i - 2] == b_j && before[j - 2] + 1 < best) {
+                best = before[j - 2] + 1;
+            }
+
+            curr[j] = best;
+
+            if (best < row_min) { row_min = best; }
+        }
+
+        // Every later row is at least as far off
+        if (row_min > max) { return max + 1; }
+
+        int* tmp = before;
+        before = prev;
+        prev = curr;
+        curr = tmp;
+    }
+
+    return prev[b_len] > max ? max + 1 : prev[b_len];
+}
+
+/**
+ * Finds the terms within the edit distance of the keyword
+ *
+ * The candidates come from the trigram index. An edit changes at most
+ * TRIGRAMS_PER_EDIT trigrams, so a term within `max` edits shares all but
+ * TRIGRAMS_PER_EDIT * `max` of the keyword's trigrams, and only terms
+ * sharing that many are decoded and compared. At least one trigram has to
+ * be shared, so very short keywords can miss a term.
+ *
+ * @param  index   The mapped index
+ * @param  keyword The lowercased keyword
+ * @param  len     The length of the keyword
+ * @param  max     The largest allowed edit distance
+ * @param  n       To store the number of matches
+ * @return         The heap allocated matches
+ */
+FuzzyMatch* find_fuzzy_terms(const Index* index, const char* keyword, size_t len,
+                             int max, size_t* n) {
+    uint32_t n_terms = index->header->n_terms;
+    uint16_t* shared = calloc(n_terms + 1, sizeof(uint16_t));
+    uint32_t* trigrams = checked_realloc(NULL, sizeof(uint32_t) * len, "find_fuzzy_terms");
+
+    IS_NULL(shared) {
+        fprintf(stderr, ERROR_IN_MALLOC, "find_fuzzy_terms");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    for (size_t i = 0; i < len; i++) { trigrams[i] = trigram_at(keyword, len, i); }
+
+    // A repeated trigram of the keyword is counted once
+    qsort(trigrams, len, sizeof(uint32_t), compare_doc_ids);
+
+    uint32_t n_trigrams = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (i > 0 && trigrams[i] == trigrams[i - 1]) { continue; }
+
+        n_trigrams++;
+
+        const IndexTrigram* trigram = find_trigram(index, trigrams[i]);
+
+        IS_NULL(trigram) { continue; }
+
+        const uint8_t* pos = index->term_lists + trigram->list_off;
+        uint32_t term = 0;
+
+        for (uint32_t j = 0; j < trigram->n_terms; j++) {
+            term += get_varint(&pos);
+
+            if (term < n_terms && shared[term] < UINT16_MAX) { shared[term]++; }
+        }
+    }
+
+    int needed = (int) n_trigrams - TRIGRAMS_PER_EDIT * max;
+
+    if (needed < 1) { needed = 1; }
+
+    FuzzyMatch* matches = NULL;
+    size_t capacity = 0;
+    *n = 0;
+
+    int* rows = checked_realloc(NULL, sizeof(int) * 3 * (index->header->max_term_len + 1),
+                                "find_fuzzy_terms");
+    DictCursor cursor = { .term = dict_term_buffer(index) };
+    cursor.next = n_terms;
+
+    for (uint32_t term = 0; term < n_terms; term++) {
+        if (shared[term] < needed) { continue; }
+
+        // Candidates are in dictionary order, so only seek to a new block
+        dict_goto(&cursor, index, term);
+
+        int distance = bounded_distance(keyword, len, cursor.term, cursor.len, max, rows);
+
+        if (distance > max) { continue; }
+
+        if (*n == capacity) {
+            capacity = capacity ? 2 * capacity : PAGES_INITIAL_CAPACITY;
+            matches = checked_realloc(matches, sizeof(FuzzyMatch) * capacity,
+                                      "find_fuzzy_terms");
+        }
+
+        matches[*n].list = cursor.list;
+        matches[*n].n_docs = cursor.n_docs;
+        matches[*n].distance = distance;
+        (*n)++;
+    }
+
+    free(cursor.term);
+    free(rows);
+    free(trigrams);
+    free(shared);
+
+    return matches;
+}
+
+/**
+ * Answers a fuzzy query from the search index
+ *
+ * Prints the pages containing a term within a few edits of the keyword
+ * (see `fuzzy_max_distance`), ignoring case. Pages with a closer term are
+ * printed first, and pages with equally close terms in scan order.
+ *
+ * @param  index   The mapped search index
+ * @param  keyword The keyword to search for
+ * @return         The number of pages printed
+ */
+int search_fuzzy(Index* index, char* keyword) {
+    size_t len = strlen(keyword);
+
+    if (0 == len || 0 == index->header->n_terms) { return 0; }
+
+    char* folded = checked_realloc(NULL, len + 1, "search_fuzzy");
+
+    for (size_t i = 0; i <= len; i++) { folded[i] = tolower((unsigned char) keyword[i]); }
+
+    int max = fuzzy_max_distance(len);
+    size_t n_matches;
+    FuzzyMatch* matches = find_fuzzy_terms(index, folded, len, max, &n_matches);
+
+    // The closest term of every page decides where it is printed
+    uint8_t* closest = checked_realloc(NULL, index->header->n_docs + 1, "search_fuzzy");
+    memset(closest, MAX_FUZZY_DISTANCE + 1, index->header->n_docs + 1);
+
+    DocList docs = { .docs = NULL, .n = 0, .capacity = 0 };
+
+    for (size_t i = 0; i < n_matches; i++) {
+        docs.n = 0;
+        decode_postings(&docs, matches[i].list, matches[i].n_docs);
+
+        for (size_t j = 0; j < docs.n; j++) {
+            if (docs.docs[j] < index->header->n_docs
+                && matches[i].distance < closest[docs.docs[j]]) {
+                closest[docs.docs[j]] = matches[i].distance;
+            }
+        }
+    }
+
+    int count = 0;
+
+    for (int distance = 0; distance <= max; distance++) {
+        docs.n = 0;
+
+        for (uint32_t doc = 0; doc < index->header->n_docs; doc++) {
+            if (closest[doc] == distance) { append_doc_list(&docs, &doc, 1); }
+        }
+
+        order_by_rank(index, &docs);
+
+        for (size_t i = 0; i < docs.n; i++) { print_indexed_doc(index, docs.docs[i]); }
+
+        count += docs.n;
+    }
+
+    free(docs.docs);
+    free(closest);
+    free(matches);
+    free(folded);
+
+    return count;
+}
+
+/**
+ * Runs a fuzzy query, which needs a search index
+ *
+ * @param  keyword The keyword to search for
+ * @return         The number of pages found, -1 if there is no index
+ */
+int run_fuzzy_search(char* keyword) {
+    Index index;
+
+    if (!acquire_index(&index)) { return -1; }
+
+    int count = search_fuzzy(&index, keyword);
+
+    release_index(&index);
+
+    return count;
+}
+
+/////////////////////////       End Fuzzy Search       /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Index Update         /////////////////////////
+
+/**
+ * Hashes the filepath of every page in the index, so `--update` can find
+ * the doc id a page had. Removed pages are left out.
+ *
+ * @param  index The mapped index
+ * @param  mask  To store the number of slots - 1
+ * @return       The heap allocated slots, each holding a doc id + 1,
+ *               0 for an empty slot
+ */
+static uint32_t* hash_doc_paths(const Index* index, uint32_t* mask) {
+    uint32_t capacity = TERM_TABLE_INITIAL_CAPACITY;
+
+    // Keep the load factor under 1/2
+    while (capacity < 2 * index->header->n_docs) { capacity *= 2; }
+
+    uint32_t* slots = calloc(capacity, sizeof(uint32_t));
+
+    IS_NULL(slots) {
+        fprintf(stderr, ERROR_IN_MALLOC, "hash_doc_paths");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    *mask = capacity - 1;
+
+    for (uint32_t doc = 0; doc < index->header->n_docs; doc++) {
+        if (0 == index->docs[doc].section) { continue; }
+
+        const char* path = index->strings + index->docs[doc].path_off;
+        uint32_t slot = hash_term(path, strlen(path)) & *mask;
+
+        // linear probing
+        while (0 != slots[slot]) { slot = (slot + 1) & *mask; }
+
+        slots[slot] = doc + 1;
+    }
+
+    return slots;
+}
+
+/**
+ * Looks up the doc id a page had in the index
+ *
+ * @param  index The mapped index
+ * @param  slots The slots from `hash_doc_paths`
+ * @param  mask  The number of slots - 1
+ * @param  path  The filepath of the page
+ * @return       The doc id, -1 if the page is new
+ */
+static int64_t find_doc_path(const Index* index, const uint32_t* slots,
+                             uint32_t mask, const char* path) {
+    uint32_t slot = hash_term(path, strlen(path)) & mask;
+
+    for (; 0 != slots[slot]; slot = (slot + 1) & mask) {
+        uint32_t doc = slots[slot] - 1;
+
+        if (0 == strcmp(index->strings + index->docs[doc].path_off, path)) {
+            return doc;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Merges the old dictionary with the terms of the changed and new pages
+ *
+ * Both are sorted, so they are merged like two sorted lists. A term whose
+ * posting list has none of the `stale` doc ids and no new pages is copied
+ * over byte for byte, every other posting list is rewritten.
+ *
+ * @param old    The old index
+ * @param stale  For every old doc id, whether its terms must be dropped
+ * @param table  The terms of the changed and new pages
+ * @param writer The dictionary to write to
+ */
+void merge_dictionary(const Index* old, const char* stale, const TermTable* table,
+                      DictWriter* writer) {
+    uint32_t n_terms;
+    BuildTerm** terms = sort_terms(table, &n_terms);
+
+    int any_stale = _FALSE_;
+
+    for (uint32_t i = 0; i < old->header->n_docs && !any_stale; i++) {
+        any_stale = stale[i];
+    }
+
+    DictCursor cursor = { .term = dict_term_buffer(old) };
+    int more = _FALSE_;
+
+    if (old->header->n_terms > 0) {
+        dict_seek(&cursor, old, 0);
+        more = dict_next(&cursor);
+    }
+
+    DocList docs = { .docs = NULL, .n = 0, .capacity = 0 };
+    uint32_t t = 0;
+
+    while (more || t < n_terms) {
+        // < 0 if only the old index has the term, > 0 if only the new pages
+        int cmp = !more ? 1
+                  : t == n_terms ? -1
+                  : compare_bytes(cursor.term, cursor.len, terms[t]->term, terms[t]->len);
+
+        int rewrite = cmp >= 0;
+        docs.n = 0;
+
+        if (cmp <= 0 && (any_stale || rewrite)) {
+            decode_postings(&docs, cursor.list, cursor.n_docs);
+
+            size_t n = 0;
+
+            for (size_t i = 0; i < docs.n; i++) {
+                if (!stale[docs.docs[i]]) { docs.docs[n++] = docs.docs[i]; }
+            }
+
+            if (n != docs.n) { rewrite = _TRUE_; }
+
+            docs.n = n;
+        }
+
+        if (!rewrite) {
+            size_t list_at = writer->postings.len;
+            size_t list_len = cursor.post_off - (cursor.list - old->postings);
+
+            buffer_append(&writer->postings, cursor.list, list_len);
+            dict_writer_add(writer, cursor.term, cursor.len, cursor.n_docs, list_at);
+        } else {
+            if (cmp >= 0) { append_doc_list(&docs, terms[t]->docs, terms[t]->n_docs); }
+
+            // Changed pages keep their doc ids, so the ids can be out of order
+            sort_doc_list(&docs);
+
+            // Every page containing the term was removed
+            if (docs.n > 0) {
+                const char* term = cmp > 0 ? terms[t]->term : cursor.term;
+                uint32_t len = cmp > 0 ? terms[t]->len : cursor.len;
+
+                size_t list_at = writer->postings.len;
+                encode_postings(&writer->postings, docs.docs, docs.n);
+                dict_writer_add(writer, term, len, docs.n, list_at);
+            }
+        }
+
+        if (cmp <= 0) { more = dict_next(&cursor); }
+        if (cmp >= 0) { t++; }
+    }
+
+    free(docs.docs);
+    free(cursor.term);
+    free(terms);
+}
+
+/**
+ * Refreshes the search index, only tokenizing the pages that are new or
+ * whose size or mtime changed since they were indexed. Builds the whole
+ * index instead if there is none yet, or too many doc ids are removed.
+ *
+ * @param  report Whether to print what was updated
+ * @return        The number of pages indexed
+ */
+int update_index(int report) {
+    Index old;
+
+    if (!load_index(&old)) { return build_index(report); }
+
+    uint32_t n_old = old.header->n_docs;
+
+    int64_t mtimes[MAX_SECTION + 1][2];
+    section_mtimes(mtimes);
+
+    PageEntry* pages;
+    size_t n_pages = collect_pages(&pages);
+
+    // Old pages keep their doc ids, new pages are numbered after them
+    BuildDoc* docs = checked_realloc(NULL, sizeof(BuildDoc) * (n_old + n_pages + 1),
+                                     "update_index");
+    char* stale = calloc(n_old + 1, sizeof(char));
+    char* seen = calloc(n_old + 1, sizeof(char));
+
+    IS_NULL(stale) {
+        fprintf(stderr, ERROR_IN_MALLOC, "update_index");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    IS_NULL(seen) {
+        fprintf(stderr, ERROR_IN_MALLOC, "update_index");
+        exit(WAPROPOS_FAILURE);
+    }
+
+    uint32_t mask;
+    uint32_t* slots = hash_doc_paths(&old, &mask);
+
+    TermTable table = { .slots = NULL, .capacity = 0, .n_terms = 0 };
+
+    uint32_t n_docs = n_old;
+    int n_new = 0;
+    int n_changed = 0;
+    int n_removed = 0;
+    int moved = _FALSE_;
+
+    for (size_t i = 0; i < n_pages; i++) {
+        struct stat st;
+
+        if (stat(pages[i].path, &st) < 0) {
+            fprintf(stderr, ERROR_IN_FOPEN, pages[i].path);
+            exit(WAPROPOS_FAILURE);
+        }
+
+        int64_t id = find_doc_path(&old, slots, mask, pages[i].path);
+        BuildDoc* doc = &docs[id < 0 ? n_docs : id];
+
+        doc->section = pages[i].section;
+        doc->rank = i;
+        doc->path = pages[i].path;
+
+        if (id >= 0 && doc_is_current(&old.docs[id], &st)) {
+            const char* name = old.strings + old.docs[id].name_off;
+
+            doc->name = NULL;
+            doc->size = old.docs[id].size;
+            doc->mtime_sec = old.docs[id].mtime_sec;
+            doc->mtime_nsec = old.docs[id].mtime_nsec;
+
+            if (NULL_TERMINATOR != name[0] && NULL == (doc->name = strdup(name))) {
+                fprintf(stderr, ERROR_IN_MALLOC, "update_index");
+                exit(WAPROPOS_FAILURE);
+            }
+
+            if (old.docs[id].rank != i) { moved = _TRUE_; }
+
+            seen[id] = _TRUE_;
+            continue;
+        }
+
+        if (id >= 0) {
+            stale[id] = _TRUE_;
+            seen[id] = _TRUE_;
+            n_changed++;
+        } else {
+            id = n_docs++;
+            n_new++;
+        }
+
+        index_doc(doc, &table, id);
+    }
+
+    // Pages that are gone keep their doc id, but in no posting list
+    int n_dead = 0;
+
+    for (uint32_t i = 0; i < n_old; i++) {
+        if (seen[i]) { continue; }
+
+        if (0 != old.docs[i].section) {
+            stale[i] = _TRUE_;
+            n_removed++;
+        }
+
+        docs[i].section = 0;
+        docs[i].rank = 0;
+        docs[i].path = "";
+        docs[i].name = NULL;
+        docs[i].size = 0;
+        docs[i].mtime_sec = 0;
+        docs[i].mtime_nsec = 0;
+        n_dead++;
+    }
+
+    int rebuild = (uint32_t) n_dead * MAX_REMOVED_FRACTION > n_docs;
+
+    // A page added and removed again leaves nothing to index, but the mtimes moved
+    int touched = 0 != memcmp(old.header->dir_mtime, mtimes, sizeof(old.header->dir_mtime));
+
+    if (!rebuild && (n_new || n_changed || n_removed || moved || touched)) {
+        DictWriter writer = { .n_terms = 0, .max_term_len = 0 };
+
+        merge_dictionary(&old, stale, &table, &writer);
+        write_index(docs, n_docs, &writer, mtimes);
+        dict_writer_destroy(&writer);
+    }
+
+    if (!rebuild && report) {
+        _PRINTF_(INDEX_UPDATED, INDEX_FILEPATH, n_new, n_changed, n_removed);
+    }
+
+    for (uint32_t i = 0; i < n_docs; i++) { free(docs[i].name); }
+
+    free(docs);
+    free(stale);
+    free(seen);
+    free(slots);
+    destroy_pages(pages, n_pages);
+    term_table_destroy(&table);
+    unload_index(&old);
+
+    // Removed pages waste space in the doc table, so compact it
+    if (rebuild) { return build_index(report); }
+
+    return n_pages;
+}
+
+/////////////////////////       End Index Update       /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////        Query Dispatch        /////////////////////////
+
+/**
+ * Parses the argument to `-j`. 0 means one thread per online CPU.
+ *
+ * @param  arg The argument to parse
+ * @return     The number of threads, -1 if `arg` is invalid
+ */
+int parse_thread_count(char* arg) {
+    char* end;
+    long n_threads = strtol(arg, &end, 10);
+
+    if (end == arg || NULL_TERMINATOR != *end || n_threads < 0) { return -1; }
+
+    if (0 == n_threads) { n_threads = sysconf(_SC_NPROCESSORS_ONLN); }
+
+    return n_threads < 1 ? 1 : (int) n_threads;
+}
+
+/**
+ * Whether the arguments build or update the index instead of querying it
+ *
+ * @param  argc The number of arguments, including the program name
+ * @param  argv The arguments
+ * @return      _TRUE_ for `--build-index` and `--update`, _FALSE_ otherwise
+ */
+int is_index_command(int argc, char* argv[]) {
+    return argc == 2 && (0 == strcmp(argv[1], BUILD_INDEX_FLAG)
+                         || 0 == strcmp(argv[1], UPDATE_FLAG));
+}
+
+/**
+ * Runs a query, printing the results to stdout
+ * This is the whole CLI, but also what the daemon runs for every request.
+ *
+ * @param  argc The number of arguments, including the program name
+ * @param  argv The arguments
+ * @return      The exit status of the query
+ */
+int run_query(int argc, char* argv[]) {
+    int n_threads = 1;
+
+    // Usage was: ./wapropos -j <threads> ...
+    if (argc > 2 && 0 == strcmp(argv[1], THREADS_FLAG)) {
+        n_threads = parse_thread_count(argv[2]);
+
+        // Not a valid number, or no keyword after it
+        if (n_threads < 0 || argc == 3) {
+            _PRINTF_(INVALID_USE);
+            return WAPROPOS_SUCCESS;
+        }
+
+        // Shift the flag out of the way
+        argc -= 2;
+        argv += 2;
+    }
+
+    // Usage was: ./wapropos -f <keyword>
+    if (argc == 3 && 0 == strcmp(argv[1], FUZZY_FLAG)) {
+        int count = run_fuzzy_search(argv[2]);
+
+        if (count < 0) {
+            _PRINTF_(index_is_stale ? STALE_INDEX : NO_INDEX);
+            return WAPROPOS_FAILURE;
+        }
+
+        if (0 == count) { _PRINTF_(KEYWORD_NOT_FOUND); }
+
+        return WAPROPOS_SUCCESS;
+    }
+
+    // Usage was: ./wapropos -a|-o <term> ...
+    if (argc > 2 && (0 == strcmp(argv[1], AND_FLAG) || 0 == strcmp(argv[1], OR_FLAG))) {
+        int count = run_term_search(argv + 2, argc - 2,
+                                    0 == strcmp(argv[1], AND_FLAG));
+
+        if (count < 0) {
+            _PRINTF_(index_is_stale ? STALE_INDEX : NO_INDEX);
+            return WAPROPOS_FAILURE;
+        }
+
+        if (0 == count) { _PRINTF_(KEYWORD_NOT_FOUND); }
+
+        return WAPROPOS_SUCCESS;
+    }
+
+    // Arg parse
+    switch (argc - 1) {
+        case 0: // Usage was : ./wapropos
+            _PRINTF_(NO_ARG);
+            break;
+        case 1: // Usage was: ./wapropos <keyword>
+            // Usage was: ./wapropos --build-index
+            if (0 == strcmp(argv[1], BUILD_INDEX_FLAG)) {
+                int lock = lock_index();
+                build_index(_TRUE_);
+                unlock_index(lock);
+                break;
+            }
+
+            // Usage was: ./wapropos --update
+            if (0 == strcmp(argv[1], UPDATE_FLAG)) {
+                int lock = lock_index();
+                update_index(_TRUE_);
+                unlock_index(lock);
+                break;
+            }
+
+            // If no file contain the specified keyword
+            if(0 == run_search(argv[1], n_threads)) { _PRINTF_(KEYWORD_NOT_FOUND); }
+
+            break;
+        default: // Usage was: ./wapropos <arg1> <arg2> ... <argc-1>
+            _PRINTF_(INVALID_USE);
+            break;
+    }
+
+    // Program succeeded
+    return WAPROPOS_SUCCESS;
+}
+
+/////////////////////////      End Query Dispatch      /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Query Daemon         /////////////////////////
+
+// The workers answering queries, so they can be stopped with the daemon
+static pid_t workers[DAEMON_WORKERS];
+
+// The client whose query a worker is running, -1 between queries
+static int current_client = -1;
+
+/**
+ * Removes the daemon's socket and stops its workers when the daemon is
+ * stopped
+ *
+ * @param sig The signal that stopped the daemon
+ */
+static void stop_daemon(int sig) {
+    (void) sig;
+
+    unlink(SOCKET_FILEPATH);
+
+    for (int i = 0; i < DAEMON_WORKERS; i++) {
+        if (workers[i] > 0) { kill(workers[i], SIGTERM); }
+    }
+
+    _exit(WAPROPOS_SUCCESS);
+}
+
+/**
+ * write, but retries until every byte was written
+ *
+ * @param  fd   The descriptor to write to
+ * @param  data The bytes to write
+ * @param  len  The number of bytes to write
+ * @return      0 on success, -1 if a write failed
+ */
+static int write_all(int fd, const void* data, size_t len) {
+    const char* pos = data;
+
+    while (len > 0) {
+        ssize_t n = write(fd, pos, len);
+
+        if (n < 0) { return -1; }
+
+        pos += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Answers the current query with a failure when it exits its worker.
+ * The query's output and errors were already written to the client.
+ */
+static void fail_request() {
+    if (current_client < 0) { return; }
+
+    unsigned char status = WAPROPOS_FAILURE;
+
+    fflush(stdout);
+    write_all(current_client, &status, 1);
+}
+
+/**
+ * Fills in the address of the daemon's socket
+ *
+ * @param addr The address to fill in
+ */
+static inline void daemon_address(struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, SOCKET_FILEPATH, sizeof(addr->sun_path) - 1);
+}
+
+/**
+ * Reads a request from a client. A request is the query's arguments, each
+ * one NUL terminated, and ends when the client shuts down its side. The
+ * client's stdout and stderr come with the first bytes, as SCM_RIGHTS.
+ *
+ * @param  client  The client's socket
+ * @param  request To store the request, DAEMON_MAX_REQUEST bytes long
+ * @param  argv    To store the arguments, DAEMON_MAX_ARGS + 1 long
+ * @param  fds     To store the client's stdout and stderr, -1 if not sent
+ * @return         The number of arguments including the program name,
+ *                 -1 if the request was malformed
+ */
+static int read_request(int client, char* request, char* argv[], int fds[2]) {
+    size_t len = 0;
+    ssize_t n;
+
+    while (_TRUE_) {
+        char control[CMSG_SPACE(2 * sizeof(int))];
+        struct iovec iov = { .iov_base = request + len,
+                             .iov_len = DAEMON_MAX_REQUEST - len };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                              .msg_control = control,
+                              .msg_controllen = sizeof(control) };
+
+        if (0 >= (n = recvmsg(client, &msg, MSG_CMSG_CLOEXEC))) { break; }
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+        for (; NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type) {
+                continue;
+            }
+
+            int n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int received[2];
+
+            memcpy(received, CMSG_DATA(cmsg), sizeof(int) * (n_fds < 2 ? n_fds : 2));
+
+            // Anything but one stdout and stderr is dropped
+            for (int i = 0; i < n_fds && i < 2; i++) {
+                if (fds[i] < 0 && 2 == n_fds) {
+                    fds[i] = received[i];
+                } else {
+                    close(received[i]);
+                }
+            }
+        }
+
+        len += n;
+
+        if (len == DAEMON_MAX_REQUEST) { return -1; }
+    }
+
+    if (n < 0 || (len > 0 && NULL_TERMINATOR != request[len - 1])) { return -1; }
+
+    int argc = 0;
+    argv[argc++] = "wapropos";
+
+    for (size_t i = 0; i < len; i += strlen(request + i) + 1) {
+        if (argc == DAEMON_MAX_ARGS) { return -1; }
+
+        argv[argc++] = request + i;
+    }
+
+    argv[argc] = NULL;
+
+    return argc;
+}
+
+/**
+ * Answers one query. The query runs exactly like it would in the CLI,
+ * with stdout and stderr pointed at the client's own, followed by one
+ * byte on the socket holding the exit status of the query.
+ *
+ * @param client The client's socket
+ * @param output The worker's own stdout, to restore after the query
+ * @param errors The worker's own stderr, to restore after the query
+ */
+void serve_request(int client, int output, int errors) {
+    static char request[DAEMON_MAX_REQUEST];
+    char* argv[DAEMON_MAX_ARGS + 1];
+    int fds[2] = { -1, -1 };
+
+    // Don't let a stuck client hold up its worker
+    struct timeval timeout = { .tv_sec = DAEMON_TIMEOUT_SEC, .tv_usec = 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    int argc = read_request(client, request, argv, fds);
+    unsigned char status = WAPROPOS_FAILURE;
+
+    // Indexing is never done on behalf of a client
+    if (argc >= 0 && fds[0] >= 0 && fds[1] >= 0 && !is_index_command(argc, argv)
+        && !(argc == 2 && 0 == strcmp(argv[1], DAEMON_FLAG))) {
+        fflush(stdout);
+        dup2(fds[0], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        current_client = client;
+
+        status = run_query(argc, argv);
+
+        // The client may have gone away, that's not the worker's problem
+        fflush(stdout);
+        clearerr(stdout);
+        clearerr(stderr);
+        current_client = -1;
+        dup2(output, STDOUT_FILENO);
+        dup2(errors, STDERR_FILENO);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] >= 0) { close(fds[i]); }
+    }
+
+    write_all(client, &status, 1);
+    close(client);
+}
+
+/**
+ * Runs one of the daemon's workers, which answers queries until the
+ * daemon stops. A query that fails exits its worker, `fail_request` still
+ * answers the client, and the daemon starts a new worker.
+ *
+ * @param server The daemon's listening socket
+ */
+static void run_worker(int server) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    // Workers don't outlive the daemon
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    atexit(fail_request);
+
+    int output = dup(STDOUT_FILENO);
+    int errors = dup(STDERR_FILENO);
+
+    while (_TRUE_) {
+        int client = accept(server, NULL, NULL);
+
+        if (client < 0) { continue; }
+
+        serve_request(client, output, errors);
+    }
+}
+
+/**
+ * Starts a worker for the daemon
+ *
+ * @param  server The daemon's listening socket
+ * @return        The worker's pid, -1 if it couldn't be started
+ */
+static pid_t start_worker(int server) {
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if (0 == pid) {
+        run_worker(server);
+        _exit(WAPROPOS_SUCCESS);
+    }
+
+    return pid;
+}
+
+/**
+ * Runs the query daemon. The search index is mapped once and kept hot, and
+ * DAEMON_WORKERS processes sharing the mapping answer queries over a UNIX
+ * socket until the daemon is stopped. If no index has been built yet, the
+ * daemon builds one first.
+ *
+ * @return The exit status, only returns if the daemon couldn't start
+ */
+int run_daemon() {
+    struct sockaddr_un addr;
+    daemon_address(&addr);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (server < 0) {
+        fprintf(stderr, ERROR_IN_SOCKET, SOCKET_FILEPATH);
+        return WAPROPOS_FAILURE;
+    }
+
+    // Another daemon is already answering queries
+    if (0 == connect(server, (struct sockaddr*) &addr, sizeof(addr))) {
+        fprintf(stderr, ERROR_IN_SOCKET, SOCKET_FILEPATH);
+        return WAPROPOS_FAILURE;
+    }
+
+    close(server);
+
+    keep_index = _TRUE_;
+
+    Index index;
+
+    if (!acquire_index(&index)) {
+        int lock = lock_index();
+        update_index(_TRUE_);
+        unlock_index(lock);
+
+        acquire_index(&index);
+    }
+
+    // Every worker needs its own watch, or they would take each other's events
+    if (index_watch >= 0) {
+        close(index_watch);
+        index_watch = -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_daemon);
+    signal(SIGTERM, stop_daemon);
+
+    // A socket left behind by a daemon that crashed
+    unlink(SOCKET_FILEPATH);
+
+    server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (server < 0 || bind(server, (struct sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(server, DAEMON_BACKLOG) < 0) {
+        fprintf(stderr, ERROR_IN_SOCKET, SOCKET_FILEPATH);
+        return WAPROPOS_FAILURE;
+    }
+
+    _PRINTF_(DAEMON_LISTENING, SOCKET_FILEPATH);
+
+    // Replace every worker that exited, whether a query failed or it crashed
+    while (_TRUE_) {
+        for (int i = 0; i < DAEMON_WORKERS; i++) {
+            if (workers[i] <= 0) { workers[i] = start_worker(server); }
+        }
+
+        pid_t pid = wait(NULL);
+
+        // No worker could be started, try again later
+        if (pid < 0) {
+            sleep(1);
+            continue;
+        }
+
+        for (int i = 0; i < DAEMON_WORKERS; i++) {
+            if (workers[i] == pid) { workers[i] = 0; }
+        }
+    }
+
+    return WAPROPOS_SUCCESS;
+}
+
+/**
+ * Sends the query to the daemon, if one is running, along with this
+ * process's stdout and stderr, which the query writes to directly.
+ *
+ * @param  argc The number of arguments, including the program name
+ * @param  argv The arguments
+ * @return      The exit status of the query, -1 if no daemon answered
+ */
+int query_daemon(int argc, char* argv[]) {
+    char request[DAEMON_MAX_REQUEST];
+    size_t len = 0;
+
+    for (int i = 1; i < argc; i++) {
+        size_t arg_len = strlen(argv[i]) + 1;
+
+        // The daemon would refuse it, run it here instead
+        if (len + arg_len >= DAEMON_MAX_REQUEST) { return -1; }
+
+        memcpy(request + len, argv[i], arg_len);
+        len += arg_len;
+    }
+
+    // The descriptors need at least one byte to travel with
+    if (0 == len) { return -1; }
+
+    struct sockaddr_un addr;
+    daemon_address(&addr);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) { return -1; }
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov = { .iov_base = request, .iov_len = len };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = control,
+                          .msg_controllen = sizeof(control) };
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent = sendmsg(fd, &msg, 0);
+
+    if (sent < 0 || write_all(fd, request + sent, len - sent) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    shutdown(fd, SHUT_WR);
+
+    // The query writes its output itself, all that comes back is the status
+    unsigned char status;
+    ssize_t n;
+
+    while ((n = read(fd, &status, 1)) < 0 && EINTR == errno) {}
+
+    close(fd);
+
+    return 1 == n ? status : WAPROPOS_FAILURE;
+}
+
+/////////////////////////       End Query Daemon       /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////             MAIN             /////////////////////////
+
+int main(int argc, char* argv[]) {
+    // Usage was: ./wapropos --daemon
+    if (argc == 2 && 0 == strcmp(argv[1], DAEMON_FLAG)) { return run_daemon(); }
+
+    // Queries go to the daemon if it's running, indexing is always local
+    if (!is_index_command(argc, argv)) {
+        int status = query_daemon(argc, argv);
+
+        if (status >= 0) { return status; }
+    }
+
+    return run_query(argc, argv);
 }
 
 /////////////////////////           END MAIN           /////////////////////////
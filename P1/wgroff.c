@@ -5,9 +5,13 @@
  */
 
 #include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 
@@ -25,6 +29,8 @@
 #define MAX_STR_LENGTH 256       /* Maximum length of a str or char[] */
 #define MAX_COMMAND_LENGTH 20    /* Maximum length of a str or char[] */
 #define OUTPUT_LENGTH 80         /* Maximum length of a str or char[] */
+#define MAX_OUT_FILENAME_LENGTH (MAX_STR_LENGTH + 3)  /* command + ".N" */
+#define MAX_TMP_FILENAME_LENGTH (MAX_OUT_FILENAME_LENGTH + MAX_FILENAME_LENGTH)
 
 #define IF_FORMAT_FAILED(x) if (x < 0)  /* Descriptive to avoid mistakes */
 #define IS_NULL(x) if (NULL == x)       /* Descriptive to avoid mistakes */
@@ -40,16 +46,13 @@
 #define INFILE_CSI_TH ".TH"  /* Infile control sequence for title header */
 #define INFILE_CSI_SH ".SH"  /* Infile control sequence for section header */
 
-#define INFILE_CSI_BOLD "/fB"       /* Infile control sequence for bold */
-#define INFILE_CSI_BOLD_L 3         /* Control sequence length for bold */
-#define INFILE_CSI_ITALIC "/fI"     /* Infile control sequence for italic */
-#define INFILE_CSI_ITALIC_L 3       /* Control sequence length for italic */
-#define INFILE_CSI_UNDERLINE "/fU"  /* Infile control sequence for underline */
-#define INFILE_CSI_UNDERLINE_L 3    /* Control sequence length for underline */
-#define INFILE_CSI_NORMAL "/fP"     /* Infile control sequence for reset */
-#define INFILE_CSI_NORMAL_L 3       /* Control sequence length for reset */
-#define INFILE_CSI_SLASH "//"       /* Infile control sequence for slash */
-#define INFILE_CSI_SLASH_L 2        /* Control sequence length for slash */
+#define INFILE_ESCAPE '/'     /* Starts every infile control sequence */
+#define INFILE_FONT 'f'       /* "/f" starts a font control sequence */
+#define INFILE_BOLD 'B'       /* Infile control sequence "/fB" for bold */
+#define INFILE_ITALIC 'I'     /* Infile control sequence "/fI" for italic */
+#define INFILE_UNDERLINE 'U'  /* Infile control sequence "/fU" for underline */
+#define INFILE_NORMAL 'P'     /* Infile control sequence "/fP" for reset */
+#define INFILE_SLASH '/'      /* Infile control sequence "//" for slash */
 
 #define ANSI_CSI_BOLD "\033[1m"       /* ANSI control sequence for bold */
 #define ANSI_CSI_BOLD_L 4             /* ANSI control sequence length for bold */
@@ -64,11 +67,26 @@
 
 #define INDENT "       "  /* 7 spaces for indentation */
 
+#define OUTPUT_BUFFER_SIZE 65536  /* Bytes buffered before writing an outfile */
+
+#define BATCH_FLAG "--batch"  /* CLA to render many infiles at once */
+#define THREADS_FLAG "-j"     /* CLA to set the number of threads */
+#define STDIN_LIST "-"        /* Reads the list of infiles from stdin */
+
+#define BATCH_INITIAL_CAPACITY 128  /* Infiles collected before growing */
+
+#define RENDER_SUCCESS 0        /* The page was rendered */
+#define RENDER_NOT_FOUND -1     /* The infile doesn't exist */
+#define RENDER_READ_FAILED -2   /* The infile couldn't be opened */
+#define RENDER_WRITE_FAILED -3  /* The outfile couldn't be written */
+#define RENDER_DUPLICATE -4     /* An earlier infile of the batch has the same outfile */
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////        Format Strings        /////////////////////////
 
 // If the program was invoked incorrectly
-SCCP INVALID_USE = "Usage: ./wgroff <file_name>\n";
+SCCP INVALID_USE = "Usage: ./wgroff <file_name>  or  "
+                   "./wgroff --batch [-j <threads>] <file|dir|-> ...\n";
 
 // If no arguments were provided
 SCCP NO_ARG = "Improper number of arguments\nUsage: ./wgroff <file>\n";
@@ -88,9 +106,36 @@ SCCP ERROR_IN_FOPEN_W = "File `%s` could not be opened to write\n";
 // If file doesn't exists
 SCCP FILE_NOT_FOUND = "File doesn't exist\n";
 
+// If opendir failed
+SCCP ERROR_IN_OPENDIR = "Error in opening directory `%s`\n";
+
+// If malloc failed
+SCCP ERROR_IN_MALLOC = "malloc failed in function `%s`\n";
+
+// If a worker thread could not be started
+SCCP ERROR_IN_PTHREAD = "Couldn't start worker thread %i\n";
+
+// If an infile of a batch doesn't exist
+SCCP BATCH_FILE_NOT_FOUND = "File `%s` doesn't exist\n";
+
+// If an infile of a batch isn't formatted correctly
+SCCP BATCH_INVALID_FORMAT = "File `%s`: Improper formatting on line %i\n";
+
+// If two infiles of a batch have the same command and section
+SCCP BATCH_DUPLICATE = "File `%s`: Outfile `%s` is already written by `%s`\n";
+
+// After a batch was rendered
+SCCP BATCH_DONE = "Rendered %i of %i files\n";
+
 // Output file
 SCCP OUT_FILE = "%s.%i";
 
+// Temporary output file, renamed to OUT_FILE once it's complete
+SCCP OUT_TMP_FILE = "%s.%i.%u.tmp";
+
+// A file in a directory of a batch
+SCCP BATCH_CHILD_PATH = "%s/%s";
+
 // Title header format
 SCCP TH_FORMAT = INFILE_CSI_TH " %s %i %s\n";
 
@@ -106,8 +151,24 @@ SCCP OUTFILE_LAST_LINE = "%s%s%s\n";
 // Section header in output
 SCCP OUTFILE_SECTION_HEADER = "\n" ANSI_CSI_BOLD "%s" ANSI_CSI_NORMAL "\n";
 
-// Normal indented line
-SCCP OUTFILE_INDENTED_LINE = INDENT "%s";
+// What an infile control sequence is translated to
+typedef struct {
+    const char* seq;  /* The ANSI control sequence */
+    size_t len;       /* The length of `seq`, 0 if there is no such sequence */
+} Escape;
+
+// Control sequences, by the byte after INFILE_ESCAPE
+static const Escape ESCAPES[UCHAR_MAX + 1] = {
+    [INFILE_SLASH] = { ANSI_CSI_SLASH, ANSI_CSI_SLASH_L },
+};
+
+// Font control sequences, by the byte after INFILE_ESCAPE INFILE_FONT
+static const Escape FONT_ESCAPES[UCHAR_MAX + 1] = {
+    [INFILE_BOLD] = { ANSI_CSI_BOLD, ANSI_CSI_BOLD_L },
+    [INFILE_ITALIC] = { ANSI_CSI_ITALIC, ANSI_CSI_ITALIC_L },
+    [INFILE_UNDERLINE] = { ANSI_CSI_UNDERLINE, ANSI_CSI_UNDERLINE_L },
+    [INFILE_NORMAL] = { ANSI_CSI_NORMAL, ANSI_CSI_NORMAL_L },
+};
 
 /////////////////////////      End Format Strings      /////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,56 +192,48 @@ int (*_PRINTF_)(const char*, ...) = printf;
  * Writes a formatted line to the specified output file,
  * applying ANSI escape codes for text formatting.
  *
+ * The line is translated in one pass. Plain text up to the next
+ * INFILE_ESCAPE is written as is, and the bytes after an INFILE_ESCAPE
+ * are looked up in ESCAPES and FONT_ESCAPES. Lines have no length limit.
+ *
  * @param outfile The file to write to
  * @param line    The line to parse and write
+ * @param len     The length of the line
  */
-void write_line(FILE* outfile, char* line) {
-    int len = strlen(line);
-
-    char buffer[MAX_STR_LENGTH];
-    int curr_idx = 0;
-
-    for (int i = 0; i < len;) {
-        // Check for bold CSI "/fB"
-        if (strncmp(line + i, INFILE_CSI_BOLD, INFILE_CSI_BOLD_L) == 0) {
-            strcpy(buffer + curr_idx, ANSI_CSI_BOLD);
-            curr_idx += ANSI_CSI_BOLD_L;
-            i += INFILE_CSI_BOLD_L;
-        }
-        // Check for italic CSI "/fI"
-        else if (strncmp(line + i, INFILE_CSI_ITALIC, INFILE_CSI_ITALIC_L) == 0) {
-            strcpy(buffer + curr_idx, ANSI_CSI_ITALIC);
-            curr_idx += ANSI_CSI_ITALIC_L;
-            i += INFILE_CSI_ITALIC_L;
-        }
-        // Check for underline CSI "/fU"
-        else if (strncmp(line + i, INFILE_CSI_UNDERLINE, INFILE_CSI_UNDERLINE_L) == 0) {
-            strcpy(buffer + curr_idx, ANSI_CSI_UNDERLINE);
-            curr_idx += ANSI_CSI_UNDERLINE_L;
-            i += INFILE_CSI_UNDERLINE_L;
-        }
-        // Check for reset/normal CSI "/fP"
-        else if (strncmp(line + i, INFILE_CSI_NORMAL, INFILE_CSI_NORMAL_L) == 0) {
-            strcpy(buffer + curr_idx, ANSI_CSI_NORMAL);
-            curr_idx += ANSI_CSI_NORMAL_L;
-            i += INFILE_CSI_NORMAL_L;
-        }
-        // Check for slashes "//"
-        else if (strncmp(line + i, INFILE_CSI_SLASH, INFILE_CSI_SLASH_L) == 0) {
-            strcpy(buffer + curr_idx, ANSI_CSI_SLASH);
-            curr_idx += ANSI_CSI_SLASH_L;
-            i += INFILE_CSI_SLASH_L;
-        }
-        // Non-CSI chars
-        else {
-            buffer[curr_idx++] = line[i++];
-        }
-    }
+void write_line(FILE* outfile, const char* line, size_t len) {
+    const char* end = line + len;
+
+    fputs(INDENT, outfile);
+
+    while (line < end) {
+        const char* escape = memchr(line, INFILE_ESCAPE, end - line);
 
-    // Terminate the string
-    buffer[curr_idx] = NULL_TERMINATOR;
+        IS_NULL(escape) { escape = end; }
+
+        fwrite(line, 1, escape - line, outfile);
+
+        if (escape == end) { break; }
+
+        const Escape* seq;
+        size_t skip;
+
+        if (escape + 1 < end && ESCAPES[(unsigned char) escape[1]].len > 0) {
+            seq = &ESCAPES[(unsigned char) escape[1]];
+            skip = 2;
+        } else if (escape + 2 < end && INFILE_FONT == escape[1]
+                   && FONT_ESCAPES[(unsigned char) escape[2]].len > 0) {
+            seq = &FONT_ESCAPES[(unsigned char) escape[2]];
+            skip = 3;
+        } else {
+            // Not a control sequence, just text
+            fputc(INFILE_ESCAPE, outfile);
+            line = escape + 1;
+            continue;
+        }
 
-    fprintf(outfile, OUTFILE_INDENTED_LINE, buffer);
+        fwrite(seq->seq, 1, seq->len, outfile);
+        line = escape + skip;
+    }
 }
 
 
@@ -197,6 +250,9 @@ void write_first_line(FILE* outfile, char* command, int section) {
 
     int n_spaces = OUTPUT_LENGTH - (2 * cmd_len);
 
+    // Very long commands don't leave room for any padding
+    if (n_spaces < 0) { n_spaces = 0; }
+
     // +1 for String terminator
     char* spaces = malloc(sizeof(char) * (n_spaces + 1));
 
@@ -252,93 +308,187 @@ void write_section_header(FILE* outfile, char* section_name) {
  * Read the file and perform preliminary checks for title headers,
  * section headers and comments.
  *
- * @param handle The infile to read from.
+ * The outfile is written to a temporary file which is renamed once the
+ * whole page was rendered, so readers never see a partial outfile, and
+ * an improperly formatted page leaves no outfile behind.
+ *
+ * @param  handle       The infile to read from.
+ * @param  out_filename To store the name of the outfile,
+ *                      MAX_OUT_FILENAME_LENGTH long
+ * @param  job          Makes the temporary file unique within the process
+ * @param  tmp_out      To store the name of the temporary file and leave
+ *                      the renaming to the caller, NULL to rename it here
+ * @return              RENDER_SUCCESS, the line with improper formatting,
+ *                      or RENDER_WRITE_FAILED if the outfile couldn't be
+ *                      written
  */
-void parse_file(FILE* handle) {
-    char buffer[MAX_STR_LENGTH];
+int parse_file(FILE* handle, char* out_filename, unsigned int job, char* tmp_out) {
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t len;
 
     int line_count = 1;
 
-    char command[MAX_STR_LENGTH];
     int section;
-    char date[DATE_STR_LENGTH + 1];
-    date[DATE_STR_LENGTH] = NULL_TERMINATOR;
 
-    // First line is handled separately
-    IS_NULL(fgets(buffer, MAX_STR_LENGTH, handle)) {
-        _PRINTF_(INVALID_FORMAT, line_count);
+    out_filename[0] = NULL_TERMINATOR;
 
-        // Invalid formatting is still a success
-        exit(WGROFF_SUCCESS);
+    // First line is handled separately
+    if (0 > (len = getline(&line, &size, handle))) {
+        free(line);
+        return line_count;
     }
 
-    // Parse first line
-    if (TH_ARG_COUNT != sscanf(buffer, TH_FORMAT, command, &section, date)) {
-        _PRINTF_(INVALID_FORMAT, line_count);
+    // Every field fits in a buffer as long as the line
+    char* command = malloc(len + 1);
+    char* date = malloc(len + 1);
 
-        // Invalid formatting is still a success
-        exit(WGROFF_SUCCESS);
+    IS_NULL(command) {
+        fprintf(stderr, ERROR_IN_MALLOC, "parse_file");
+        exit(WGROFF_FAILURE);
     }
 
-    // Validate section
-    if (section < 1 || section > 9) {
-        _PRINTF_(INVALID_FORMAT, line_count);
-
-        // Invalid formatting is still a success
-        exit(WGROFF_SUCCESS);
+    IS_NULL(date) {
+        fprintf(stderr, ERROR_IN_MALLOC, "parse_file");
+        exit(WGROFF_FAILURE);
     }
 
+    int status = RENDER_SUCCESS;
+
+    // Parse first line
+    if (TH_ARG_COUNT != sscanf(line, TH_FORMAT, command, &section, date)) {
+        status = line_count;
+    }
+    // Validate section
+    else if (section < 1 || section > 9) {
+        status = line_count;
+    }
     // Validate date
-    if (strlen(date) != DATE_STR_LENGTH) {
-        _PRINTF_(INVALID_FORMAT, line_count);
+    else if (strlen(date) != DATE_STR_LENGTH) {
+        status = line_count;
+    }
+    // No filesystem takes names this long
+    else if (strlen(command) >= MAX_STR_LENGTH) {
+        status = line_count;
+    }
 
-        // Invalid formatting is still a success
-        exit(WGROFF_SUCCESS);
+    if (RENDER_SUCCESS != status) {
+        free(command);
+        free(date);
+        free(line);
+        return status;
     }
 
-    // +3 for extension and string terminator
-    int filename_size = strlen(command) + 3;
-    char* out_filename = malloc(sizeof(char) * filename_size);
+    char tmp_filename[MAX_TMP_FILENAME_LENGTH];
 
     IF_FORMAT_FAILED(sprintf(out_filename, OUT_FILE, command, section)) {
         fprintf(stderr, ERROR_IN_FORMAT, "parse_file");
         exit(WGROFF_FAILURE);
     }
 
-    FILE* outfile = fopen(out_filename, "w");
+    IF_FORMAT_FAILED(sprintf(tmp_filename, OUT_TMP_FILE, out_filename,
+                             (int) getpid(), job)) {
+        fprintf(stderr, ERROR_IN_FORMAT, "parse_file");
+        exit(WGROFF_FAILURE);
+    }
 
-    free(out_filename);
+    FILE* outfile = fopen(tmp_filename, "w");
 
     IS_NULL(outfile) {
-        fprintf(stderr, ERROR_IN_FOPEN_W, out_filename);
-        exit(WGROFF_FAILURE);
+        free(command);
+        free(date);
+        free(line);
+        return RENDER_WRITE_FAILED;
     }
 
+    // Lines are written in small pieces, so buffer a lot of them
+    setvbuf(outfile, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
     write_first_line(outfile, command, section);
 
-    while (NULL != fgets(buffer, MAX_STR_LENGTH, handle)) {
+    while (0 <= (len = getline(&line, &size, handle))) {
         line_count++;
-        if (buffer[0] == COMMENT) {
+        if (line[0] == COMMENT) {
             continue;
         }
-        else if (strstr(buffer, INFILE_CSI_SH)) {
-            char section_name[MAX_STR_LENGTH];
+        else if (strstr(line, INFILE_CSI_SH)) {
+            char* section_name = malloc(len + 1);
 
-            // Parse first line
-            if (SH_ARG_COUNT != sscanf(buffer, SH_FORMAT, section_name)) {
-                _PRINTF_(INVALID_FORMAT, line_count);
+            IS_NULL(section_name) {
+                fprintf(stderr, ERROR_IN_MALLOC, "parse_file");
+                exit(WGROFF_FAILURE);
+            }
 
-                // Invalid formatting is still a success
-                exit(WGROFF_SUCCESS);
+            // Parse first line
+            if (SH_ARG_COUNT != sscanf(line, SH_FORMAT, section_name)) {
+                free(section_name);
+                status = line_count;
+                break;
             }
 
             write_section_header(outfile, section_name);
+            free(section_name);
         } else {
-            write_line(outfile, buffer);
+            write_line(outfile, line, len);
         }
     }
 
-    write_last_line(outfile, date);
+    if (RENDER_SUCCESS == status) { write_last_line(outfile, date); }
+
+    free(command);
+    free(date);
+    free(line);
+
+    if (0 != fclose(outfile) && RENDER_SUCCESS == status) {
+        status = RENDER_WRITE_FAILED;
+    }
+
+    if (RENDER_SUCCESS != status) {
+        unlink(tmp_filename);
+        return status;
+    }
+
+    IS_NOT_NULL(tmp_out) {
+        strcpy(tmp_out, tmp_filename);
+        return RENDER_SUCCESS;
+    }
+
+    if (0 != rename(tmp_filename, out_filename)) {
+        unlink(tmp_filename);
+        return RENDER_WRITE_FAILED;
+    }
+
+    return RENDER_SUCCESS;
+}
+
+/**
+ * Renders one infile
+ *
+ * @param  filename     The name of the infile
+ * @param  out_filename To store the name of the outfile,
+ *                      MAX_OUT_FILENAME_LENGTH long
+ * @param  job          Makes the temporary outfile unique within the process
+ * @param  tmp_out      See `parse_file`
+ * @return              The result of `parse_file`, or RENDER_NOT_FOUND or
+ *                      RENDER_READ_FAILED if the infile couldn't be read
+ */
+int render_file(const char* filename, char* out_filename, unsigned int job,
+                char* tmp_out) {
+    out_filename[0] = NULL_TERMINATOR;
+
+    // Does the file exist?
+    if (access(filename, F_OK)) { return RENDER_NOT_FOUND; }
+
+    FILE* handle = NULL;
+
+    // Can we open the file?
+    IS_NULL((handle = fopen(filename, "r"))) { return RENDER_READ_FAILED; }
+
+    int status = parse_file(handle, out_filename, job, tmp_out);
+
+    fclose(handle);
+
+    return status;
 }
 
 /**
@@ -348,25 +498,396 @@ void parse_file(FILE* handle) {
  * @param filename The name of the infile
  */
 void run_wgroff(char* filename) {
-    // Does the file exist?
-    if (access(filename, F_OK)) {
-        _PRINTF_(FILE_NOT_FOUND);
-        // 404 is still a success
-        exit(WGROFF_SUCCESS);
+    char out_filename[MAX_OUT_FILENAME_LENGTH];
+
+    int status = render_file(filename, out_filename, 0, NULL);
+
+    switch (status) {
+        case RENDER_SUCCESS:
+            break;
+        case RENDER_NOT_FOUND:
+            _PRINTF_(FILE_NOT_FOUND);
+            // 404 is still a success
+            exit(WGROFF_SUCCESS);
+        case RENDER_READ_FAILED:
+            _PRINTF_(ERROR_IN_FOPEN, filename);
+            exit(WGROFF_FAILURE);
+        case RENDER_WRITE_FAILED:
+            fprintf(stderr, ERROR_IN_FOPEN_W, out_filename);
+            exit(WGROFF_FAILURE);
+        default:
+            _PRINTF_(INVALID_FORMAT, status);
+
+            // Invalid formatting is still a success
+            exit(WGROFF_SUCCESS);
     }
+}
 
-    FILE* handle = NULL;
+/////////////////////////          End WGROFF          /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
 
-    // Can we open the file?
-    IS_NULL((handle = fopen(filename, "r"))) {
-        _PRINTF_(ERROR_IN_FOPEN, filename);
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Batch WGROFF         /////////////////////////
+
+typedef struct {
+    char* filename;          /* The infile */
+    int status;              /* The result of `render_file` */
+    char* out_filename;      /* The outfile, NULL if there is none yet */
+    char* tmp_filename;      /* The rendered page, until it is renamed */
+    const char* duplicate;   /* The earlier infile with the same outfile */
+} BatchJob;
+
+typedef struct {
+    BatchJob* jobs;        /* Every infile to render */
+    size_t n_jobs;         /* The number of infiles */
+    size_t capacity;       /* The capacity of `jobs` */
+    size_t next;           /* The next infile to hand out to a worker */
+    pthread_mutex_t lock;  /* Guards `next` */
+} Batch;
+
+/**
+ * Adds an infile to the batch
+ *
+ * @param batch    The batch to add to
+ * @param filename The name of the infile
+ */
+void add_batch_file(Batch* batch, const char* filename) {
+    if (batch->n_jobs == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2
+                                          : BATCH_INITIAL_CAPACITY;
+        batch->jobs = realloc(batch->jobs, sizeof(BatchJob) * batch->capacity);
+
+        IS_NULL(batch->jobs) {
+            fprintf(stderr, ERROR_IN_MALLOC, "add_batch_file");
+            exit(WGROFF_FAILURE);
+        }
+    }
+
+    BatchJob* job = &batch->jobs[batch->n_jobs++];
+
+    job->filename = strdup(filename);
+    job->status = RENDER_SUCCESS;
+    job->out_filename = NULL;
+    job->tmp_filename = NULL;
+    job->duplicate = NULL;
+
+    IS_NULL(job->filename) {
+        fprintf(stderr, ERROR_IN_MALLOC, "add_batch_file");
+        exit(WGROFF_FAILURE);
+    }
+}
+
+/**
+ * Adds an infile, or every infile in a directory tree, to the batch.
+ * Hidden files and directories are skipped.
+ *
+ * @param batch The batch to add to
+ * @param path  The infile or directory
+ */
+void add_batch_path(Batch* batch, const char* path) {
+    struct stat st;
+
+    // Missing files are reported like any other failure
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        add_batch_file(batch, path);
+        return;
+    }
+
+    DIR* dir = opendir(path);
+
+    IS_NULL(dir) {
+        fprintf(stderr, ERROR_IN_OPENDIR, path);
+        return;
+    }
+
+    struct dirent* entry;
+
+    while (NULL != (entry = readdir(dir))) {
+        // Ignore hidden files, cwd and parent
+        if (entry->d_name[0] == '.') continue;
+
+        char* child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+
+        IS_NULL(child) {
+            fprintf(stderr, ERROR_IN_MALLOC, "add_batch_path");
+            exit(WGROFF_FAILURE);
+        }
+
+        IF_FORMAT_FAILED(sprintf(child, BATCH_CHILD_PATH, path, entry->d_name)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "add_batch_path");
+            exit(WGROFF_FAILURE);
+        }
+
+        add_batch_path(batch, child);
+        free(child);
+    }
+
+    closedir(dir);
+}
+
+/**
+ * Adds every infile listed in the given file, one per line
+ *
+ * @param batch  The batch to add to
+ * @param handle The list of infiles
+ */
+void add_batch_list(Batch* batch, FILE* handle) {
+    char* line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    while (0 < (len = getline(&line, &size, handle))) {
+        if (line[len - 1] == '\n') { line[--len] = NULL_TERMINATOR; }
+
+        if (len > 0) { add_batch_path(batch, line); }
+    }
+
+    free(line);
+}
+
+/**
+ * Worker thread for `run_batch`
+ * Repeatedly claims the next infile until none are left.
+ *
+ * @param  arg The shared Batch
+ * @return     NULL
+ */
+static void* batch_worker(void* arg) {
+    Batch* batch = arg;
+    char out_filename[MAX_OUT_FILENAME_LENGTH];
+    char tmp_filename[MAX_TMP_FILENAME_LENGTH];
+
+    while (1) {
+        pthread_mutex_lock(&batch->lock);
+        size_t i = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (i >= batch->n_jobs) { break; }
+
+        BatchJob* job = &batch->jobs[i];
+
+        job->status = render_file(job->filename, out_filename, i, tmp_filename);
+
+        if (RENDER_SUCCESS == job->status || RENDER_WRITE_FAILED == job->status) {
+            job->out_filename = strdup(out_filename);
+
+            IS_NULL(job->out_filename) {
+                fprintf(stderr, ERROR_IN_MALLOC, "batch_worker");
+                exit(WGROFF_FAILURE);
+            }
+        }
+
+        // The outfile is only renamed into place once every name is known
+        if (RENDER_SUCCESS == job->status) {
+            job->tmp_filename = strdup(tmp_filename);
+
+            IS_NULL(job->tmp_filename) {
+                fprintf(stderr, ERROR_IN_MALLOC, "batch_worker");
+                exit(WGROFF_FAILURE);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Reports why an infile of the batch couldn't be rendered
+ *
+ * @param job The failed job
+ */
+void report_batch_failure(const BatchJob* job) {
+    switch (job->status) {
+        case RENDER_NOT_FOUND:
+            fprintf(stderr, BATCH_FILE_NOT_FOUND, job->filename);
+            break;
+        case RENDER_READ_FAILED:
+            fprintf(stderr, ERROR_IN_FOPEN, job->filename);
+            break;
+        case RENDER_WRITE_FAILED:
+            fprintf(stderr, ERROR_IN_FOPEN_W,
+                    NULL == job->out_filename ? job->filename : job->out_filename);
+            break;
+        case RENDER_DUPLICATE:
+            fprintf(stderr, BATCH_DUPLICATE, job->filename, job->out_filename,
+                    job->duplicate);
+            break;
+        default:
+            fprintf(stderr, BATCH_INVALID_FORMAT, job->filename, job->status);
+            break;
+    }
+}
+
+/**
+ * Orders rendered jobs by outfile, and jobs with the same outfile by
+ * their position in the batch
+ */
+static int compare_batch_outfiles(const void* a, const void* b) {
+    const BatchJob* job_a = *(const BatchJob* const*) a;
+    const BatchJob* job_b = *(const BatchJob* const*) b;
+
+    int order = strcmp(job_a->out_filename, job_b->out_filename);
+
+    if (0 != order) { return order; }
+
+    return (job_a > job_b) - (job_a < job_b);
+}
+
+/**
+ * Renames every rendered page into place. Outfiles are named after the
+ * title header, so two infiles with the same command and section would
+ * overwrite each other's outfile. Only the first of them in the batch is
+ * renamed, the others fail with RENDER_DUPLICATE.
+ *
+ * @param batch The rendered batch
+ */
+void finish_batch(Batch* batch) {
+    BatchJob** rendered = malloc(sizeof(BatchJob*) * (batch->n_jobs + 1));
+
+    IS_NULL(rendered) {
+        fprintf(stderr, ERROR_IN_MALLOC, "finish_batch");
+        exit(WGROFF_FAILURE);
+    }
+
+    size_t n_rendered = 0;
+
+    for (size_t i = 0; i < batch->n_jobs; i++) {
+        if (RENDER_SUCCESS == batch->jobs[i].status) { rendered[n_rendered++] = &batch->jobs[i]; }
+    }
+
+    qsort(rendered, n_rendered, sizeof(BatchJob*), compare_batch_outfiles);
+
+    for (size_t i = 0; i < n_rendered; i++) {
+        BatchJob* job = rendered[i];
+
+        if (i > 0 && 0 == strcmp(job->out_filename, rendered[i - 1]->out_filename)) {
+            // The first job with this outfile sorts before the others
+            job->duplicate = NULL == rendered[i - 1]->duplicate
+                             ? rendered[i - 1]->filename
+                             : rendered[i - 1]->duplicate;
+            job->status = RENDER_DUPLICATE;
+            unlink(job->tmp_filename);
+            continue;
+        }
+
+        if (0 != rename(job->tmp_filename, job->out_filename)) {
+            job->status = RENDER_WRITE_FAILED;
+            unlink(job->tmp_filename);
+        }
+    }
+
+    free(rendered);
+}
+
+/**
+ * Renders every infile of the batch on a pool of worker threads.
+ * A page that can't be rendered is reported, and the rest of the batch
+ * carries on.
+ *
+ * @param  batch     The infiles to render
+ * @param  n_threads The number of worker threads
+ * @return           WGROFF_SUCCESS if every page was rendered,
+ *                   WGROFF_FAILURE otherwise
+ */
+int run_batch(Batch* batch, int n_threads) {
+    if ((size_t) n_threads > batch->n_jobs) { n_threads = batch->n_jobs; }
+    if (n_threads < 1) { n_threads = 1; }
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * n_threads);
+
+    IS_NULL(threads) {
+        fprintf(stderr, ERROR_IN_MALLOC, "run_batch");
         exit(WGROFF_FAILURE);
     }
 
-    parse_file(handle);
+    batch->next = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+
+    for (int i = 0; i < n_threads; i++) {
+        if (0 != pthread_create(&threads[i], NULL, batch_worker, batch)) {
+            fprintf(stderr, ERROR_IN_PTHREAD, i);
+            exit(WGROFF_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < n_threads; i++) { pthread_join(threads[i], NULL); }
+
+    pthread_mutex_destroy(&batch->lock);
+    free(threads);
+
+    finish_batch(batch);
+
+    // Report in input order, so the report doesn't depend on scheduling
+    int n_rendered = 0;
+
+    for (size_t i = 0; i < batch->n_jobs; i++) {
+        if (RENDER_SUCCESS == batch->jobs[i].status) {
+            n_rendered++;
+        } else {
+            report_batch_failure(&batch->jobs[i]);
+        }
+    }
+
+    _PRINTF_(BATCH_DONE, n_rendered, (int) batch->n_jobs);
+
+    return n_rendered == (int) batch->n_jobs ? WGROFF_SUCCESS : WGROFF_FAILURE;
 }
 
-/////////////////////////          End WGROFF          /////////////////////////
+/**
+ * Parses the batch mode CLAs, and renders every infile they name
+ *
+ * @param  argc The number of arguments after BATCH_FLAG
+ * @param  argv The arguments after BATCH_FLAG
+ * @return      The exit status
+ */
+int run_wgroff_batch(int argc, char* argv[]) {
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Usage was: ./wgroff --batch -j <threads> ...
+    if (argc > 1 && 0 == strcmp(argv[0], THREADS_FLAG)) {
+        char* end;
+        n_threads = strtol(argv[1], &end, 10);
+
+        if (end == argv[1] || NULL_TERMINATOR != *end || n_threads < 1) {
+            _PRINTF_(INVALID_USE);
+            return WGROFF_SUCCESS;
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 1) {
+        _PRINTF_(INVALID_USE);
+        return WGROFF_SUCCESS;
+    }
+
+    Batch batch = { .jobs = NULL, .n_jobs = 0, .capacity = 0 };
+
+    for (int i = 0; i < argc; i++) {
+        // "-" reads the list of infiles from stdin
+        if (0 == strcmp(argv[i], STDIN_LIST)) {
+            add_batch_list(&batch, stdin);
+        } else {
+            add_batch_path(&batch, argv[i]);
+        }
+    }
+
+    int status = run_batch(&batch, n_threads < 1 ? 1 : (int) n_threads);
+
+    for (size_t i = 0; i < batch.n_jobs; i++) {
+        free(batch.jobs[i].filename);
+        free(batch.jobs[i].out_filename);
+        free(batch.jobs[i].tmp_filename);
+    }
+
+    free(batch.jobs);
+
+    return status;
+}
+
+/////////////////////////        End Batch WGROFF      /////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
 
@@ -383,9 +904,20 @@ int main(int argc, char *argv[]) {
         case 1: // Usage was: ./wgroff <file_name>
             filename = argv[1];
 
+            // Usage was: ./wgroff --batch
+            if (0 == strcmp(filename, BATCH_FLAG)) {
+                _PRINTF_(INVALID_USE);
+                break;
+            }
+
             run_wgroff(filename);
             break;
         default: // Usage was: ./wgroff <arg1> <arg2> ... <argc-1>
+            // Usage was: ./wgroff --batch [-j <threads>] <file|dir|-> ...
+            if (0 == strcmp(argv[1], BATCH_FLAG)) {
+                return run_wgroff_batch(argc - 2, argv + 2);
+            }
+
             _PRINTF_(INVALID_USE);
             break;
     }
@@ -4,11 +4,20 @@
  * @author Mrigank Kumar
  */
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "page_reader.h"
+
 #define WMAN_FAILURE 1  /* Exit status for failure */
 #define WMAN_SUCCESS 0  /* Exit status for success */
 
@@ -24,6 +33,38 @@
 #define IS_NOT_NULL(x) if (NULL != x)  /* Descriptive to avoid mistakes */
 #define IF_FORMAT_FAILED(x) if (x < 0)    /* Descriptive to avoid mistakes */
 
+#define NULL_TERMINATOR '\0'  /* String terminator character */
+#define SPACE ' '             /* The space character */
+#define ESCAPE '\033'         /* Starts an ANSI control sequence */
+#define CSI_START '['         /* Follows ESCAPE in a control sequence */
+
+#define MANWIDTH "MANWIDTH"  /* Environment variable to set the width */
+
+/* Enough spaces to indent any wrapped line */
+#define INDENT_SPACES "                                                  " \
+                      "                                                  " \
+                      "                                                  " \
+                      "                                                  " \
+                      "                                                  " \
+                      "                                                  "
+
+#define ALL_FLAG "-a"      /* Flag to print the page from every section */
+#define KEYWORD_FLAG "-k"  /* Flag to search page names for a keyword */
+
+#define FNV_OFFSET 14695981039346656037ull  /* FNV-1a initial hash */
+#define FNV_PRIME 1099511628211ull          /* FNV-1a multiplier */
+
+#define INDEX_MAGIC 0x584e4d57     /* "WMNX", marks a wman page index */
+#define INDEX_VERSION 1            /* Layout version of the page index */
+#define INDEX_LOAD_FACTOR 2        /* At least this many buckets per name */
+#define INDEX_INITIAL_CAPACITY 64  /* Pages listed before growing the list */
+#define INDEX_FILE_MODE 0644       /* Permissions of the page index */
+
+#define CACHE_MAX_BYTES (8 << 20)           /* Size cap of the page cache */
+#define CACHE_ENTRIES_INITIAL_CAPACITY 64   /* Cache entries before growing */
+#define CACHE_DIR_MODE 0755                 /* Permissions of the cache */
+#define CACHE_FILE_MODE 0644                /* Permissions of a cached page */
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////        Format Strings        /////////////////////////
 
@@ -48,15 +89,38 @@ SCCP ERROR_IN_FORMAT = "Couldn't write to formatted string in func `%s`\n";
 // If fopen failed
 SCCP ERROR_IN_FOPEN = "File `%s` was found, but could not be opened to read\n";
 
+// If malloc failed
+SCCP ERROR_IN_MALLOC = "malloc failed in function `%s`\n";
+
+// If no page name contained the keyword
+SCCP KEYWORD_NOT_FOUND = "nothing appropriate\n";
+
+// A page name found by a keyword search
+SCCP KEYWORD_OUTPUT = "%s (%i)\n";
+
 /* Cross platform compatibility (not required, but I don't think it hurts)*/
 /* This was inspired by multiple answers on StackOverflow */
 /* Link: https://stackoverflow.com/q/12971499/10812282 */
 #if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
 SCCP FILEPATH = ".\\man_pages\\man%i\\%s.%i";
+SCCP DIRPATH = ".\\man_pages\\man%i";
+SCCP INDEX_FILEPATH = ".\\man_pages\\.wman.index";
+SCCP CACHE_DIRPATH = ".\\man_pages\\.wman.cache";
+SCCP CACHE_FILEPATH = ".\\man_pages\\.wman.cache\\%016llx";
 #else
 SCCP FILEPATH = "./man_pages/man%i/%s.%i";
+SCCP DIRPATH = "./man_pages/man%i";
+SCCP INDEX_FILEPATH = "./man_pages/.wman.index";
+SCCP CACHE_DIRPATH = "./man_pages/.wman.cache";
+SCCP CACHE_FILEPATH = "./man_pages/.wman.cache/%016llx";
 #endif
 
+// Temporary file for a page being cached
+SCCP CACHE_TMP_FILEPATH = "%s.%i.tmp";
+
+// Temporary file for the page index being written
+SCCP INDEX_TMP_FILEPATH = "%s.%i.tmp";
+
 /////////////////////////      End Format Strings      /////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -75,7 +139,7 @@ int (*_PRINTF_)(const char*, ...) = printf;
  * In case of failure to format the string, exits the program with status
  * WMAN_FAILURE
  *
- * This function is inlined as it's only called once. Separated for readability.
+ * This function is inlined as it's only called from main. Separated for readability.
  *
  * @param str  Where to store the formatted error message
  * @param page The page that was not found
@@ -112,6 +176,406 @@ static inline void page_not_found_in_section_msg(char* str, const char* page,
 ////////////////////////////////////////////////////////////////////////////////
 
 
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////          Page Index          /////////////////////////
+
+typedef struct {
+    uint32_t magic;        /* INDEX_MAGIC */
+    uint32_t version;      /* INDEX_VERSION */
+    uint32_t n_names;      /* Number of distinct page names */
+    uint32_t n_buckets;    /* Number of hash buckets, a power of 2 */
+    uint32_t names_size;   /* Size of the name pool in bytes */
+    uint32_t reserved;     /* Padding, always 0 */
+    int64_t dir_mtime[MAX_SECTION + 1][2];  /* mtime of man<i>, -1 if missing */
+} IndexHeader;
+
+typedef struct {
+    uint32_t name_off;  /* Offset of the NUL terminated name in the pool */
+    uint16_t name_len;  /* Length of the name */
+    uint16_t sections;  /* Bit `i` is set if the page is in section `i` */
+} IndexName;
+
+typedef struct {
+    Page page;                 /* The index, mapped or built in memory */
+    const IndexHeader* header; /* The header, at the start of the page */
+    const IndexName* names;    /* The names, sorted */
+    const uint32_t* buckets;   /* 1 + the name in each bucket, 0 if empty */
+    const char* pool;          /* The NUL terminated names */
+} PageIndex;
+
+typedef struct {
+    char* name;   /* The name of the page */
+    int section;  /* The section the page is in */
+} IndexedPage;
+
+/**
+ * write, but retries until every byte was written
+ *
+ * @param  fd   The descriptor to write to
+ * @param  data The bytes to write
+ * @param  len  The number of bytes to write
+ * @return      0 on success, -1 if a write failed
+ */
+static int write_all(int fd, const void* data, size_t len) {
+    const char* pos = data;
+
+    while (len > 0) {
+        ssize_t n = write(fd, pos, len);
+
+        if (n < 0) { return -1; }
+
+        pos += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * FNV-1a hash of `len` bytes, continuing from `hash`
+ *
+ * @param  hash The hash so far
+ * @param  data The bytes to hash
+ * @param  len  The number of bytes to hash
+ * @return      The hash
+ */
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t len) {
+    const unsigned char* bytes = data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Gets the mtime of every section's directory. The index is current as
+ * long as none of them changed, since adding, removing or renaming a page
+ * changes the mtime of its directory.
+ *
+ * @param mtimes To store the mtimes, -1 for sections that don't exist
+ */
+void section_mtimes(int64_t mtimes[MAX_SECTION + 1][2]) {
+    char dirpath[MAX_STR_LENGTH];
+    struct stat st;
+
+    memset(mtimes, 0, sizeof(int64_t) * (MAX_SECTION + 1) * 2);
+
+    for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+        IF_FORMAT_FAILED(sprintf(dirpath, DIRPATH, section)) {
+            fprintf(stderr, ERROR_IN_FORMAT, "section_mtimes");
+            exit(WMAN_FAILURE);
+        }
+
+        if (stat(dirpath, &st) < 0) {
+            mtimes[section][0] = mtimes[section][1] = -1;
+            continue;
+        }
+
+        mtimes[section][0] = st.st_mtim.tv_sec;
+        mtimes[section][1] = st.st_mtim.tv_nsec;
+    }
+}
+
+/**
+ * Points the views of the index into its page
+ *
+ * @param index The index to set up
+ */
+static void set_index_views(PageIndex* index) {
+    const char* data = index->page.data;
+
+    index->header = (const IndexHeader*) data;
+    index->names = (const IndexName*) (data + sizeof(IndexHeader));
+    index->buckets = (const uint32_t*) (index->names + index->header->n_names);
+    index->pool = (const char*) (index->buckets + index->header->n_buckets);
+}
+
+/**
+ * Checks that the index on disk is whole, and was built from the current
+ * contents of every section
+ *
+ * @param  index  The index read from disk
+ * @param  mtimes The current mtimes of the sections
+ * @return        1 if the index can be used, 0 if it must be rebuilt
+ */
+int index_is_current(const Page* index, int64_t mtimes[MAX_SECTION + 1][2]) {
+    if (index->size < sizeof(IndexHeader)) { return 0; }
+
+    const IndexHeader* header = (const IndexHeader*) index->data;
+
+    if (header->magic != INDEX_MAGIC || header->version != INDEX_VERSION) {
+        return 0;
+    }
+
+    // There is always an empty bucket, so every probe ends
+    if (header->n_buckets <= header->n_names
+        || 0 != (header->n_buckets & (header->n_buckets - 1))) {
+        return 0;
+    }
+
+    size_t size = sizeof(IndexHeader) + sizeof(IndexName) * header->n_names
+                  + sizeof(uint32_t) * header->n_buckets + header->names_size;
+
+    if (index->size != size) { return 0; }
+
+    return 0 == memcmp(header->dir_mtime, mtimes, sizeof(header->dir_mtime));
+}
+
+/**
+ * Orders pages by name then section, for qsort
+ */
+static int compare_indexed_pages(const void* a, const void* b) {
+    const IndexedPage* x = a;
+    const IndexedPage* y = b;
+    int cmp = strcmp(x->name, y->name);
+
+    return 0 != cmp ? cmp : x->section - y->section;
+}
+
+/**
+ * Lists the pages in one section
+ *
+ * @param pages    The pages found so far, grown as needed
+ * @param n_pages  The number of pages found so far
+ * @param capacity The capacity of `pages`
+ * @param section  The section to list
+ */
+void list_section(IndexedPage** pages, size_t* n_pages, size_t* capacity,
+                  int section) {
+    char dirpath[MAX_STR_LENGTH];
+
+    IF_FORMAT_FAILED(sprintf(dirpath, DIRPATH, section)) {
+        fprintf(stderr, ERROR_IN_FORMAT, "list_section");
+        exit(WMAN_FAILURE);
+    }
+
+    DIR* dir = opendir(dirpath);
+
+    IS_NULL(dir) { return; }
+
+    struct dirent* entry;
+
+    while (NULL != (entry = readdir(dir))) {
+        size_t len = strlen(entry->d_name);
+
+        // Only `<page>.<section>` is a page of this section
+        if (len < 3 || len - 2 > UINT16_MAX
+            || entry->d_name[len - 2] != '.'
+            || entry->d_name[len - 1] != '0' + section) {
+            continue;
+        }
+
+        if (*n_pages == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : INDEX_INITIAL_CAPACITY;
+            *pages = realloc(*pages, sizeof(IndexedPage) * *capacity);
+
+            IS_NULL(*pages) {
+                fprintf(stderr, ERROR_IN_MALLOC, "list_section");
+                exit(WMAN_FAILURE);
+            }
+        }
+
+        (*pages)[*n_pages].name = strndup(entry->d_name, len - 2);
+        (*pages)[*n_pages].section = section;
+
+        IS_NULL((*pages)[*n_pages].name) {
+            fprintf(stderr, ERROR_IN_MALLOC, "list_section");
+            exit(WMAN_FAILURE);
+        }
+
+        (*n_pages)++;
+    }
+
+    closedir(dir);
+}
+
+/**
+ * Writes the index to disk, through a temporary file and a rename.
+ * Failing to write the index is not an error, the next `wman` rebuilds it.
+ *
+ * @param index The index to write
+ */
+void write_index(const Page* index) {
+    char tmp_path[MAX_STR_LENGTH];
+
+    IF_FORMAT_FAILED(sprintf(tmp_path, INDEX_TMP_FILEPATH, INDEX_FILEPATH, (int) getpid())) {
+        fprintf(stderr, ERROR_IN_FORMAT, "write_index");
+        exit(WMAN_FAILURE);
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, INDEX_FILE_MODE);
+
+    if (fd < 0) { return; }
+
+    int failed = write_all(fd, index->data, index->size) < 0;
+
+    if (0 != close(fd) || failed || 0 != rename(tmp_path, INDEX_FILEPATH)) {
+        unlink(tmp_path);
+    }
+}
+
+/**
+ * Builds the index from the contents of every section, and saves it
+ *
+ * @param index  To store the index, built in memory
+ * @param mtimes The mtimes of the sections, taken before listing them
+ */
+void build_index(PageIndex* index, int64_t mtimes[MAX_SECTION + 1][2]) {
+    IndexedPage* pages = NULL;
+    size_t n_pages = 0;
+    size_t capacity = 0;
+
+    for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+        if (mtimes[section][0] != -1) {
+            list_section(&pages, &n_pages, &capacity, section);
+        }
+    }
+
+    qsort(pages, n_pages, sizeof(IndexedPage), compare_indexed_pages);
+
+    // Count the distinct names, and the bytes to store them
+    uint32_t n_names = 0;
+    uint32_t names_size = 0;
+
+    for (size_t i = 0; i < n_pages; i++) {
+        if (0 == i || 0 != strcmp(pages[i].name, pages[i - 1].name)) {
+            n_names++;
+            names_size += strlen(pages[i].name) + 1;
+        }
+    }
+
+    uint32_t n_buckets = 1;
+
+    while (n_buckets < INDEX_LOAD_FACTOR * n_names + 1) { n_buckets *= 2; }
+
+    index->page.size = sizeof(IndexHeader) + sizeof(IndexName) * n_names
+                       + sizeof(uint32_t) * n_buckets + names_size;
+    index->page.data = calloc(1, index->page.size);
+    index->page.mapped = 0;
+
+    IS_NULL(index->page.data) {
+        fprintf(stderr, ERROR_IN_MALLOC, "build_index");
+        exit(WMAN_FAILURE);
+    }
+
+    IndexHeader* header = (IndexHeader*) index->page.data;
+
+    header->magic = INDEX_MAGIC;
+    header->version = INDEX_VERSION;
+    header->n_names = n_names;
+    header->n_buckets = n_buckets;
+    header->names_size = names_size;
+    memcpy(header->dir_mtime, mtimes, sizeof(header->dir_mtime));
+
+    set_index_views(index);
+
+    IndexName* names = (IndexName*) index->names;
+    uint32_t* buckets = (uint32_t*) index->buckets;
+    char* pool = (char*) index->pool;
+    uint32_t name = 0;
+    uint32_t pool_len = 0;
+
+    for (size_t i = 0; i < n_pages; i++) {
+        // Pages with the same name are next to each other after sorting
+        if (i > 0 && 0 == strcmp(pages[i].name, pages[i - 1].name)) {
+            names[name - 1].sections |= 1 << pages[i].section;
+            continue;
+        }
+
+        size_t len = strlen(pages[i].name);
+
+        names[name].name_off = pool_len;
+        names[name].name_len = len;
+        names[name].sections = 1 << pages[i].section;
+        memcpy(pool + pool_len, pages[i].name, len + 1);
+        pool_len += len + 1;
+
+        uint32_t bucket = hash_bytes(FNV_OFFSET, pages[i].name, len) & (n_buckets - 1);
+
+        while (0 != buckets[bucket]) { bucket = (bucket + 1) & (n_buckets - 1); }
+
+        buckets[bucket] = ++name;
+    }
+
+    for (size_t i = 0; i < n_pages; i++) { free(pages[i].name); }
+
+    free(pages);
+
+    write_index(&index->page);
+}
+
+/**
+ * Gets the page index, loading it the first time it is needed.
+ * The index on disk is rebuilt if any section changed since it was built.
+ *
+ * @return The page index
+ */
+const PageIndex* page_index() {
+    static PageIndex index;
+    static int loaded = 0;
+
+    if (loaded) { return &index; }
+
+    int64_t mtimes[MAX_SECTION + 1][2];
+    section_mtimes(mtimes);
+
+    if (0 == page_open(&index.page, INDEX_FILEPATH)) {
+        if (index_is_current(&index.page, mtimes)) {
+            set_index_views(&index);
+            loaded = 1;
+            return &index;
+        }
+
+        page_close(&index.page);
+    }
+
+    build_index(&index, mtimes);
+    loaded = 1;
+
+    return &index;
+}
+
+/**
+ * Looks up the sections a page is in, with a single hash probe
+ *
+ * @param  index The page index
+ * @param  page  The name of the page
+ * @return       Bit `i` is set if the page is in section `i`
+ */
+int lookup_sections(const PageIndex* index, const char* page) {
+    size_t len = strlen(page);
+    uint32_t mask = index->header->n_buckets - 1;
+    uint32_t bucket = hash_bytes(FNV_OFFSET, page, len) & mask;
+
+    for (uint32_t probes = 0; probes <= mask; probes++) {
+        uint32_t entry = index->buckets[bucket];
+
+        if (0 == entry) { return 0; }
+
+        // A damaged index can't point outside of itself
+        if (entry > index->header->n_names) { return 0; }
+
+        const IndexName* name = &index->names[entry - 1];
+
+        if (name->name_len == len
+            && (size_t) name->name_off + len < index->header->names_size
+            && 0 == memcmp(index->pool + name->name_off, page, len)) {
+            return name->sections;
+        }
+
+        bucket = (bucket + 1) & mask;
+    }
+
+    return 0;
+}
+
+/////////////////////////        End Page Index        /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////       Search Functions       /////////////////////////
 
@@ -136,44 +600,41 @@ static inline void build_filepath(char* str, char* page, int section) {
  * Search through the sub folder specified by `section`
  * to find a manual entry for `page`
  *
- * @param  page The page to find a manual entry for
- * @return      A handle to the file if the manual is found. NULL otherwise
+ * @param  filepath To store the filepath to the manual entry
+ * @param  page     The page to find a manual entry for
+ * @param  section  The section to search in
+ * @return          `filepath` if the manual is found. NULL otherwise
  */
-FILE* search_page_in_section(char* page, int section) {
-    char filename[MAX_STR_LENGTH];
-    build_filepath(filename, page, section);
-
-    if (access(filename, F_OK | R_OK)) { return NULL; }
+char* search_page_in_section(char* filepath, char* page, int section) {
+    build_filepath(filepath, page, section);
 
-    FILE* handle;
-
-    IS_NULL((handle = fopen(filename, "r"))) {
-        fprintf(stderr, ERROR_IN_FOPEN, filename);
-
-        exit(WMAN_FAILURE);
-    }
+    if (access(filepath, F_OK | R_OK)) { return NULL; }
 
-    return handle;
+    return filepath;
 }
 
 /**
  * Search through all sub folders to find a manual entry for `page`
  *
- * @param  page The page to find a manual entry for
- * @return      A handle to the file if the manual is found. NULL otherwise
+ * The page index tells which sections have the page, so only those are
+ * checked instead of every section.
+ *
+ * @param  filepath To store the filepath to the manual entry
+ * @param  page     The page to find a manual entry for
+ * @return          `filepath` if the manual is found. NULL otherwise
  */
-FILE* search_all_pages(char* page) {
-    FILE* handle = NULL;
+char* search_all_pages(char* filepath, char* page) {
+    int sections = lookup_sections(page_index(), page);
 
     for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
-        handle = search_page_in_section(page, section);
+        if (!(sections & (1 << section))) { continue; }
 
-        IS_NOT_NULL(handle) {
-            return handle;
+        IS_NOT_NULL(search_page_in_section(filepath, page, section)) {
+            return filepath;
         }
     }
 
-    return handle;
+    return NULL;
 }
 
 /////////////////////////     End Search Functions     /////////////////////////
@@ -182,32 +643,556 @@ FILE* search_all_pages(char* page) {
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////          Print File          /////////////////////////
 
+/**
+ * Copies `size` bytes from `fd` to stdout
+ *
+ * The bytes are sent with `sendfile`, so they are copied inside the
+ * kernel and never pass through this process.
+ *
+ * @param  fd   The descriptor to copy from, at the offset to start at
+ * @param  size The number of bytes to copy
+ * @return      0 on success, -1 if stdout couldn't be written
+ */
+int copy_to_stdout(int fd, size_t size) {
+    fflush(stdout);
+
+    while (size > 0) {
+        ssize_t n = sendfile(STDOUT_FILENO, fd, NULL, size);
+
+        if (n <= 0) { break; }
+
+        size -= n;
+    }
+
+    // sendfile can't write to every kind of stdout (like one opened with
+    // O_APPEND), so copy whatever is left by hand
+    char buffer[PAGE_READ_CHUNK];
+    ssize_t n;
+
+    while (size > 0 && 0 < (n = read(fd, buffer, sizeof(buffer)))) {
+        if (write_all(STDOUT_FILENO, buffer, n) < 0) { return -1; }
+
+        size -= (size_t) n < size ? (size_t) n : size;
+    }
+
+    return 0 == size ? 0 : -1;
+}
+
 /**
  * Prints the file to stdout
- * @param handle A handle to the file to print
+ *
+ * The page is written out with a single `sendfile`, instead of being
+ * copied through a line buffer.
+ *
+ * @param filepath The filepath to the file to print
  */
-void print_file(FILE* handle) {
-    char buffer[MAX_STR_LENGTH];
+void print_file(char* filepath) {
+    int fd = open(filepath, O_RDONLY);
+    struct stat st;
 
-    while (NULL != fgets(buffer, MAX_STR_LENGTH, handle)) {
-        printf("%s", buffer);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, ERROR_IN_FOPEN, filepath);
+        exit(WMAN_FAILURE);
+    }
+
+    if (copy_to_stdout(fd, st.st_size) < 0) {
+        close(fd);
+        exit(WMAN_FAILURE);
     }
+
+    close(fd);
 }
 
 /////////////////////////        End Print File        /////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
 
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////         Render Page          /////////////////////////
+
+typedef struct {
+    char* data;       /* The rendered page */
+    size_t len;       /* Number of bytes used */
+    size_t capacity;  /* Number of bytes allocated */
+} RenderBuffer;
+
+/**
+ * Appends bytes to the rendered page
+ *
+ * @param out  The rendered page
+ * @param data The bytes to append
+ * @param len  The number of bytes to append
+ */
+static void render_append(RenderBuffer* out, const char* data, size_t len) {
+    if (out->len + len > out->capacity) {
+        out->capacity = 2 * (out->len + len);
+        out->data = realloc(out->data, out->capacity);
+
+        IS_NULL(out->data) {
+            fprintf(stderr, ERROR_IN_MALLOC, "render_append");
+            exit(WMAN_FAILURE);
+        }
+    }
+
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+/**
+ * Gets the width to render pages for. MANWIDTH takes precedence over the
+ * width of the terminal, like it does for `man`.
+ *
+ * @return The number of columns, 0 if pages should be printed as is
+ */
+int terminal_width() {
+    char* manwidth = getenv(MANWIDTH);
+
+    IS_NOT_NULL(manwidth) { return atoi(manwidth) > 0 ? atoi(manwidth) : 0; }
+
+    struct winsize ws;
+
+    if (isatty(STDOUT_FILENO) && 0 == ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)) {
+        return ws.ws_col;
+    }
+
+    return 0;
+}
+
+/**
+ * Gets the length of the ANSI control sequence at the start of `text`
+ *
+ * @param  text The text, starting with ESCAPE
+ * @param  len  The length of `text`
+ * @return      The length of the control sequence
+ */
+static size_t escape_length(const char* text, size_t len) {
+    if (len < 2 || text[1] != CSI_START) { return 1; }
+
+    // Parameters, then one final byte in '@'..'~'
+    size_t i = 2;
+
+    while (i < len && !(text[i] >= '@' && text[i] <= '~')) { i++; }
+
+    return i < len ? i + 1 : len;
+}
+
+/**
+ * Renders one line, wrapping it at word boundaries so no piece is wider
+ * than `width` columns. The pieces after the first are indented as much
+ * as the line itself. ANSI control sequences take up no columns.
+ *
+ * @param out   The rendered page
+ * @param line  The line, without its newline
+ * @param len   The length of the line
+ * @param width The number of columns
+ */
+void render_line(RenderBuffer* out, const char* line, size_t len, int width) {
+    size_t indent = 0;
+
+    while (indent < len && line[indent] == SPACE) { indent++; }
+
+    // Keep at least half the width for text
+    if (indent > (size_t) width / 2) { indent = width / 2; }
+    if (indent > sizeof(INDENT_SPACES) - 1) { indent = sizeof(INDENT_SPACES) - 1; }
+
+    const char* end = line + len;
+    int first = 1;
+
+    while (1) {
+        int avail = first ? width : width - (int) indent;
+        int col = 0;
+        const char* cut = NULL;
+        const char* last_space = NULL;
+        const char* c = line;
+
+        while (c < end) {
+            if (*c == ESCAPE) {
+                c += escape_length(c, end - c);
+                continue;
+            }
+
+            // UTF-8 continuation bytes don't take up a column
+            if ((*c & 0xC0) != 0x80) {
+                if (col == avail) {
+                    cut = c;
+                    break;
+                }
+
+                col++;
+            }
+
+            if (*c == SPACE) { last_space = c; }
+
+            c++;
+        }
+
+        IS_NULL(cut) {
+            if (!first) { render_append(out, INDENT_SPACES, indent); }
+            render_append(out, line, end - line);
+            render_append(out, "\n", 1);
+            return;
+        }
+
+        // Break at the last space if there is one, mid word otherwise
+        const char* brk = (NULL != last_space && last_space > line) ? last_space : cut;
+        const char* piece_end = brk;
+
+        while (piece_end > line && *(piece_end - 1) == SPACE) { piece_end--; }
+
+        if (!first) { render_append(out, INDENT_SPACES, indent); }
+        render_append(out, line, piece_end - line);
+        render_append(out, "\n", 1);
+
+        line = brk;
+
+        while (line < end && *line == SPACE) { line++; }
+
+        if (line == end) { return; }
+
+        first = 0;
+    }
+}
+
+/**
+ * Renders the page for a terminal `width` columns wide
+ *
+ * @param out   To store the rendered page
+ * @param page  The page to render
+ * @param width The number of columns
+ */
+void render_page(RenderBuffer* out, const Page* page, int width) {
+    size_t cursor = 0;
+    LineView line;
+
+    while (page_next_line(page, &cursor, &line)) {
+        int has_newline = line.len > 0 && line.start[line.len - 1] == '\n';
+
+        render_line(out, line.start, line.len - has_newline, width);
+
+        // The last line didn't end with a newline, so neither does the output
+        if (!has_newline) { out->len--; }
+    }
+}
+
+/////////////////////////        End Render Page       /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////          Page Cache          /////////////////////////
+
+typedef struct {
+    char name[MAX_STR_LENGTH];  /* The name of the cached page */
+    off_t size;                 /* The size of the cached page */
+    struct timespec used;       /* When the cached page was last served */
+} CacheEntry;
+
+/**
+ * Builds the filepath of the rendered page in the cache.
+ * The name is a hash of the page's path, inode, size, mtime and the width,
+ * so an edited page or a different width never finds a stale rendering.
+ *
+ * @param str      To store the filepath to the cached page
+ * @param filepath The filepath to the manual page
+ * @param st       The manual page's stat
+ * @param width    The width the page is rendered for
+ */
+void build_cache_filepath(char* str, const char* filepath, const struct stat* st,
+                          int width) {
+    uint64_t hash = FNV_OFFSET;
+    int64_t key[] = {
+        st->st_ino, st->st_size, st->st_mtim.tv_sec, st->st_mtim.tv_nsec, width
+    };
+
+    hash = hash_bytes(hash, filepath, strlen(filepath) + 1);
+    hash = hash_bytes(hash, key, sizeof(key));
+
+    IF_FORMAT_FAILED(sprintf(str, CACHE_FILEPATH, (unsigned long long) hash)) {
+        fprintf(stderr, ERROR_IN_FORMAT, "build_cache_filepath");
+        exit(WMAN_FAILURE);
+    }
+}
+
+/**
+ * Prints a rendered page from the cache, and marks it as recently used
+ *
+ * @param  cache_path The filepath to the cached page
+ * @return            0 if the page was printed, -1 if it isn't cached
+ */
+int serve_cached(const char* cache_path) {
+    int fd = open(cache_path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) { return -1; }
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // The mtime of a cached page is when it was last used
+    futimens(fd, NULL);
+
+    if (copy_to_stdout(fd, st.st_size) < 0) {
+        close(fd);
+        exit(WMAN_FAILURE);
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+/**
+ * Orders cache entries from least to most recently used, for qsort
+ */
+static int compare_cache_entries(const void* a, const void* b) {
+    const struct timespec* x = &((const CacheEntry*) a)->used;
+    const struct timespec* y = &((const CacheEntry*) b)->used;
+
+    if (x->tv_sec != y->tv_sec) { return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec); }
+
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/**
+ * Removes the least recently used pages from the cache while it is over
+ * CACHE_MAX_BYTES, down to 3/4 of it so not every new page evicts.
+ */
+void evict_cache() {
+    DIR* dir = opendir(CACHE_DIRPATH);
+
+    IS_NULL(dir) { return; }
+
+    CacheEntry* entries = NULL;
+    size_t n_entries = 0;
+    size_t capacity = 0;
+    off_t total = 0;
+
+    struct dirent* entry;
+
+    while (NULL != (entry = readdir(dir))) {
+        struct stat st;
+
+        // Temporary files and cwd and parent all have a '.' in them
+        if (NULL != strchr(entry->d_name, '.')) { continue; }
+
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) < 0) { continue; }
+
+        if (n_entries == capacity) {
+            capacity = capacity ? capacity * 2 : CACHE_ENTRIES_INITIAL_CAPACITY;
+            entries = realloc(entries, sizeof(CacheEntry) * capacity);
+
+            IS_NULL(entries) {
+                fprintf(stderr, ERROR_IN_MALLOC, "evict_cache");
+                exit(WMAN_FAILURE);
+            }
+        }
+
+        strncpy(entries[n_entries].name, entry->d_name, MAX_STR_LENGTH - 1);
+        entries[n_entries].name[MAX_STR_LENGTH - 1] = NULL_TERMINATOR;
+        entries[n_entries].size = st.st_size;
+        entries[n_entries].used = st.st_mtim;
+        total += st.st_size;
+        n_entries++;
+    }
+
+    if (total > CACHE_MAX_BYTES) {
+        qsort(entries, n_entries, sizeof(CacheEntry), compare_cache_entries);
+
+        for (size_t i = 0; i < n_entries && total > CACHE_MAX_BYTES / 4 * 3; i++) {
+            if (0 == unlinkat(dirfd(dir), entries[i].name, 0)) {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+    free(entries);
+    closedir(dir);
+}
+
+/**
+ * Stores a rendered page in the cache. The page is written to a temporary
+ * file and renamed into place, so a concurrent `wman` never serves half
+ * a page. Failing to cache a page is not an error.
+ *
+ * @param cache_path The filepath to the cached page
+ * @param rendered   The rendered page
+ */
+void store_cached(const char* cache_path, const RenderBuffer* rendered) {
+    if (rendered->len > CACHE_MAX_BYTES) { return; }
+
+    if (mkdir(CACHE_DIRPATH, CACHE_DIR_MODE) < 0 && errno != EEXIST) { return; }
+
+    char tmp_path[MAX_STR_LENGTH];
+
+    IF_FORMAT_FAILED(sprintf(tmp_path, CACHE_TMP_FILEPATH, cache_path, (int) getpid())) {
+        fprintf(stderr, ERROR_IN_FORMAT, "store_cached");
+        exit(WMAN_FAILURE);
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, CACHE_FILE_MODE);
+
+    if (fd < 0) { return; }
+
+    int failed = write_all(fd, rendered->data, rendered->len) < 0;
+
+    if (0 != close(fd) || failed || 0 != rename(tmp_path, cache_path)) {
+        unlink(tmp_path);
+        return;
+    }
+
+    evict_cache();
+}
+
+/**
+ * Prints the manual page, rendered for the width of the terminal
+ *
+ * Rendered pages are cached, so the next `wman` for the same page and
+ * width only has to `sendfile` the cached rendering. If there is no width
+ * to render for, like when stdout isn't a terminal, the page is printed
+ * as is.
+ *
+ * @param filepath The filepath to the manual page
+ */
+void serve_page(char* filepath) {
+    int width = terminal_width();
+
+    if (width <= 0) {
+        print_file(filepath);
+        return;
+    }
+
+    struct stat st;
+
+    if (stat(filepath, &st) < 0) {
+        fprintf(stderr, ERROR_IN_FOPEN, filepath);
+        exit(WMAN_FAILURE);
+    }
+
+    char cache_path[MAX_STR_LENGTH];
+    build_cache_filepath(cache_path, filepath, &st, width);
+
+    if (0 == serve_cached(cache_path)) { return; }
+
+    Page man;
+
+    if (page_open(&man, filepath) < 0) {
+        fprintf(stderr, ERROR_IN_FOPEN, filepath);
+        exit(WMAN_FAILURE);
+    }
+
+    RenderBuffer rendered = { .data = NULL, .len = 0, .capacity = 0 };
+    render_page(&rendered, &man, width);
+    page_close(&man);
+
+    store_cached(cache_path, &rendered);
+
+    if (write_all(STDOUT_FILENO, rendered.data, rendered.len) < 0) {
+        free(rendered.data);
+        exit(WMAN_FAILURE);
+    }
+
+    free(rendered.data);
+}
+
+/////////////////////////        End Page Cache        /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+/////////////////////////        Index Commands        /////////////////////////
+
+/**
+ * Prints the manual page from every section that has it, in order of
+ * section, like `man -a`
+ *
+ * @param  page The page to print
+ * @return      The number of sections the page was printed from
+ */
+int print_all_sections(char* page) {
+    char path[MAX_STR_LENGTH];
+    int sections = lookup_sections(page_index(), page);
+    int printed = 0;
+
+    for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+        if (!(sections & (1 << section))) { continue; }
+
+        IS_NOT_NULL(search_page_in_section(path, page, section)) {
+            serve_page(path);
+            printed++;
+        }
+    }
+
+    return printed;
+}
+
+/**
+ * Prints every page whose name contains `keyword`, with its section, in
+ * order of name, like `man -k` without the descriptions
+ *
+ * @param keyword The keyword to search page names for
+ */
+void keyword_search(const char* keyword) {
+    const PageIndex* index = page_index();
+    int found = 0;
+
+    for (uint32_t i = 0; i < index->header->n_names; i++) {
+        const IndexName* name = &index->names[i];
+
+        // A damaged index can't point outside of itself
+        if ((size_t) name->name_off + name->name_len >= index->header->names_size) {
+            continue;
+        }
+
+        const char* str = index->pool + name->name_off;
+
+        IS_NULL(strstr(str, keyword)) { continue; }
+
+        for (int section = MIN_SECTION; section <= MAX_SECTION; section++) {
+            if (name->sections & (1 << section)) {
+                _PRINTF_(KEYWORD_OUTPUT, str, section);
+                found = 1;
+            }
+        }
+    }
+
+    if (!found) { _PRINTF_(KEYWORD_NOT_FOUND); }
+}
+
+/////////////////////////      End Index Commands      /////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /////////////////////////             MAIN             /////////////////////////
 
 int main(int argc, char* argv[]) {
     // Define variables, initialize with invalid values to avoid flags
     // This allows a single check for input validity and result
-    FILE* handle = NULL;  // Explicit null to avoid compiler warnings
+    char* filepath = NULL;  // Explicit null to avoid compiler warnings
     char* page = NULL;  // Same as above.
+    char path[MAX_STR_LENGTH];  // Filepath to the manual entry
     int section = -1;
 
+    // Usage was: prompt> wman -k <keyword>
+    if (3 == argc && 0 == strcmp(argv[1], KEYWORD_FLAG)) {
+        keyword_search(argv[2]);
+        return WMAN_SUCCESS;
+    }
+
+    // Usage was: prompt> wman -a <page>
+    if (3 == argc && 0 == strcmp(argv[1], ALL_FLAG)) {
+        if (0 == print_all_sections(argv[2])) {
+            char msg[MAX_STR_LENGTH];
+
+            page_not_found_msg(msg, argv[2]);
+            _PRINTF_(msg);
+        }
+
+        return WMAN_SUCCESS;
+    }
+
     // Arg parse
     switch (argc - 1) {
         case 0:  // Usage was: prompt> wman
@@ -220,8 +1205,8 @@ int main(int argc, char* argv[]) {
             // No checks are performed to verify contents of `page`
             page = argv[1];
 
-            // Re-initialize local variable with a file handle
-            handle = search_all_pages(page);
+            // Re-initialize local variable with the filepath
+            filepath = search_all_pages(path, page);
 
             break;
 
@@ -253,8 +1238,8 @@ int main(int argc, char* argv[]) {
             // No checks are performed to verify contents of `page`
             page = argv[2];
 
-            // Re-initialize local variable with a file handle
-            handle = search_page_in_section(page, section);
+            // Re-initialize local variable with the filepath
+            filepath = search_page_in_section(path, page, section);
 
             break;
         default: // Usage was: prompt> wman <arg1> <arg2> <arg3> ... <argc>
@@ -267,7 +1252,7 @@ int main(int argc, char* argv[]) {
     }
 
     // Check for file returned by `case 1` or `case 2`, other cases return early
-    IS_NULL(handle) {
+    IS_NULL(filepath) {
         // If the local variable is still `NULL`, no file with the given
         // specifications were found
 
@@ -293,13 +1278,10 @@ int main(int argc, char* argv[]) {
     }
 
     // A manual entry was found
-    // The handle to the file is present in `handle`
-
-    // Print the file's contents.
-    print_file(handle);
+    // The filepath to the file is present in `filepath`
 
-    // Close the file handle
-    fclose(handle);
+    // Print the file's contents, rendered for the terminal
+    serve_page(filepath);
 
     return WMAN_SUCCESS;  // Program succeeded
 }
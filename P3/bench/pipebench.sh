@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# Measures the throughput of a multi-stage pipeline run by wsh, once for
+# each pipe capacity given to `set pipesize` (0 keeps the default 64KiB).
+#
+# Usage: bench/pipebench.sh [-m <MiB>] [-s <stages>] [-r <runs>] [sizes...]
+#
+#   -m  Amount of data pushed through the pipeline, 256MiB by default
+#   -s  Number of `cat` stages between the producer and `wc`, 4 by default
+#   -r  Runs per size, the best run is reported, 3 by default
+#
+# Run it from P3 after `make`, e.g. `bench/pipebench.sh 0 256K 1M`.
+
+set -e
+
+MIB=256
+STAGES=4
+RUNS=3
+
+while getopts "m:s:r:" opt; do
+    case $opt in
+        m) MIB=$OPTARG ;;
+        s) STAGES=$OPTARG ;;
+        r) RUNS=$OPTARG ;;
+        *) sed -n '7,12p' "$0"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+SIZES=("$@")
+[ ${#SIZES[@]} -eq 0 ] && SIZES=(0 256K 1M)
+
+WSH=${WSH:-./wsh}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+head -c "$((MIB << 20))" /dev/zero > "$TMP/data"
+
+PIPELINE="cat $TMP/data"
+for _ in $(seq "$STAGES"); do
+    PIPELINE="$PIPELINE | cat"
+done
+PIPELINE="$PIPELINE | wc -c"
+
+echo "$MIB MiB through $((STAGES + 2)) stages, best of $RUNS runs"
+printf "%10s %10s %10s\n" pipesize seconds MiB/s
+
+for size in "${SIZES[@]}"; do
+    printf "set pipesize %s\n%s\n" "$size" "$PIPELINE" > "$TMP/bench.wsh"
+
+    best=
+    for _ in $(seq "$RUNS"); do
+        start=$EPOCHREALTIME
+        "$WSH" "$TMP/bench.wsh" > "$TMP/out"
+        end=$EPOCHREALTIME
+
+        if [ "$(tr -d ' ' < "$TMP/out")" != "$((MIB << 20))" ]; then
+            echo "pipesize $size: unexpected output $(cat "$TMP/out")" >&2
+            exit 1
+        fi
+
+        best=$(awk -v s="$start" -v e="$end" -v b="$best" \
+            'BEGIN { t = e - s; print (b == "" || t < b) ? t : b }')
+    done
+
+    awk -v size="$size" -v t="$best" -v mib="$MIB" \
+        'BEGIN { printf "%10s %10.3f %10.1f\n", size, t, mib / t }'
+done
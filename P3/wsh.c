@@ -4,527 +4,3008 @@
  * @author Mrigank Kumar
  */
 
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
+#include <sched.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "wsh.h"
 
-static Job* all_jobs[128];
+static JobTable job_table;
 static Job* foreground_job;
+static Settings settings = { .memo_ttl = MEMO_DEFAULT_TTL };
+static FILE* profile_log;
+
+/////////////////////////////// ARENA FUNCTIONS ////////////////////////////////
+
+// Released arenas, reused by the next lines instead of allocating again
+static Arena* free_arenas;
+static int n_free_arenas;
+
+static ArenaBlock* arena_block_init(size_t size) {
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    _MALLOC_CHECK_(block)
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+Arena* arena_acquire() {
+    Arena* arena = free_arenas;
+
+    if (NULL != arena) {
+        free_arenas = arena->next_free;
+        n_free_arenas--;
+        return arena;
+    }
+
+    arena = malloc(sizeof(Arena));
+    _MALLOC_CHECK_(arena)
+
+    arena->head = arena->current = arena_block_init(ARENA_BLOCK_SIZE);
+    arena->next_free = NULL;
+
+    return arena;
+}
+
+void arena_release(Arena* arena) {
+    if (NULL == arena) return;
+
+    // O(1), the blocks after the first are marked empty when they are reached again
+    arena->current = arena->head;
+    arena->head->used = 0;
+
+    if (n_free_arenas < ARENA_POOL_MAX) {
+        arena->next_free = free_arenas;
+        free_arenas = arena;
+        n_free_arenas++;
+        return;
+    }
+
+    ArenaBlock* block = arena->head;
+
+    while (NULL != block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    ArenaBlock* block = arena->current;
+
+    while (block->used + size > block->size) {
+        // Reuse the next block if it is large enough, otherwise put a new one before it
+        if (NULL != block->next && block->next->size >= size) {
+            block = block->next;
+        } else {
+            ArenaBlock* fresh = arena_block_init(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+            fresh->next = block->next;
+            block->next = fresh;
+            block = fresh;
+        }
+
+        block->used = 0;
+    }
+
+    arena->current = block;
+
+    void* ptr = block->data + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+char* arena_strdup(Arena* arena, const char* str, size_t n) {
+    char* copy = arena_alloc(arena, n + 1);
+
+    memcpy(copy, str, n);
+    copy[n] = _NULL_TERMINATOR_;
+
+    return copy;
+}
+
+static void buffer_append(ByteBuffer* buf, const void* data, size_t n) {
+    if (n == 0) return;
+
+    if (buf->len + n > buf->capacity) {
+        while (buf->len + n > buf->capacity) {
+            buf->capacity = buf->capacity ? 2 * buf->capacity : ARENA_BLOCK_SIZE;
+        }
+
+        buf->data = realloc(buf->data, buf->capacity);
+        _MALLOC_CHECK_(buf->data)
+    }
+
+    memcpy(buf->data + buf->len, data, n);
+    buf->len += n;
+}
+
+///////////////////////////// END ARENA FUNCTIONS //////////////////////////////
+
+
+////////////////////////////// JOB TABLE FUNCTIONS /////////////////////////////
+
+static void free_ids_push(int id) {
+    int* heap = job_table.free_ids;
+    int i = job_table.n_free++;
+
+    // free_ids has room for every ID below next_id
+    while (i > 0 && heap[(i - 1) / 2] > id) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    heap[i] = id;
+}
+
+static int free_ids_pop() {
+    int* heap = job_table.free_ids;
+    int min = heap[0];
+    int last = heap[--job_table.n_free];
+    int i = 0;
+
+    while (2 * i + 1 < job_table.n_free) {
+        int child = 2 * i + 1;
+
+        if (child + 1 < job_table.n_free && heap[child + 1] < heap[child]) {
+            child++;
+        }
+
+        if (last <= heap[child]) break;
+
+        heap[i] = heap[child];
+        i = child;
+    }
+
+    heap[i] = last;
+
+    return min;
+}
+
+// Gives the job the smallest positive ID not in use
+int job_table_add(Job* job) {
+    int id;
+
+    if (job_table.n_free > 0) {
+        id = free_ids_pop();
+    } else {
+        if (job_table.next_id < JOB_START_IDX) {
+            job_table.next_id = JOB_START_IDX;
+        }
+
+        if (job_table.next_id >= job_table.capacity) {
+            job_table.capacity = job_table.capacity ? 2 * job_table.capacity
+                                                    : JOB_TABLE_INITIAL_CAPACITY;
+
+            job_table.jobs = realloc(job_table.jobs, sizeof(Job*) * job_table.capacity);
+            _MALLOC_CHECK_(job_table.jobs)
+
+            job_table.free_ids = realloc(job_table.free_ids, sizeof(int) * job_table.capacity);
+            _MALLOC_CHECK_(job_table.free_ids)
+        }
+
+        id = job_table.next_id++;
+    }
+
+    job_table.jobs[id] = job;
+    job->id = id;
+
+    return id;
+}
+
+// Adds the job to the job table, unless it is a built-in
+void job_register(Job* job) {
+    if (job->n_process == 1) {
+        char* p0_cmd = job->processes[0]->cmd->argv[0];
+
+        for (int i = 0; i < _N_BUILTINS_; i++) {
+            if (0 == strcmp(p0_cmd, _builtins_[i])) {
+                return;
+            }
+        }
+    }
+
+    job_table_add(job);
+}
+
+void job_table_remove(Job* job) {
+    if (job->id < JOB_START_IDX) return;
+
+    job_table.jobs[job->id] = NULL;
+    free_ids_push(job->id);
+    job->id = 0;
+}
+
+static inline size_t pid_slot(pid_t pid) {
+    return ((unsigned) pid * 2654435761u) & (job_table.pid_capacity - 1);
+}
+
+static void pid_map_grow() {
+    PidEntry* old = job_table.pids;
+    size_t old_capacity = job_table.pid_capacity;
+
+    job_table.pid_capacity = old_capacity ? 2 * old_capacity : PID_MAP_INITIAL_CAPACITY;
+    job_table.pids = calloc(job_table.pid_capacity, sizeof(PidEntry));
+    _MALLOC_CHECK_(job_table.pids)
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].pid == 0) continue;
+
+        size_t slot = pid_slot(old[i].pid);
+
+        while (job_table.pids[slot].pid != 0) {
+            slot = (slot + 1) & (job_table.pid_capacity - 1);
+        }
+
+        job_table.pids[slot] = old[i];
+    }
+
+    free(old);
+}
+
+// Tracks a spawned process of the job until it is reaped
+void pid_map_add(Job* job, int proc) {
+    // At most half full, so probes stay short
+    if (2 * (job_table.n_pids + 1) > job_table.pid_capacity) {
+        pid_map_grow();
+    }
+
+    pid_t pid = job->processes[proc]->pid;
+    size_t slot = pid_slot(pid);
+
+    while (job_table.pids[slot].pid != 0) {
+        slot = (slot + 1) & (job_table.pid_capacity - 1);
+    }
+
+    job_table.pids[slot] = (PidEntry) { .pid = pid, .job = job, .proc = proc };
+    job_table.n_pids++;
+    job->n_running++;
+}
+
+PidEntry* pid_map_find(pid_t pid) {
+    if (job_table.pid_capacity == 0 || pid <= 0) return NULL;
+
+    size_t slot = pid_slot(pid);
+
+    while (job_table.pids[slot].pid != 0) {
+        if (job_table.pids[slot].pid == pid) {
+            return &job_table.pids[slot];
+        }
+
+        slot = (slot + 1) & (job_table.pid_capacity - 1);
+    }
+
+    return NULL;
+}
+
+void pid_map_remove(pid_t pid) {
+    PidEntry* entry = pid_map_find(pid);
+
+    if (NULL == entry) return;
+
+    size_t mask = job_table.pid_capacity - 1;
+    size_t hole = entry - job_table.pids;
+    size_t next = hole;
+
+    // Shift back the entries that probed past the hole, no tombstones needed
+    while (true) {
+        next = (next + 1) & mask;
+
+        if (job_table.pids[next].pid == 0) break;
+
+        size_t home = pid_slot(job_table.pids[next].pid);
+        bool stays = hole <= next ? (hole < home && home <= next)
+                                  : (hole < home || home <= next);
+
+        if (stays) continue;
+
+        job_table.pids[hole] = job_table.pids[next];
+        hole = next;
+    }
+
+    job_table.pids[hole].pid = 0;
+    job_table.n_pids--;
+}
+
+//////////////////////////// END JOB TABLE FUNCTIONS ///////////////////////////
+
 
 /////////////////////////// INITIALIZATION FUNCTIONS ///////////////////////////
 
-Command* command_init(char* cmd) {
+// Splits `cmd` in place on the delimiter, argv points into `cmd`
+Command* command_init(Arena* arena, char* cmd) {
     if (!cmd)
         return NULL;
-    ssize_t n = strlen(cmd);
 
-    if (n <= 0)
+    char delimiter = _DELIMITER_[0];
+    int argc = 0;
+
+    for (char* c = cmd; *c; c++) {
+        if (*c != delimiter && (c == cmd || c[-1] == delimiter)) {
+            argc++;
+        }
+    }
+
+    if (argc == 0)
         return NULL;
 
-    Command* command = malloc(sizeof(Command));
-    _MALLOC_CHECK_(command)
+    Command* command = arena_alloc(arena, sizeof(Command));
+
+    command->argc = 0;
+    command->argv = arena_alloc(arena, sizeof(char*) * (argc + 1));
+
+    char* c = cmd;
+
+    while (*c) {
+        while (*c == delimiter) {
+            *c++ = _NULL_TERMINATOR_;
+        }
+
+        if (!*c) break;
+
+        command->argv[command->argc++] = c;
+
+        while (*c && *c != delimiter) {
+            c++;
+        }
+    }
+
+    command->argv[command->argc] = NULL;
+
+    return command;
+}
+
+Process* process_init(Arena* arena, Command* cmd) {
+    if (NULL == cmd) return NULL;
+
+    Process* proc = arena_alloc(arena, sizeof(Process));
+
+    proc->cmd = cmd;
+    proc->controls = NULL;
+    proc->pid = -1;
+    proc->state = SCHEDULED;
+
+    return proc;
+}
+
+Job* job_init(Arena* arena, char* cmd, Process** procs, int n_procs, bool bg) {
+    Job* job = arena_alloc(arena, sizeof(Job));
+
+    job->cmd = cmd;
+    job->processes = procs;
+    job->n_process = n_procs;
+    job->bg = bg;
+    job->p_state = FOREGROUND;
+    job->arena = arena;
+    job->id = 0;
+    job->n_running = 0;
+    job->scheduled = false;
+    job->profiled = false;
+    job->memo = NULL;
+
+    return job;
+}
+
+
+///////////////////////// END INITIALIZATION FUNCTIONS /////////////////////////
+
+
+///////////////////////////// DESTRUCTOR FUNCTIONS /////////////////////////////
+
+void job_destroy(Job* job) {
+    if (NULL == job) return;
+
+    job_table_remove(job);
+
+    if (job->p_state == BACKGROUND) {
+        job_table.n_background--;
+    }
+
+    // Children that were never reaped are not tracked anymore
+    for (int i = 0; job->n_running > 0 && i < job->n_process; i++) {
+        if (job->processes[i]->state != DONE) {
+            pid_map_remove(job->processes[i]->pid);
+        }
+    }
+
+    if (job == foreground_job) {
+        foreground_job = NULL;
+    }
+
+    memo_release(job->memo);
+
+    // Frees the job along with everything else parsed from its line
+    arena_release(job->arena);
+}
+
+/////////////////////////// END DESTRUCTOR FUNCTIONS ///////////////////////////
+
+
+/////////////////////////// SIGNAL HANDLER FUNCTIONS ///////////////////////////
+
+// Signals restored to their default action in every child
+static const int default_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD,
+};
+
+#define _N_DEFAULT_SIGNALS_ (sizeof(default_signals) / sizeof(default_signals[0]))
+
+static inline void reset_signal_handlers() {
+    for (size_t i = 0; i < _N_DEFAULT_SIGNALS_; i++) {
+        signal(default_signals[i], SIG_DFL);
+    }
+}
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Exit code of a wait status, like $? in sh
+static int exit_code(int status) {
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+// Prints how a scheduled job ended, the exit code is the last stage's
+static void report_job(Job* job) {
+    Process* last = job->processes[job->n_process - 1];
+
+    printf("%i: %s (exit %i, %.3fs)\n", job->id, job->cmd, exit_code(last->status),
+           seconds_since(&job->start));
+    fflush(stdout);
+}
+
+static void json_string(FILE* out, const char* str) {
+    fputc('"', out);
+
+    for (; *str; str++) {
+        unsigned char c = *str;
+
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+
+    fputc('"', out);
+}
+
+static inline double seconds(const struct timeval* tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+// Prints the resources used by every process of the job, as JSON lines with `set profile <file>`
+static void profile_job(Job* job) {
+    for (int i = 0; i < job->n_process; i++) {
+        Process* proc = job->processes[i];
+        struct rusage* ru = &proc->usage;
+
+        if (NULL == profile_log) {
+            fprintf(stderr, "%s (%i/%i): exit %i, real %.3fs, user %.3fs, sys %.3fs, "
+                    "maxrss %liKiB, vcsw %li, ivcsw %li\n", proc->cmd->argv[0], i + 1,
+                    job->n_process, exit_code(proc->status), proc->wall, seconds(&ru->ru_utime),
+                    seconds(&ru->ru_stime), ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+            continue;
+        }
+
+        fprintf(profile_log, "{\"job\":");
+        json_string(profile_log, job->cmd);
+        fprintf(profile_log, ",\"stage\":%i,\"stages\":%i,\"command\":", i, job->n_process);
+        json_string(profile_log, proc->cmd->argv[0]);
+
+        // In-process commands that ran in the shell have no pid
+        if (proc->pid > 0) {
+            fprintf(profile_log, ",\"pid\":%i", proc->pid);
+        } else {
+            fprintf(profile_log, ",\"pid\":null");
+        }
+
+        fprintf(profile_log, ",\"exit\":%i,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,"
+                "\"maxrss_kib\":%li,\"nvcsw\":%li,\"nivcsw\":%li}\n",
+                exit_code(proc->status), proc->wall, seconds(&ru->ru_utime),
+                seconds(&ru->ru_stime), ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+    }
+
+    fflush(NULL == profile_log ? stderr : profile_log);
+}
+
+// Reports a job whose processes are all done, and destroys it
+void finish_job(Job* job) {
+    if (job->scheduled) {
+        report_job(job);
+    }
+
+    if (job->profiled) {
+        profile_job(job);
+    }
+
+    job_destroy(job);
+}
+
+// Records that a child exited, finishing its job once it was in the background
+static void child_exited(pid_t pid, int status, const struct rusage* usage) {
+    PidEntry* entry = pid_map_find(pid);
+
+    if (NULL == entry) return;
+
+    Job* job = entry->job;
+    Process* proc = job->processes[entry->proc];
+
+    // Stopped or continued by a signal, it is still running
+    if (WIFSTOPPED(status) || WIFCONTINUED(status)) {
+        proc->state = WIFSTOPPED(status) ? PAUSED : RUNNING;
+        return;
+    }
+
+    pid_map_remove(pid);
+
+    proc->state = DONE;
+    proc->status = status;
+    proc->usage = *usage;
+    proc->wall = seconds_since(&proc->start);
+    job->n_running--;
+
+    // A foreground job is finished by the one waiting for it
+    if (job->n_running == 0 && job->bg) {
+        finish_job(job);
+    }
+}
+
+// Reaps every child that exited, without blocking
+void reap_children() {
+    pid_t cpid;
+    int status;
+    struct rusage usage;
+
+    while ((cpid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        child_exited(cpid, status, &usage);
+    }
+}
+
+/*
+ * Blocks SIGCHLD and returns a signalfd it is read from instead, so child
+ * exits are handled in the main loop rather than in a signal handler.
+ * Children get an empty signal mask when they are launched.
+ */
+int setup_child_signals() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) _FAILURE_EXIT_("sigprocmask failed!\n")
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    if (fd < 0) _FAILURE_EXIT_("signalfd failed!\n")
+
+    return fd;
+}
+
+void handle_child_signals(int fd) {
+    struct signalfd_siginfo info[16];
+
+    // Pending SIGCHLDs merge, so the reaping below doesn't rely on their number
+    while (read(fd, info, sizeof(info)) > 0);
+
+    reap_children();
+}
+
+// Blocks until some child exits, returns false if there are no children
+static bool reap_one() {
+    int status;
+    pid_t cpid;
+    struct rusage usage;
+
+    while ((cpid = wait4(-1, &status, WUNTRACED | WCONTINUED, &usage)) < 0) {
+        if (errno != EINTR) return false;
+    }
+
+    child_exited(cpid, status, &usage);
+
+    return true;
+}
+
+// Blocks until every process of the job is reaped, reaping other children on the way
+void wait_for_job(Job* job) {
+    while (job->n_running > 0 && reap_one());
+}
+
+// Blocks until fewer than `set maxjobs` background jobs are running
+void wait_for_slot() {
+    while (settings.max_jobs > 0 && job_table.n_background >= settings.max_jobs
+           && reap_one());
+}
+
+// void sigtstp_handler(int signal) {
+//     // printf("%i got a SIGTSTP\n", getpid());
+//     // printf("%s\n", foreground_job->cmd);
+//     if (NULL == foreground_job) {
+//         printf("foreground_job is NULL");
+//         return;
+//     }
+
+//     // printf("foreground job: %s", foreground_job->cmd);
+
+//     int n = foreground_job->n_process;
+
+//     for (int i = 0; i < n; i++) {
+//         if (foreground_job->processes[i]->state != RUNNING) {
+//             continue;
+//         }
+
+//         pid_t pid = foreground_job->processes[i]->pid;
+
+//         if (kill(pid, SIGTSTP) < 0) {
+//             _FAILURE_EXIT_("FATAL ERROR: Couldn't send SIGTSTP signal!\n");
+//         }
+
+//         foreground_job->processes[i]->state = PAUSED;
+//     }
+//     foreground_job = NULL;
+// }
+
+
+///////////////////////// END SIGNAL HANDLER FUNCTIONS /////////////////////////
+
+
+///////////////////////// COMMAND HASH TABLE FUNCTIONS /////////////////////////
+
+static PathCache path_cache;
+
+// A resolved path that is relative to the working directory, and is not kept
+static char* uncached_path;
+
+static unsigned long hash_name(const char* name) {
+    // FNV-1a
+    unsigned long hash = 14695981039346656037UL;
+
+    for (const char* c = name; *c; c++) {
+        hash = (hash ^ (unsigned char) *c) * 1099511628211UL;
+    }
+
+    return hash;
+}
+
+static uint64_t hash_bytes(const char* data, size_t n) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037UL;
+
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211UL;
+    }
+
+    return hash;
+}
+
+void path_cache_clear() {
+    for (size_t i = 0; i < path_cache.capacity; i++) {
+        PathEntry* entry = path_cache.buckets[i];
+
+        while (NULL != entry) {
+            PathEntry* next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+
+        path_cache.buckets[i] = NULL;
+    }
+
+    path_cache.n = 0;
+}
+
+// The search path, forgetting every command if PATH changed since they were hashed
+static const char* current_search_path() {
+    const char* path_env = getenv("PATH");
+
+    if (NULL == path_env) {
+        path_env = _DEFAULT_PATH_;
+    }
+
+    if (NULL == path_cache.path_env || 0 != strcmp(path_env, path_cache.path_env)) {
+        path_cache_clear();
+        free(path_cache.path_env);
+
+        path_cache.path_env = strdup(path_env);
+        _MALLOC_CHECK_(path_cache.path_env)
+    }
+
+    return path_cache.path_env;
+}
+
+// Finds an executable the way execvp does, an empty directory is the working directory
+static char* search_path(const char* name, const char* path_env) {
+    size_t name_len = strlen(name);
+    const char* dir = path_env;
+
+    while (true) {
+        const char* end = strchrnul(dir, _PATH_SEPARATOR_);
+        size_t dir_len = end - dir;
+
+        char* candidate = malloc(dir_len + name_len + 3);
+        _MALLOC_CHECK_(candidate)
+
+        if (dir_len == 0) {
+            sprintf(candidate, "./%s", name);
+        } else {
+            sprintf(candidate, "%.*s/%s", (int) dir_len, dir, name);
+        }
+
+        struct stat st;
+
+        if (0 == stat(candidate, &st) && S_ISREG(st.st_mode) && 0 == access(candidate, X_OK)) {
+            return candidate;
+        }
+
+        free(candidate);
+
+        if (_NULL_TERMINATOR_ == *end) {
+            return NULL;
+        }
+
+        dir = end + 1;
+    }
+}
+
+static void path_cache_grow() {
+    size_t capacity = path_cache.capacity ? 2 * path_cache.capacity : PATH_CACHE_INITIAL_CAPACITY;
+
+    PathEntry** buckets = calloc(capacity, sizeof(PathEntry*));
+    _MALLOC_CHECK_(buckets)
+
+    for (size_t i = 0; i < path_cache.capacity; i++) {
+        PathEntry* entry = path_cache.buckets[i];
+
+        while (NULL != entry) {
+            PathEntry* next = entry->next;
+            PathEntry** bucket = &buckets[entry->hash & (capacity - 1)];
+
+            entry->next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    free(path_cache.buckets);
+    path_cache.buckets = buckets;
+    path_cache.capacity = capacity;
+}
+
+/*
+ * Resolves a command name to its executable, walking PATH only the first
+ * time a name is seen. Names with a `/` are used as they are. `run` counts
+ * the lookup as a run of the command.
+ * Returns NULL if there is no such executable.
+ */
+const char* path_cache_lookup(const char* name, bool run) {
+    if (NULL != strchr(name, '/')) {
+        return name;
+    }
+
+    const char* path_env = current_search_path();
+    unsigned long hash = hash_name(name);
+
+    if (path_cache.capacity > 0) {
+        PathEntry* entry = path_cache.buckets[hash & (path_cache.capacity - 1)];
+
+        for (; NULL != entry; entry = entry->next) {
+            if (entry->hash == hash && 0 == strcmp(entry->name, name)) {
+                entry->hits += run;
+                return entry->path;
+            }
+        }
+    }
+
+    char* path = search_path(name, path_env);
+
+    if (NULL == path) {
+        return NULL;
+    }
+
+    // Relative directories in PATH depend on the working directory
+    if ('/' != path[0]) {
+        free(uncached_path);
+        uncached_path = path;
+        return path;
+    }
+
+    if (path_cache.n >= path_cache.capacity * PATH_CACHE_LOAD_FACTOR) {
+        path_cache_grow();
+    }
+
+    PathEntry* entry = malloc(sizeof(PathEntry));
+    _MALLOC_CHECK_(entry)
+
+    entry->name = strdup(name);
+    _MALLOC_CHECK_(entry->name)
+
+    entry->path = path;
+    entry->hash = hash;
+    entry->hits = run;
+
+    PathEntry** bucket = &path_cache.buckets[hash & (path_cache.capacity - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    path_cache.n++;
+
+    return path;
+}
+
+void path_cache_forget(const char* name) {
+    if (path_cache.capacity == 0) return;
+
+    unsigned long hash = hash_name(name);
+    PathEntry** link = &path_cache.buckets[hash & (path_cache.capacity - 1)];
+
+    for (; NULL != *link; link = &(*link)->next) {
+        PathEntry* entry = *link;
+
+        if (entry->hash == hash && 0 == strcmp(entry->name, name)) {
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            path_cache.n--;
+            return;
+        }
+    }
+}
+
+/////////////////////// END COMMAND HASH TABLE FUNCTIONS ///////////////////////
+
+
+//////////////////////////////// MEMO FUNCTIONS ////////////////////////////////
+
+static MemoCache memo_cache;
+
+// The arguments of every stage, the working directory and the variables of `set memoenv`
+static void memo_key(Job* job, ByteBuffer* key) {
+    for (int i = 0; i < job->n_process; i++) {
+        Command* cmd = job->processes[i]->cmd;
+
+        for (int j = 0; j < cmd->argc; j++) {
+            buffer_append(key, cmd->argv[j], strlen(cmd->argv[j]) + 1);
+        }
+
+        // Arguments are never empty, so an empty one ends the stage
+        buffer_append(key, "", 1);
+    }
+
+    char* cwd = getcwd(NULL, 0);
+
+    if (NULL != cwd) {
+        buffer_append(key, cwd, strlen(cwd) + 1);
+        free(cwd);
+    }
+
+    for (const char* name = settings.memo_env; NULL != name && *name;) {
+        const char* end = strchrnul(name, _MEMOENV_SEPARATOR_);
+        char* var = strndup(name, end - name);
+        _MALLOC_CHECK_(var)
+
+        const char* value = getenv(var);
+
+        // An unset variable differs from an empty one
+        buffer_append(key, NULL == value ? "" : "=", 1);
+        buffer_append(key, NULL == value ? "" : value, NULL == value ? 0 : strlen(value));
+        buffer_append(key, "", 1);
+
+        free(var);
+        name = *end ? end + 1 : end;
+    }
+}
+
+static size_t memo_entry_bytes(const MemoEntry* entry) {
+    return sizeof(MemoEntry) + entry->key_len + entry->output_len
+           + sizeof(int) * entry->n_statuses;
+}
+
+static void memo_entry_free(MemoEntry* entry) {
+    free(entry->key);
+    free(entry->output);
+    free(entry->statuses);
+    free(entry);
+}
+
+void memo_clear() {
+    for (size_t i = 0; i < memo_cache.capacity; i++) {
+        MemoEntry* entry = memo_cache.buckets[i];
+
+        while (NULL != entry) {
+            MemoEntry* next = entry->next;
+            memo_entry_free(entry);
+            entry = next;
+        }
+
+        memo_cache.buckets[i] = NULL;
+    }
+
+    memo_cache.n = 0;
+    memo_cache.bytes = 0;
+    memo_cache.newest = NULL;
+    memo_cache.oldest = NULL;
+}
+
+static void memo_cache_grow() {
+    size_t capacity = memo_cache.capacity ? 2 * memo_cache.capacity
+                                          : MEMO_CACHE_INITIAL_CAPACITY;
+
+    MemoEntry** buckets = calloc(capacity, sizeof(MemoEntry*));
+    _MALLOC_CHECK_(buckets)
+
+    for (size_t i = 0; i < memo_cache.capacity; i++) {
+        MemoEntry* entry = memo_cache.buckets[i];
+
+        while (NULL != entry) {
+            MemoEntry* next = entry->next;
+            size_t slot = entry->hash & (capacity - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+
+    free(memo_cache.buckets);
+    memo_cache.buckets = buckets;
+    memo_cache.capacity = capacity;
+}
+
+// Adds the entry as the most recently used one
+static void memo_cache_insert(MemoEntry* entry) {
+    if (memo_cache.n >= memo_cache.capacity) {
+        memo_cache_grow();
+    }
+
+    size_t slot = entry->hash & (memo_cache.capacity - 1);
+    entry->next = memo_cache.buckets[slot];
+    memo_cache.buckets[slot] = entry;
+
+    entry->newer = NULL;
+    entry->older = memo_cache.newest;
+
+    if (NULL != memo_cache.newest) {
+        memo_cache.newest->newer = entry;
+    } else {
+        memo_cache.oldest = entry;
+    }
+
+    memo_cache.newest = entry;
+    memo_cache.n++;
+    memo_cache.bytes += memo_entry_bytes(entry);
+}
+
+// Takes the entry out of its bucket and of the LRU list
+static void memo_cache_unlink(MemoEntry* entry) {
+    MemoEntry** link = &memo_cache.buckets[entry->hash & (memo_cache.capacity - 1)];
+
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+
+    *link = entry->next;
+
+    if (NULL != entry->newer) {
+        entry->newer->older = entry->older;
+    } else {
+        memo_cache.newest = entry->older;
+    }
+
+    if (NULL != entry->older) {
+        entry->older->newer = entry->newer;
+    } else {
+        memo_cache.oldest = entry->newer;
+    }
+
+    memo_cache.n--;
+    memo_cache.bytes -= memo_entry_bytes(entry);
+}
+
+// The entry with the key, NULL if there is none
+static MemoEntry* memo_cache_find(const MemoCapture* memo) {
+    if (memo_cache.capacity == 0) return NULL;
+
+    MemoEntry* entry = memo_cache.buckets[memo->hash & (memo_cache.capacity - 1)];
+
+    for (; NULL != entry; entry = entry->next) {
+        if (entry->hash == memo->hash && entry->key_len == memo->key_len &&
+            0 == memcmp(entry->key, memo->key, memo->key_len)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static bool expired(const struct timespec* expires) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec > expires->tv_sec ||
+           (now.tv_sec == expires->tv_sec && now.tv_nsec >= expires->tv_nsec);
+}
+
+/*
+ * Frees every expired entry, then the least recently used ones until the
+ * cache is within MEMO_MAX_ENTRIES and MEMO_MAX_BYTES.
+ */
+static void memo_evict() {
+    for (MemoEntry* entry = memo_cache.oldest; NULL != entry;) {
+        MemoEntry* newer = entry->newer;
+
+        if (expired(&entry->expires)) {
+            memo_cache_unlink(entry);
+            memo_entry_free(entry);
+        }
+
+        entry = newer;
+    }
+
+    while (NULL != memo_cache.oldest &&
+           (memo_cache.n > MEMO_MAX_ENTRIES || memo_cache.bytes > MEMO_MAX_BYTES)) {
+        MemoEntry* oldest = memo_cache.oldest;
+
+        memo_cache_unlink(oldest);
+        memo_entry_free(oldest);
+    }
+}
+
+/*
+ * Writes the output of the job from the last time it ran, if that is less
+ * than `set memottl` seconds ago, and marks its processes as done with the
+ * same statuses. Otherwise the job is set up to capture its output.
+ * Returns whether the output was replayed.
+ */
+bool memo_replay(Job* job) {
+    ByteBuffer key = {0};
+    memo_key(job, &key);
+
+    MemoCapture* memo = arena_alloc(job->arena, sizeof(MemoCapture));
+    memset(memo, 0, sizeof(MemoCapture));
+    memo->key = key.data;
+    memo->key_len = key.len;
+    memo->hash = hash_bytes(key.data, key.len);
+    memo->capture_fd = -1;
+
+    MemoEntry* entry = memo_cache_find(memo);
+
+    if (NULL != entry && (expired(&entry->expires) || entry->n_statuses != job->n_process)) {
+        memo_cache_unlink(entry);
+        memo_entry_free(entry);
+        entry = NULL;
+    }
+
+    if (NULL == entry) {
+        job->memo = memo;
+        return false;
+    }
+
+    if (entry->output_len > 0) {
+        fwrite(entry->output, 1, entry->output_len, stdout);
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < job->n_process; i++) {
+        Process* proc = job->processes[i];
+
+        memset(&proc->usage, 0, sizeof(struct rusage));
+        proc->wall = 0;
+        proc->pid = -1;
+        proc->state = DONE;
+        proc->status = entry->statuses[i];
+    }
+
+    // Now the most recently used entry
+    memo_cache_unlink(entry);
+    memo_cache_insert(entry);
+
+    free(key.data);
+
+    return true;
+}
+
+// Pipe the last stage writes to instead of stdout, returns its write end
+int memo_pipe(Job* job) {
+    int fds[2];
+
+    // Close-on-exec, so the children never hold the read end open
+    if (pipe2(fds, O_CLOEXEC) < 0) _FAILURE_EXIT_("pipe failed!\n")
+
+    job->memo->capture_fd = fds[0];
+
+    return fds[1];
+}
+
+// Copies the output of the job to stdout until every stage closed it, keeping it as well
+void memo_capture(Job* job) {
+    MemoCapture* memo = job->memo;
+    char chunk[ARENA_BLOCK_SIZE];
+    ssize_t n;
+
+    if (memo->capture_fd < 0) return;
+
+    fflush(stdout);
+
+    while ((n = read(memo->capture_fd, chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+
+            memo->overflow = true;
+            break;
+        }
+
+        for (ssize_t written = 0, w; written < n; written += w) {
+            if ((w = write(STDOUT_FILENO, chunk + written, n - written)) < 0) {
+                if (errno != EINTR) _FAILURE_EXIT_("write failed!\n")
+                w = 0;
+            }
+        }
+
+        if (!memo->overflow && memo->output.len + n > MEMO_MAX_OUTPUT) {
+            memo->overflow = true;
+            free(memo->output.data);
+            memset(&memo->output, 0, sizeof(ByteBuffer));
+        }
+
+        if (!memo->overflow) {
+            buffer_append(&memo->output, chunk, n);
+        }
+    }
+
+    close(memo->capture_fd);
+    memo->capture_fd = -1;
+}
+
+// Keeps the output of a finished job, unless a stage was killed by a signal
+void memo_store(Job* job) {
+    MemoCapture* memo = job->memo;
+
+    if (memo->overflow || settings.memo_ttl <= 0) return;
+
+    for (int i = 0; i < job->n_process; i++) {
+        if (job->processes[i]->state != DONE || !WIFEXITED(job->processes[i]->status)) {
+            return;
+        }
+    }
+
+    MemoEntry* entry = malloc(sizeof(MemoEntry));
+    _MALLOC_CHECK_(entry)
+
+    entry->statuses = malloc(sizeof(int) * job->n_process);
+    _MALLOC_CHECK_(entry->statuses)
+
+    for (int i = 0; i < job->n_process; i++) {
+        entry->statuses[i] = job->processes[i]->status;
+    }
+
+    // The entry takes the key and the output
+    entry->n_statuses = job->n_process;
+    entry->key = memo->key;
+    entry->key_len = memo->key_len;
+    entry->hash = memo->hash;
+    entry->output = memo->output.data;
+    entry->output_len = memo->output.len;
+    memo->key = NULL;
+    memo->output.data = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &entry->expires);
+    entry->expires.tv_sec += settings.memo_ttl;
+
+    memo_cache_insert(entry);
+    memo_evict();
+}
+
+void memo_release(MemoCapture* memo) {
+    if (NULL == memo) return;
+
+    if (memo->capture_fd >= 0) {
+        close(memo->capture_fd);
+    }
+
+    free(memo->key);
+    free(memo->output.data);
+}
+
+////////////////////////////// END MEMO FUNCTIONS //////////////////////////////
+
+
+/////////////////////////// PROCESS LAUNCH FUNCTIONS ///////////////////////////
+
+// posix_spawn attributes doing what `reset_signal_handlers` does after a fork
+static posix_spawnattr_t* spawn_attributes() {
+    static posix_spawnattr_t attr;
+    static bool initialized = false;
+
+    if (initialized) return &attr;
+
+    sigset_t defaults, mask;
+    sigemptyset(&defaults);
+    sigemptyset(&mask);
+
+    for (size_t i = 0; i < _N_DEFAULT_SIGNALS_; i++) {
+        sigaddset(&defaults, default_signals[i]);
+    }
+
+    if (posix_spawnattr_init(&attr)
+        || posix_spawnattr_setsigdefault(&attr, &defaults)
+        || posix_spawnattr_setsigmask(&attr, &mask)
+        || posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK)) {
+        _FAILURE_EXIT_("posix_spawnattr failed!\n")
+    }
+
+    initialized = true;
+
+    return &attr;
+}
+
+// Marks a process that could not be run as done, errno says why
+static pid_t launch_failed(Process* proc) {
+    // Same message the child used to print when execvp failed
+    perror("execvp failed!\n");
+
+    // As if the child had exited after execvp failed
+    proc->pid = -1;
+    proc->state = DONE;
+    proc->status = W_EXITCODE(_EXIT_FAILURE_, 0);
+    return -1;
+}
+
+// Arguments running `path` with /bin/sh, `sh_argv` has room for one more than argv
+static void shell_argv(const char* path, char** argv, char** sh_argv) {
+    int i = 1;
+
+    sh_argv[0] = _SHELL_PATH_;
+    sh_argv[1] = (char*) path;
+
+    for (; NULL != argv[i]; i++) {
+        sh_argv[i + 1] = argv[i];
+    }
+
+    sh_argv[i + 1] = NULL;
+}
+
+/*
+ * Launches a process without copying the shell's page tables (glibc's
+ * posix_spawn uses CLONE_VFORK), running the executable the command hash
+ * table resolved. `in_fd` and `out_fd` become the child's
+ * stdin and stdout unless they are -1, the pipes are created close-on-exec
+ * so the child needs no other file actions.
+ * Returns the child's pid, or -1 if the command could not be run.
+ */
+pid_t spawn_process(Process* proc, int in_fd, int out_fd, bool close_stdin) {
+    posix_spawn_file_actions_t actions;
+
+    if (posix_spawn_file_actions_init(&actions)) {
+        _FAILURE_EXIT_("posix_spawn_file_actions_init failed!\n")
+    }
+
+    int err = 0;
+
+    if (close_stdin) {
+        err = posix_spawn_file_actions_addclose(&actions, STDIN_FILENO);
+    }
+
+    if (!err && in_fd >= 0) {
+        err = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+
+    if (!err && out_fd >= 0) {
+        err = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+
+    if (err) {
+        errno = err;
+        _FAILURE_EXIT_("posix_spawn_file_actions failed!\n")
+    }
+
+    pid_t cpid;
+    char** argv = proc->cmd->argv;
+    const char* path = path_cache_lookup(argv[0], true);
+
+    err = NULL == path ? ENOENT : posix_spawn(&cpid, path, &actions, spawn_attributes(),
+                                              argv, environ);
+
+    // The executable was moved or removed since it was hashed
+    if (ENOENT == err && NULL != path && path != argv[0]) {
+        path_cache_forget(argv[0]);
+        path = path_cache_lookup(argv[0], true);
+
+        err = NULL == path ? ENOENT : posix_spawn(&cpid, path, &actions, spawn_attributes(),
+                                                  argv, environ);
+    }
+
+    // An executable without a #! line is a shell script, as for execvp
+    if (ENOEXEC == err) {
+        char* sh_argv[proc->cmd->argc + 2];
+        shell_argv(path, argv, sh_argv);
+
+        err = posix_spawn(&cpid, _SHELL_PATH_, &actions, spawn_attributes(), sh_argv, environ);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err) {
+        errno = err;
+        return launch_failed(proc);
+    }
+
+    proc->pid = cpid;
+    proc->state = RUNNING;
+
+    return cpid;
+}
+
+// The in-process implementation of a command, NULL if it has to be spawned
+static InprocFunction find_inproc(Command* cmd) {
+    for (int i = 0; i < _N_INPROCS_; i++) {
+        if (0 == strcmp(cmd->argv[0], _inprocs_[i].name)) {
+            if (NULL != _inprocs_[i].handles && !_inprocs_[i].handles(cmd)) {
+                return NULL;
+            }
+
+            return _inprocs_[i].run;
+        }
+    }
+
+    return NULL;
+}
+
+// Runs an in-process command in the shell itself, writing to the shell's stdout
+static void run_inproc(Process* proc, InprocFunction run) {
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+
+    int code = run(proc->cmd);
+
+    fflush(stdout);
+
+    proc->pid = -1;
+    proc->state = DONE;
+    proc->status = W_EXITCODE(code & 0xff, 0);
+    proc->wall = seconds_since(&proc->start);
+
+    // What the shell used meanwhile, except maxrss which is the shell's
+    getrusage(RUSAGE_SELF, &proc->usage);
+    timersub(&proc->usage.ru_utime, &before.ru_utime, &proc->usage.ru_utime);
+    timersub(&proc->usage.ru_stime, &before.ru_stime, &proc->usage.ru_stime);
+    proc->usage.ru_nvcsw -= before.ru_nvcsw;
+    proc->usage.ru_nivcsw -= before.ru_nivcsw;
+}
+
+// Numbers and ranges separated by commas, like 0,2-5
+static bool parse_cpus(const char* str, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+
+    while (true) {
+        char* end;
+        long first, last;
+
+        if (!isdigit((unsigned char) *str)) return false;
+        first = last = strtol(str, &end, 10);
+
+        if (*end == '-') {
+            str = end + 1;
+
+            if (!isdigit((unsigned char) *str)) return false;
+            last = strtol(str, &end, 10);
+        }
+
+        if (last < first || last >= CPU_SETSIZE) return false;
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+
+        if (*end == _NULL_TERMINATOR_) return true;
+        if (*end != ',') return false;
+
+        str = end + 1;
+    }
+}
+
+// idle, be[:level] or rt[:level], like the classes of ionice
+static bool parse_io_priority(const char* str, int* priority) {
+    const char* colon = strchr(str, ':');
+    size_t len = NULL == colon ? strlen(str) : (size_t) (colon - str);
+    int class, level = IOPRIO_DEFAULT_LEVEL;
+
+    if (len == strlen(_IOPRIO_IDLE_) && 0 == strncmp(str, _IOPRIO_IDLE_, len)) {
+        class = IOPRIO_CLASS_IDLE;
+        level = 0;
+    } else if (len == strlen(_IOPRIO_BE_) && 0 == strncmp(str, _IOPRIO_BE_, len)) {
+        class = IOPRIO_CLASS_BE;
+    } else if (len == strlen(_IOPRIO_RT_) && 0 == strncmp(str, _IOPRIO_RT_, len)) {
+        class = IOPRIO_CLASS_RT;
+    } else {
+        return false;
+    }
+
+    if (NULL != colon) {
+        // The idle class has no levels
+        if (class == IOPRIO_CLASS_IDLE || !isdigit((unsigned char) colon[1])
+            || colon[2] != _NULL_TERMINATOR_ || colon[1] - '0' >= IOPRIO_LEVELS) {
+            return false;
+        }
+
+        level = colon[1] - '0';
+    }
+
+    *priority = class << IOPRIO_CLASS_SHIFT | level;
+
+    return true;
+}
+
+/*
+ * The increment of `nice <n>` has no sign, since nice(1) reads `nice -5` as
+ * an increment of 5, which then runs nice(1) itself. `nice -n <n>` takes a
+ * signed one, like nice(1).
+ */
+static bool parse_nice(const char* str, bool sign, int* nice) {
+    char* end;
+
+    if (!sign && !isdigit((unsigned char) *str)) return false;
+
+    long value = strtol(str, &end, 10);
+
+    if (end == str || *end || value < -NICE_RANGE || value > NICE_RANGE) return false;
+
+    *nice = value;
+
+    return true;
+}
+
+/*
+ * Removes the pin, nice and ioprio prefixes in front of the command, and
+ * keeps their values in the process. A prefix whose value doesn't parse,
+ * or that isn't followed by a command, is left as the command to run.
+ */
+static void strip_controls(Arena* arena, Process* proc) {
+    Command* cmd = proc->cmd;
+    Controls parsed;
+
+    memset(&parsed, 0, sizeof(Controls));
+
+    while (cmd->argc > 2) {
+        const char* prefix = cmd->argv[0];
+        const char* value = cmd->argv[1];
+
+        if (0 == strcmp(prefix, _PIN_PREFIX_) && parse_cpus(value, &parsed.cpus)) {
+            parsed.pinned = true;
+        } else if (0 == strcmp(prefix, _NICE_PREFIX_) && parse_nice(value, false, &parsed.nice)) {
+            parsed.niced = true;
+        } else if (0 == strcmp(prefix, _NICE_PREFIX_) && 0 == strcmp(value, _NICE_FLAG_)
+                   && cmd->argc > 3 && parse_nice(cmd->argv[2], true, &parsed.nice)) {
+            parsed.niced = true;
+
+            // The flag is one more argument
+            cmd->argv++;
+            cmd->argc--;
+        } else if (0 == strcmp(prefix, _IOPRIO_PREFIX_) &&
+                   parse_io_priority(value, &parsed.io_priority)) {
+            parsed.io_prioritized = true;
+        } else {
+            break;
+        }
+
+        cmd->argv += 2;
+        cmd->argc -= 2;
+    }
+
+    if (parsed.pinned || parsed.niced || parsed.io_prioritized) {
+        proc->controls = arena_alloc(arena, sizeof(Controls));
+        *proc->controls = parsed;
+    }
+}
+
+/*
+ * Parses the scheduling prefixes of every stage. The ones in front of the
+ * first stage apply to the stages without their own.
+ */
+void parse_controls(Job* job) {
+    for (int i = 0; i < job->n_process; i++) {
+        strip_controls(job->arena, job->processes[i]);
+    }
+
+    Controls* first = job->processes[0]->controls;
+
+    if (NULL == first) return;
+
+    for (int i = 1; i < job->n_process; i++) {
+        Controls* controls = job->processes[i]->controls;
+
+        if (NULL == controls) {
+            job->processes[i]->controls = first;
+            continue;
+        }
+
+        if (!controls->pinned && first->pinned) {
+            controls->pinned = true;
+            controls->cpus = first->cpus;
+        }
+
+        if (!controls->niced && first->niced) {
+            controls->niced = true;
+            controls->nice = first->nice;
+        }
+
+        if (!controls->io_prioritized && first->io_prioritized) {
+            controls->io_prioritized = true;
+            controls->io_priority = first->io_priority;
+        }
+    }
+}
+
+// Applies the scheduling of a process to the calling process, false on failure
+static bool apply_controls(const Controls* controls) {
+    if (controls->pinned && sched_setaffinity(0, sizeof(cpu_set_t), &controls->cpus) < 0) {
+        perror("sched_setaffinity failed!\n");
+        return false;
+    }
+
+    if (controls->niced) {
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, 0);
+
+        if ((nice < 0 && errno) || setpriority(PRIO_PROCESS, 0, nice + controls->nice) < 0) {
+            perror("setpriority failed!\n");
+            return false;
+        }
+    }
+
+    if (controls->io_prioritized &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, controls->io_priority) < 0) {
+        perror("ioprio_set failed!\n");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Runs a stage in a forked child: an in-process command for a background
+ * job or a stage writing into a pipe, or any command with scheduling
+ * controls, which are applied in the child before it runs `run` or execs
+ * the executable. `other_fd` is a pipe end the child must not hold, since
+ * nothing is closed on exec for an in-process command.
+ */
+pid_t fork_process(Process* proc, InprocFunction run, int in_fd, int out_fd, int other_fd,
+                   bool close_stdin) {
+    char** argv = proc->cmd->argv;
+    const char* path = NULL;
+
+    // Resolved in the shell, so that the command hash table keeps it
+    if (NULL == run) {
+        path = path_cache_lookup(argv[0], true);
+
+        // The executable was moved or removed since it was hashed
+        if (NULL != path && path != argv[0] && access(path, X_OK) < 0) {
+            path_cache_forget(argv[0]);
+            path = path_cache_lookup(argv[0], true);
+        }
+
+        if (NULL == path) {
+            errno = ENOENT;
+            return launch_failed(proc);
+        }
+    }
+
+    // Anything still buffered would be written by both processes
+    fflush(stdout);
+
+    pid_t cpid = fork();
+
+    if (cpid < 0) _FAILURE_EXIT_("fork failed!\n")
+
+    if (0 == cpid) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+
+        reset_signal_handlers();
+
+        if (close_stdin) {
+            close(STDIN_FILENO);
+        }
+
+        if (in_fd >= 0) {
+            dup2(in_fd, STDIN_FILENO);
+            close(in_fd);
+        }
+
+        if (out_fd >= 0) {
+            dup2(out_fd, STDOUT_FILENO);
+            close(out_fd);
+        }
+
+        if (other_fd >= 0) {
+            close(other_fd);
+        }
+
+        if (NULL != proc->controls && !apply_controls(proc->controls)) {
+            _exit(_EXIT_FAILURE_);
+        }
+
+        if (NULL == run) {
+            execv(path, argv);
+
+            // An executable without a #! line is a shell script, as for execvp
+            if (ENOEXEC == errno) {
+                char* sh_argv[proc->cmd->argc + 2];
+                shell_argv(path, argv, sh_argv);
+                execv(_SHELL_PATH_, sh_argv);
+            }
+
+            perror("execvp failed!\n");
+            _exit(_EXIT_FAILURE_);
+        }
+
+        int code = run(proc->cmd);
+
+        fflush(stdout);
+
+        // Not exit, which would run the shell's exit handlers and flush its streams again
+        _exit(code);
+    }
+
+    proc->pid = cpid;
+    proc->state = RUNNING;
+
+    return cpid;
+}
+
+/*
+ * Launches stage `i` of the job. An in-process command runs in the shell
+ * when it is in the foreground and writes to the shell's stdout, and in a
+ * forked child otherwise. A stage with scheduling controls always runs in
+ * a forked child.
+ * Returns the child's pid, 0 if the command ran in the shell, or -1 if the
+ * command could not be run.
+ */
+pid_t launch_stage(Job* job, int i, int in_fd, int out_fd, int other_fd) {
+    Process* proc = job->processes[i];
+    InprocFunction run = find_inproc(proc->cmd);
+    bool close_stdin = job->bg && job->n_process == 1;
+
+    // Stays zero for a command that could not be run
+    memset(&proc->usage, 0, sizeof(struct rusage));
+    proc->wall = 0;
+    clock_gettime(CLOCK_MONOTONIC, &proc->start);
+
+    // posix_spawn can't set the scheduling of the child before it execs
+    if (NULL != proc->controls) {
+        return fork_process(proc, run, in_fd, out_fd, other_fd, close_stdin);
+    }
+
+    if (NULL == run) {
+        return spawn_process(proc, in_fd, out_fd, close_stdin);
+    }
+
+    if (job->bg || out_fd >= 0) {
+        return fork_process(proc, run, in_fd, out_fd, other_fd, close_stdin);
+    }
+
+    run_inproc(proc, run);
+
+    return 0;
+}
+
+///////////////////////// END PROCESS LAUNCH FUNCTIONS /////////////////////////
+
+
+///////////////////////////// MAIN LOOP FUNCTIONS //////////////////////////////
+
+void display_prompt() {
+    printf(_PROMPT_);
+    fflush(stdout);
+}
+
+// Reads what is available on stdin into the buffer, returns 0 at EOF
+ssize_t read_input(InputBuffer* input) {
+    if (input->len + INPUT_READ_SIZE + 1 > input->capacity) {
+        input->capacity = 2 * input->capacity + INPUT_READ_SIZE + 1;
+        input->data = realloc(input->data, input->capacity);
+        _MALLOC_CHECK_(input->data)
+    }
+
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, input->data + input->len, INPUT_READ_SIZE)) < 0) {
+        if (errno != EINTR) _FAILURE_EXIT_("read failed to read input!\n")
+    }
+
+    input->len += n;
+
+    return n;
+}
+
+// The job is not in the job table until it is registered
+Job* parse_command(char* input) {
+    bool bg = false;
+    ssize_t len = strlen(input);
+
+    if (len <= 0) {
+        return NULL;
+    }
+
+    // One copy of the line to tokenize in place, and one to show in `jobs`
+    Arena* arena = arena_acquire();
+    char* cmd_cpy = arena_strdup(arena, input, len);
+    char* line = arena_strdup(arena, input, len);
+
+    if (line[len - 1] == _AMPERSAND_) {
+        bg = true;
+        line[len - 1] = _NULL_TERMINATOR_;
+    }
+
+    int max_procs = 1;
+
+    for (char* c = line; *c; c++) {
+        if (*c == _PIPE_[0]) max_procs++;
+    }
+
+    Process** procs = arena_alloc(arena, sizeof(Process*) * max_procs);
+    int n_procs = 0;
+    char* stage = line;
+
+    // Stages without any arguments are skipped
+    while (NULL != stage) {
+        char* pipe = strchr(stage, _PIPE_[0]);
+
+        if (NULL != pipe) {
+            *pipe = _NULL_TERMINATOR_;
+        }
+
+        Process* proc = process_init(arena, command_init(arena, stage));
+
+        if (NULL != proc) {
+            procs[n_procs++] = proc;
+        }
+
+        stage = NULL == pipe ? NULL : pipe + 1;
+    }
+
+    if (n_procs == 0) {
+        arena_release(arena);
+        return NULL;
+    }
+
+    Job* job = job_init(arena, cmd_cpy, procs, n_procs, bg);
+
+    if (NULL == job) _FAILURE_EXIT_("Job init failed!\n")
+
+    return job;
+}
+
+// Waits for a foreground job, copying its output first when it is memoized
+static void finish_foreground_job(Job* job) {
+    if (NULL != job->memo) {
+        memo_capture(job);
+    }
+
+    wait_for_job(job);
+
+    if (NULL != job->memo) {
+        memo_store(job);
+    }
+
+    finish_job(job);
+}
+
+void dispatch_job(Job* job) {
+    int out_fd = NULL != job->memo ? memo_pipe(job) : -1;
+    int capture_fd = NULL != job->memo ? job->memo->capture_fd : -1;
+
+    pid_t cpid = launch_stage(job, 0, -1, out_fd, capture_fd);
+
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+
+    job->pgid = cpid;
+
+    if (cpid < 0) {
+        finish_job(job);
+        return;
+    }
+
+    if (cpid > 0) {
+        pid_map_add(job, 0);
+    }
+
+    if (job->bg == false) {
+        foreground_job = job;
+        finish_foreground_job(job);
+    } else {
+        job->p_state = BACKGROUND;
+        job_table.n_background++;
+    }
+}
+
+void dispatch_piped_jobs(Job* job) {
+    pid_t first = -1;
+    int in_fd = -1;
+
+    for (int i = 0; i < job->n_process; i++) {
+        int pipe_fds[2] = { -1, -1 };
+
+        if (i == job->n_process - 1 && NULL != job->memo) {
+            pipe_fds[1] = memo_pipe(job);
+            pipe_fds[0] = job->memo->capture_fd;
+        } else if (i < job->n_process - 1) {
+            // Close-on-exec, so the other stages never hold this pipe open
+            if (pipe2(pipe_fds, O_CLOEXEC) < 0) _FAILURE_EXIT_("pipe failed!\n")
+
+            // Larger pipes mean fewer switches between the stages. `set` checked
+            // the size, so this only fails past the per-user limit on pipe buffers,
+            // and the pipe keeps the default size then
+            if (settings.pipe_size > 0) {
+                fcntl(pipe_fds[1], F_SETPIPE_SZ, settings.pipe_size);
+            }
+        }
+
+        pid_t cpid = launch_stage(job, i, in_fd, pipe_fds[1], pipe_fds[0]);
+
+        if (cpid > 0) {
+            pid_map_add(job, i);
+        }
+
+        if (first < 0) {
+            first = cpid;
+        }
+
+        // The child has its own copies of the ends it uses
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+        if (pipe_fds[1] >= 0) {
+            close(pipe_fds[1]);
+        }
+
+        in_fd = i < job->n_process - 1 ? pipe_fds[0] : -1;
+    }
+
+    job->pgid = first;
+
+    if (job->bg == false) {
+        foreground_job = job;
+        finish_foreground_job(job);
+    } else if (job->n_running == 0) {
+        finish_job(job);
+    } else {
+        job->p_state = BACKGROUND;
+        job_table.n_background++;
+    }
+}
+
+/////////////////////////// END MAIN LOOP FUNCTIONS ////////////////////////////
+
+
+///////////////////////// BUILT-IN COMMANDS FUNCTIONS //////////////////////////
+
+int check_builtin(Job* job) {
+    if (job->n_process != 1) {
+        return 0;
+    }
+
+    char* command = job->processes[0]->cmd->argv[0];
+
+    if (strcmp(command, _BUILTINS_BG_) == 0) {
+        builtins_bg(job->processes[0]->cmd);
+    }
+    else if (strcmp(command, _BUILTINS_CD_) == 0) {
+        builtins_cd(job->processes[0]->cmd);
+    }
+    else if (strcmp(command, _BUILTINS_EXIT_) == 0) {
+        builtins_exit(job->processes[0]->cmd);
+    }
+    else if (strcmp(command, _BUILTINS_FG_) == 0) {
+        builtins_fg(job->processes[0]->cmd);
+    }
+    else if (strcmp(command, _BUILTINS_HASH_) == 0) {
+        builtins_hash(job->processes[0]->cmd);
+    }
+    else if (strcmp(command, _BUILTINS_JOBS_) == 0) {
+        builtins_jobs(job->processes[0]->cmd);
+    }
+    else if (strcmp(command, _BUILTINS_SET_) == 0) {
+        builtins_set(job->processes[0]->cmd);
+    }
+    else if (strcmp(command, _BUILTINS_WAIT_) == 0) {
+        builtins_wait(job->processes[0]->cmd);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+void builtins_bg(Command* cmd) {
+    printf("builtins_bg has not been implemented yet!\n");
+    exit(0);
+}
+void builtins_cd(Command* cmd) {
+    if (cmd->argc != 2) {
+        printf("`cd` takes exactly 1 argument, the path to a directory to switch to\n");
+        return;
+    }
+
+    if(chdir(cmd->argv[1]) < 0) {
+        printf("cd failed!");
+    }
+}
+
+void builtins_exit(Command* cmd) {
+    if (cmd->argc != 1) {
+        printf("`exit` does not accept any arguments\n");
+        return;
+    }
+    exit(_EXIT_SUCCESS_);
+}
+
+void builtins_fg(Command* cmd) {
+    printf("builtins_fg has not been implemented yet!\n");
+    exit(0);
+}
+
+void builtins_hash(Command* cmd) {
+    if (cmd->argc == 2 && 0 == strcmp(cmd->argv[1], _HASH_RESET_FLAG_)) {
+        path_cache_clear();
+        return;
+    }
+
+    // Hash the given commands without running them
+    if (cmd->argc > 1) {
+        for (int i = 1; i < cmd->argc; i++) {
+            if (NULL == path_cache_lookup(cmd->argv[i], false)) {
+                printf("hash: %s: not found\n", cmd->argv[i]);
+            }
+        }
+        return;
+    }
+
+    current_search_path();
+
+    if (path_cache.n == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+
+    for (size_t i = 0; i < path_cache.capacity; i++) {
+        for (PathEntry* entry = path_cache.buckets[i]; NULL != entry; entry = entry->next) {
+            printf("%4u\t%s\n", entry->hits, entry->path);
+        }
+    }
+}
+
+void builtins_jobs(Command* cmd) {
+    // Finished jobs are not listed
+    reap_children();
+
+    Job* job;
+    for (int i = JOB_START_IDX; i < job_table.next_id; i++) {
+        if (NULL == (job = job_table.jobs[i])) {
+            continue;
+        }
+
+        printf("%i: %s\n", i, job->cmd);
+    }
+}
+
+// Parses a size in bytes with an optional K, M or G suffix, -1 if it is invalid
+static long parse_size(const char* str) {
+    char* end;
+    errno = 0;
+    long size = strtol(str, &end, 10);
+
+    if (errno || end == str || size < 0) return -1;
+
+    switch (*end) {
+        case 'G': case 'g': size <<= 10; // fall through
+        case 'M': case 'm': size <<= 10; // fall through
+        case 'K': case 'k': size <<= 10; end++; break;
+        default: break;
+    }
+
+    return *end || size > INT_MAX ? -1 : size;
+}
+
+static void set_pipe_size(const char* value) {
+    long size = parse_size(value);
+
+    if (size < 0) {
+        printf("set: %s: invalid size %s\n", _SET_PIPESIZE_, value);
+        return;
+    }
+
+    if (size == 0) {
+        settings.pipe_size = 0;
+        return;
+    }
+
+    // Try the size on a pipe, the kernel rounds it up to a power of 2 pages
+    int fds[2];
+
+    if (pipe(fds) < 0) _FAILURE_EXIT_("pipe failed!\n")
+
+    int actual = fcntl(fds[1], F_SETPIPE_SZ, (int) size);
+
+    if (actual < 0) {
+        printf("set: %s: %s\n", _SET_PIPESIZE_, strerror(errno));
+    } else {
+        settings.pipe_size = actual;
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void set_max_jobs(const char* value) {
+    char* end;
+    long max_jobs = strtol(value, &end, 10);
+
+    if (end == value || *end || max_jobs < 0 || max_jobs > INT_MAX) {
+        printf("set: %s: invalid number of jobs %s\n", _SET_MAXJOBS_, value);
+        return;
+    }
+
+    settings.max_jobs = max_jobs;
+}
+
+// `on` profiles every job to stderr, a path appends them to that file instead
+static void set_profile(const char* value) {
+    FILE* log = NULL;
+
+    if (0 == strcmp(value, _PROFILE_OFF_)) {
+        settings.profile = false;
+    } else if (0 == strcmp(value, _PROFILE_ON_)) {
+        settings.profile = true;
+    } else if (NULL == (log = fopen(value, "ae"))) {
+        printf("set: %s: %s: %s\n", _SET_PROFILE_, value, strerror(errno));
+        return;
+    } else {
+        settings.profile = true;
+    }
+
+    if (NULL != profile_log) {
+        fclose(profile_log);
+    }
+
+    free(settings.profile_log);
+    settings.profile_log = NULL;
+    profile_log = log;
+
+    if (NULL != log) {
+        settings.profile_log = strdup(value);
+        _MALLOC_CHECK_(settings.profile_log)
+    }
+}
+
+// 0 stops memoizing, changing the TTL forgets every memoized output
+static void set_memo_ttl(const char* value) {
+    char* end;
+    long ttl = strtol(value, &end, 10);
+
+    if (end == value || *end || ttl < 0 || ttl > INT_MAX) {
+        printf("set: %s: invalid number of seconds %s\n", _SET_MEMOTTL_, value);
+        return;
+    }
+
+    settings.memo_ttl = ttl;
+    memo_clear();
+}
+
+// Variables whose values are part of memo keys, like HOME,LANG, or none
+static void set_memo_env(const char* value) {
+    free(settings.memo_env);
+    settings.memo_env = NULL;
+
+    if (0 != strcmp(value, _MEMOENV_NONE_)) {
+        settings.memo_env = strdup(value);
+        _MALLOC_CHECK_(settings.memo_env)
+    }
+}
+
+void builtins_set(Command* cmd) {
+    if (cmd->argc == 1) {
+        printf("%s %i\n", _SET_PIPESIZE_, settings.pipe_size);
+        printf("%s %i\n", _SET_MAXJOBS_, settings.max_jobs);
+        printf("%s %s\n", _SET_PROFILE_, NULL != settings.profile_log ? settings.profile_log
+                                         : settings.profile ? _PROFILE_ON_ : _PROFILE_OFF_);
+        printf("%s %i\n", _SET_MEMOTTL_, settings.memo_ttl);
+        printf("%s %s\n", _SET_MEMOENV_, NULL != settings.memo_env ? settings.memo_env
+                                                                   : _MEMOENV_NONE_);
+        return;
+    }
+
+    if (cmd->argc != 3) {
+        printf("`set` takes a setting and its value, or no arguments to show the settings\n");
+        return;
+    }
+
+    if (0 == strcmp(cmd->argv[1], _SET_PIPESIZE_)) {
+        set_pipe_size(cmd->argv[2]);
+    } else if (0 == strcmp(cmd->argv[1], _SET_MAXJOBS_)) {
+        set_max_jobs(cmd->argv[2]);
+    } else if (0 == strcmp(cmd->argv[1], _SET_PROFILE_)) {
+        set_profile(cmd->argv[2]);
+    } else if (0 == strcmp(cmd->argv[1], _SET_MEMOTTL_)) {
+        set_memo_ttl(cmd->argv[2]);
+    } else if (0 == strcmp(cmd->argv[1], _SET_MEMOENV_)) {
+        set_memo_env(cmd->argv[2]);
+    } else {
+        printf("set: unknown setting %s\n", cmd->argv[1]);
+    }
+}
+
+void builtins_wait(Command* cmd) {
+    if (cmd->argc != 1) {
+        printf("`wait` does not accept any arguments\n");
+        return;
+    }
+
+    while (job_table.n_background > 0 && reap_one());
+}
+
+/////////////////////// END BUILT-IN COMMANDS FUNCTIONS ////////////////////////
+
+
+//////////////////////// IN-PROCESS COMMANDS FUNCTIONS /////////////////////////
+
+/*
+ * Prints the character of the backslash escape at `esc`, which points past
+ * the backslash. Octal escapes are `\NNN` in a printf format, and `\0NNN`
+ * for echo and %b (`zero_octal`). Sets `stop` for `\c`, which ends all output.
+ * Returns the first character after the escape.
+ */
+static const char* print_escape(const char* esc, bool zero_octal, bool* stop) {
+    static const char from[] = "\\abefnrtv";
+    static const char to[] = "\\\a\b\033\f\n\r\t\v";
+
+    const char* found = *esc ? strchr(from, *esc) : NULL;
+
+    if (NULL != found) {
+        putchar(to[found - from]);
+        return esc + 1;
+    }
+
+    if (*esc == 'c') {
+        *stop = true;
+        return esc + 1;
+    }
+
+    int base = 0, max_digits = 0;
+    const char* digits = esc;
+
+    if (*esc == 'x') {
+        base = 16, max_digits = 2, digits++;
+    } else if (zero_octal && *esc == '0') {
+        base = 8, max_digits = 3, digits++;
+    } else if (!zero_octal && *esc >= '0' && *esc <= '7') {
+        base = 8, max_digits = 3;
+    }
+
+    int value = 0, n = 0;
+
+    for (; n < max_digits && digits[n]; n++) {
+        int digit = isxdigit((unsigned char) digits[n])
+                  ? (isdigit((unsigned char) digits[n]) ? digits[n] - '0'
+                                                        : tolower(digits[n]) - 'a' + 10)
+                  : base;
+
+        if (digit >= base) break;
+
+        value = value * base + digit;
+    }
+
+    // Not an escape, print it as it is
+    if (base == 0 || (base == 16 && n == 0)) {
+        putchar('\\');
+        return esc;
+    }
+
+    putchar(value);
+
+    return digits + n;
+}
+
+// Prints a string, interpreting its backslash escapes. Returns false after `\c`
+static bool print_escaped(const char* str, bool zero_octal) {
+    bool stop = false;
+
+    while (*str && !stop) {
+        if (*str == '\\') {
+            str = print_escape(str + 1, zero_octal, &stop);
+        } else {
+            putchar(*str++);
+        }
+    }
+
+    return !stop;
+}
+
+int inproc_echo(Command* cmd) {
+    bool newline = true, escapes = false;
+    int i = 1;
+
+    // Like coreutils, leading arguments made of only -n, -e and -E are options
+    for (; i < cmd->argc; i++) {
+        const char* arg = cmd->argv[i];
+
+        if (arg[0] != '-' || arg[1] == _NULL_TERMINATOR_ || arg[strspn(arg + 1, "neE") + 1]) {
+            break;
+        }
+
+        for (const char* c = arg + 1; *c; c++) {
+            if (*c == 'n') newline = false;
+            else escapes = *c == 'e';
+        }
+    }
+
+    for (int first = i; i < cmd->argc; i++) {
+        if (i > first) {
+            putchar(' ');
+        }
+
+        if (!escapes) {
+            fputs(cmd->argv[i], stdout);
+        } else if (!print_escaped(cmd->argv[i], true)) {
+            return _EXIT_SUCCESS_;
+        }
+    }
+
+    if (newline) {
+        putchar('\n');
+    }
+
+    return _EXIT_SUCCESS_;
+}
+
+int inproc_false(Command* cmd) {
+    return _EXIT_FAILURE_;
+}
+
+int inproc_true(Command* cmd) {
+    return _EXIT_SUCCESS_;
+}
+
+int inproc_pwd(Command* cmd) {
+    char* cwd = getcwd(NULL, 0);
+
+    if (NULL == cwd) {
+        perror("pwd");
+        return _EXIT_FAILURE_;
+    }
+
+    puts(cwd);
+    free(cwd);
+
+    return _EXIT_SUCCESS_;
+}
+
+// Parses a numeric printf argument, warning like coreutils if it is not a number
+static bool printf_number(const char* arg, bool is_float, long long* integer, double* real) {
+    char* end = NULL;
+
+    errno = 0;
+
+    if (is_float) {
+        *real = strtod(arg, &end);
+    } else if (arg[0] == '-') {
+        *integer = strtoll(arg, &end, 0);
+    } else {
+        *integer = (long long) strtoull(arg, &end, 0);
+    }
+
+    if (end == arg || *end || errno) {
+        fprintf(stderr, "printf: %s: expected a numeric value\n", arg);
+        return false;
+    }
+
+    return true;
+}
+
+// Whether every conversion of the format is one `inproc_printf` knows
+bool inproc_printf_handles(Command* cmd) {
+    if (cmd->argc < 2) return true;
+
+    for (const char* f = strchr(cmd->argv[1], '%'); NULL != f; f = strchr(f, '%')) {
+        f++;
+
+        if (*f == '%') {
+            f++;
+            continue;
+        }
+
+        f += strspn(f, "-+ #0");
+        f += strspn(f, "0123456789");
+
+        if (*f == '.') {
+            f++;
+            f += strspn(f, "0123456789");
+        }
+
+        if (!*f || !strchr(PRINTF_CONVERSIONS, *f)) return false;
+    }
+
+    return true;
+}
+
+int inproc_printf(Command* cmd) {
+    if (cmd->argc < 2) {
+        fprintf(stderr, "printf: missing operand\n");
+        return _EXIT_FAILURE_;
+    }
+
+    const char* format = cmd->argv[1];
+    char** args = cmd->argv + 2;
+    int n_args = cmd->argc - 2, next = 0, code = _EXIT_SUCCESS_;
+
+    // The format is reused while arguments are left
+    do {
+        const char* f = format;
+        int used = next;
 
-    command->argc = 0;
+        while (*f) {
+            if (*f == '\\') {
+                bool stop = false;
+                f = print_escape(f + 1, false, &stop);
 
-    int argv_size = 5;
-    int argv_incr = 5;
+                if (stop) return code;
 
-    command->argv = malloc(sizeof(char*) * argv_size);
-    _MALLOC_CHECK_(command->argv)
+                continue;
+            }
 
-    char* end_ptr;
-    char* token = strtok_r(cmd, _DELIMITER_, &end_ptr);
+            if (*f != '%') {
+                putchar(*f++);
+                continue;
+            }
 
-    while (NULL != token) {
-        if (command->argc == argv_size) {
-            argv_size += argv_incr;
-            command->argv = realloc(command->argv, sizeof(char*) * (argv_incr));
-            _MALLOC_CHECK_(command->argv)
-        }
+            if (f[1] == '%') {
+                putchar('%');
+                f += 2;
+                continue;
+            }
 
-        n = strlen(token);
+            // %[flags][width][.precision]conversion
+            const char* spec_start = f++;
+            f += strspn(f, "-+ #0");
+            f += strspn(f, "0123456789");
 
-        command->argv[command->argc] = malloc(sizeof(char) * (n + 1));
-        _MALLOC_CHECK_(command->argv[command->argc])
+            if (*f == '.') {
+                f++;
+                f += strspn(f, "0123456789");
+            }
 
-        strcpy(command->argv[command->argc++], token);
+            char conversion = *f;
+            int spec_len = f - spec_start;
 
-        token = strtok_r(NULL, _DELIMITER_, &end_ptr);
-    }
+            if (!conversion || !strchr(PRINTF_CONVERSIONS, conversion) || spec_len > 32) {
+                fprintf(stderr, "printf: %.*s: invalid conversion\n", spec_len + !!conversion,
+                        spec_start);
+                return _EXIT_FAILURE_;
+            }
 
-    command->argv = realloc(command->argv, sizeof(char*) * (command->argc + 1));
-    _MALLOC_CHECK_(command->argv)
+            f++;
+
+            // Room for the spec, an `ll` length and the conversion
+            char spec[40];
+            const char* arg = next < n_args ? args[next++] : NULL;
+            long long integer = 0;
+            double real = 0;
+
+            memcpy(spec, spec_start, spec_len);
+
+            if (strchr("diouxX", conversion)) {
+                sprintf(spec + spec_len, "ll%c", conversion);
+
+                if (NULL != arg && !printf_number(arg, false, &integer, &real)) {
+                    code = _EXIT_FAILURE_;
+                }
+
+                printf(spec, integer);
+            } else if (strchr("eEfFgGaA", conversion)) {
+                sprintf(spec + spec_len, "%c", conversion);
+
+                if (NULL != arg && !printf_number(arg, true, &integer, &real)) {
+                    code = _EXIT_FAILURE_;
+                }
+
+                printf(spec, real);
+            } else if (conversion == 'c') {
+                sprintf(spec + spec_len, "c");
+                printf(spec, NULL == arg ? 0 : arg[0]);
+            } else if (conversion == 's') {
+                sprintf(spec + spec_len, "s");
+                printf(spec, NULL == arg ? "" : arg);
+            } else if (NULL != arg && !print_escaped(arg, true)) {
+                // %b, whose `\c` ends all output
+                return code;
+            }
+        }
 
-    command->argv[command->argc] = NULL;
+        // A format without conversions prints once
+        if (next == used) break;
+    } while (next < n_args);
 
-    return command;
+    return code;
 }
 
-Process* process_init(Command* cmd) {
-    if (NULL == cmd) return NULL;
-
-    Process* proc = malloc(sizeof(Process));
-    _MALLOC_CHECK_(proc)
+// Parses an integer operand of `test`
+static bool test_integer(const char* arg, long long* value) {
+    char* end;
 
-    proc->cmd = cmd;
-    proc->state = SCHEDULED;
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
 
-    return proc;
+    return end != arg && !*end && !errno;
 }
 
-Job* job_init(char* cmd, Process** procs, int n_procs, bool bg) {
-    Job* job = malloc(sizeof(Job));
-    _MALLOC_CHECK_(job)
+// Applies a unary `test` operator, -1 if `op` is not one or the operand is bad
+static int test_unary(const char* op, const char* arg) {
+    struct stat st;
+    long long fd;
+
+    if (op[0] != '-' || !op[1] || op[2]) return -1;
+
+    switch (op[1]) {
+        case 'n': return arg[0] != _NULL_TERMINATOR_;
+        case 'z': return arg[0] == _NULL_TERMINATOR_;
+        case 'r': return 0 == access(arg, R_OK);
+        case 'w': return 0 == access(arg, W_OK);
+        case 'x': return 0 == access(arg, X_OK);
+        case 't': return test_integer(arg, &fd) ? isatty(fd) : -1;
+        case 'h':
+        case 'L': return 0 == lstat(arg, &st) && S_ISLNK(st.st_mode);
+        default: break;
+    }
 
-    job->cmd = malloc(sizeof(char) * (strlen(cmd) + 1));
-    _MALLOC_CHECK_(job->cmd);
-    strcpy(job->cmd, cmd);
+    if (!strchr("bcdefgkpsSu", op[1])) return -1;
+
+    if (stat(arg, &st) < 0) return 0;
+
+    switch (op[1]) {
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'f': return S_ISREG(st.st_mode);
+        case 'g': return 0 != (st.st_mode & S_ISGID);
+        case 'k': return 0 != (st.st_mode & S_ISVTX);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 'u': return 0 != (st.st_mode & S_ISUID);
+        default: return 1;
+    }
+}
 
-    job->processes = malloc(sizeof(Process*) * n_procs);
-    _MALLOC_CHECK_(job->processes);
+// Applies a binary `test` operator, -1 if `op` is not one or an operand is bad
+static int test_binary(const char* left, const char* op, const char* right) {
+    if (0 == strcmp(op, "=") || 0 == strcmp(op, "==")) return 0 == strcmp(left, right);
+    if (0 == strcmp(op, "!=")) return 0 != strcmp(left, right);
 
-    for (int i = 0; i < n_procs; ++i) {
-        job->processes[i] = procs[i];
-    }
+    static const char* comparisons[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
 
-    job->n_process = n_procs;
-    job->bg = bg;
-    job->p_state = FOREGROUND;
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(op, comparisons[i])) continue;
 
-    if (n_procs == 1) {
-        char* p0_cmd = procs[0]->cmd->argv[0];
+        long long a, b;
 
-        for (int i = 0; i < _N_BUILTINS_; i++) {
-            if (0 == strcmp(p0_cmd, _builtins_[i])) {
-                return job;
-            }
-        }
-    }
+        if (!test_integer(left, &a) || !test_integer(right, &b)) return -1;
 
-    for (int i = JOB_START_IDX; i < MAX_JOBS; i++) {
-        if (NULL == all_jobs[i]) {
-            all_jobs[i] = job;
-            break;
+        switch (i) {
+            case 0: return a == b;
+            case 1: return a != b;
+            case 2: return a < b;
+            case 3: return a <= b;
+            case 4: return a > b;
+            default: return a >= b;
         }
     }
 
-
-    return job;
+    return -1;
 }
 
+/*
+ * Evaluates up to TEST_MAX_ARGS arguments with the POSIX rules for their
+ * number. Returns 1 if true, 0 if false, and -1 if the expression uses an
+ * operator the shell doesn't implement, or is invalid, which the external
+ * `test` reports.
+ */
+static int test_evaluate(char** args, int n) {
+    int result;
 
-///////////////////////// END INITIALIZATION FUNCTIONS /////////////////////////
+    switch (n) {
+        case 0:
+            return 0;
+        case 1:
+            return args[0][0] != _NULL_TERMINATOR_;
+        case 2:
+            if (0 == strcmp(args[0], "!")) {
+                return !test_evaluate(args + 1, 1);
+            }
 
+            return test_unary(args[0], args[1]);
+        case 3:
+            if ((result = test_binary(args[0], args[1], args[2])) >= 0) return result;
 
-///////////////////////////// DESTRUCTOR FUNCTIONS /////////////////////////////
+            if (0 == strcmp(args[0], "!")) {
+                result = test_evaluate(args + 1, 2);
+                return result < 0 ? result : !result;
+            }
 
-void command_destroy(Command* cmd) {
-    if (NULL == cmd) return;
+            if (0 == strcmp(args[0], "(") && 0 == strcmp(args[2], ")")) {
+                return test_evaluate(args + 1, 1);
+            }
 
+            return -1;
+        default:
+            if (0 == strcmp(args[0], "!")) {
+                result = test_evaluate(args + 1, 3);
+                return result < 0 ? result : !result;
+            }
 
-    if (cmd->argv) {
-        for (int i = 0; i < cmd->argc; i++) {
-            free(cmd->argv[i]);
-        }
+            if (0 == strcmp(args[0], "(") && 0 == strcmp(args[3], ")")) {
+                return test_evaluate(args + 1, 2);
+            }
 
-        free(cmd->argv);
+            return -1;
     }
-
-    free(cmd);
 }
 
-void process_destroy(Process* process) {
-    if (NULL == process) return;
+// Anything test_evaluate can't decide, like `-nt` or `-O`, runs /usr/bin/test
+bool inproc_test_handles(Command* cmd) {
+    return cmd->argc - 1 <= TEST_MAX_ARGS && test_evaluate(cmd->argv + 1, cmd->argc - 1) >= 0;
+}
 
-    command_destroy(process->cmd);
+int inproc_test(Command* cmd) {
+    int result = test_evaluate(cmd->argv + 1, cmd->argc - 1);
 
-    free(process);
+    return result < 0 ? 2 : !result;
 }
 
-void job_destroy(Job* job) {
-    if (NULL == job) return;
+////////////////////// END IN-PROCESS COMMANDS FUNCTIONS ///////////////////////
 
-    if (job->cmd)
-        free(job->cmd);
 
-    if (job->processes) {
-        for (int i = 0; i < job->n_process; i++) {
-            process_destroy(job->processes[i]);
-        }
+/////////////////////////// SCRIPT CACHE FUNCTIONS /////////////////////////////
 
-        free(job->processes);
-    }
+// .<name>.wshc in the directory of the script
+static char* script_cache_path(const char* script_file) {
+    const char* slash = strrchr(script_file, '/');
+    int dir_len = NULL == slash ? 0 : slash - script_file + 1;
+    size_t len = strlen(script_file) + strlen(SCRIPT_CACHE_PREFIX) + strlen(SCRIPT_CACHE_SUFFIX) + 1;
 
-    for (int i = JOB_START_IDX; i < MAX_JOBS; i++) {
-        if (all_jobs[i] == job) {
-            all_jobs[i] = NULL;
-            break;
-        }
-    }
+    char* path = malloc(len);
+    _MALLOC_CHECK_(path)
 
-    if (job == foreground_job) {
-        foreground_job = NULL;
-    }
+    snprintf(path, len, "%.*s%s%s%s", dir_len, script_file, SCRIPT_CACHE_PREFIX,
+             script_file + dir_len, SCRIPT_CACHE_SUFFIX);
 
-    free(job);
+    return path;
 }
 
-/////////////////////////// END DESTRUCTOR FUNCTIONS ///////////////////////////
+// Finds the sections of the image, false if it is not a valid compiled script
+static bool script_index(Script* script) {
+    if (script->size < sizeof(ScriptHeader)) return false;
 
+    const ScriptHeader* header = script->data;
 
-/////////////////////////// SIGNAL HANDLER FUNCTIONS ///////////////////////////
+    if (header->magic != SCRIPT_CACHE_MAGIC || header->version != SCRIPT_CACHE_VERSION) {
+        return false;
+    }
 
-static inline void reset_signal_handlers() {
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
-    signal(SIGTTIN, SIG_DFL);
-    signal(SIGTTOU, SIG_DFL);
-    signal (SIGCHLD, SIG_DFL);
-}
+    size_t lines = sizeof(ScriptHeader);
+    size_t stages = lines + (size_t) header->n_lines * sizeof(ScriptLine);
+    size_t args = stages + (size_t) header->n_stages * sizeof(ScriptStage);
+    size_t strings = args + (size_t) header->n_args * sizeof(uint32_t);
 
-void sigchld_handler(int signal) {
-    pid_t cpid;
-    if (NULL != foreground_job) {
-        int n = foreground_job->n_process - 1;
-        cpid = waitpid(foreground_job->processes[n]->pid, NULL, 0);
-    } else {
-        cpid = wait(NULL);
-    }
+    if (strings + header->strings_size != script->size) return false;
 
-    if (cpid < 0) return;
+    char* data = script->data;
+    script->header = header;
+    script->lines = (const ScriptLine*) (data + lines);
+    script->stages = (const ScriptStage*) (data + stages);
+    script->args = (const uint32_t*) (data + args);
+    script->strings = data + strings;
 
-    for (int i = 1; i < MAX_JOBS; i++) {
-        Job* job = all_jobs[i];
+    // Every offset stays inside the image, so a damaged cache is compiled again
+    if (header->strings_size > 0 && script->strings[header->strings_size - 1] != _NULL_TERMINATOR_) {
+        return false;
+    }
 
-        if (NULL == job) continue;
+    for (uint32_t i = 0; i < header->n_lines; i++) {
+        const ScriptLine* line = &script->lines[i];
 
-        for (int i = 0; i < job->n_process; i++) {
-            if (job->processes[i]->pid == cpid) {
-                job->processes[i]->state = DONE;
-                break;
-            }
+        if (line->cmd >= header->strings_size || line->n_stages == 0 ||
+            line->first_stage > header->n_stages ||
+            line->n_stages > header->n_stages - line->first_stage) {
+            return false;
         }
+    }
 
-        if (job->processes[job->n_process - 1]->pid == cpid) {
-            job_destroy(job);
-            return;
+    for (uint32_t i = 0; i < header->n_stages; i++) {
+        const ScriptStage* stage = &script->stages[i];
+
+        if (stage->argc == 0 || stage->first_arg > header->n_args ||
+            stage->argc > header->n_args - stage->first_arg) {
+            return false;
         }
     }
-}
-
-// void sigtstp_handler(int signal) {
-//     // printf("%i got a SIGTSTP\n", getpid());
-//     // printf("%s\n", foreground_job->cmd);
-//     if (NULL == foreground_job) {
-//         printf("foreground_job is NULL");
-//         return;
-//     }
 
-//     // printf("foreground job: %s", foreground_job->cmd);
+    for (uint32_t i = 0; i < header->n_args; i++) {
+        if (script->args[i] >= header->strings_size) return false;
+    }
 
-//     int n = foreground_job->n_process;
+    return true;
+}
 
-//     for (int i = 0; i < n; i++) {
-//         if (foreground_job->processes[i]->state != RUNNING) {
-//             continue;
-//         }
+/*
+ * Maps a compiled script, pages are copied on write since commands get the
+ * strings. The cache runs commands as the user, so it must be a file of the
+ * user that nobody else can write, or it is compiled again.
+ */
+static bool script_map(const char* path, Script* script) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
 
-//         pid_t pid = foreground_job->processes[i]->pid;
+    if (fd < 0) return false;
 
-//         if (kill(pid, SIGTSTP) < 0) {
-//             _FAILURE_EXIT_("FATAL ERROR: Couldn't send SIGTSTP signal!\n");
-//         }
+    struct stat st;
 
-//         foreground_job->processes[i]->state = PAUSED;
-//     }
-//     foreground_job = NULL;
-// }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()
+        || (st.st_mode & (S_IWGRP | S_IWOTH))
+        || st.st_size < (off_t) sizeof(ScriptHeader)) {
+        close(fd);
+        return false;
+    }
 
+    void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
 
-///////////////////////// END SIGNAL HANDLER FUNCTIONS /////////////////////////
+    if (MAP_FAILED == data) return false;
 
+    script->data = data;
+    script->size = st.st_size;
+    script->mapped = true;
 
-///////////////////////////// MAIN LOOP FUNCTIONS //////////////////////////////
+    if (!script_index(script)) {
+        script_unload(script);
+        return false;
+    }
 
-void display_prompt() {
-    printf(_PROMPT_);
-    fflush(stdout);
+    return true;
 }
 
-char* get_command() {
-    char* cmd = NULL;
-    size_t size = 0;
+static bool read_all(int fd, ByteBuffer* buf) {
+    char chunk[ARENA_BLOCK_SIZE];
+    ssize_t n;
 
-    ssize_t n_chars = getline(&cmd, &size, stdin);
+    while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
 
-    if (n_chars < 0) {
-        free(cmd);
-        _FAILURE_EXIT_("getline failed to read input!\n")
+        buffer_append(buf, chunk, n);
     }
 
-    return cmd;
+    return true;
 }
 
-Job* parse_command(char* input) {
-    bool bg = false;
-    ssize_t len = strlen(input);
+static void header_set_source(ScriptHeader* header, const struct stat* st, uint64_t hash) {
+    header->mtime_sec = st->st_mtim.tv_sec;
+    header->mtime_nsec = st->st_mtim.tv_nsec;
+    header->size = st->st_size;
+    header->hash = hash;
 
-    if (len <= 0) {
-        return NULL;
+    /* A script modified in the last second could change again without its mtime
+       changing, its contents are hashed again on the next run */
+    if (st->st_mtim.tv_sec >= time(NULL) - 1) {
+        header->mtime_sec = -1;
     }
+}
 
-    char* cmd_cpy = malloc(sizeof(char) * (len + 1));
-    strcpy(cmd_cpy, input);
+// Compiles every line of the text into an image, the way run_command parses it
+static void script_compile(char* text, size_t len, ByteBuffer* image) {
+    ByteBuffer lines = {0}, stages = {0}, args = {0}, strings = {0};
+    ScriptHeader header = { .magic = SCRIPT_CACHE_MAGIC, .version = SCRIPT_CACHE_VERSION };
 
-    if (input[len - 1] == _AMPERSAND_) {
-        bg = true;
-        input[len - 1] = _NULL_TERMINATOR_;
-    }
+    for (char* start = text; start < text + len;) {
+        char* end = memchr(start, '\n', text + len - start);
 
-    Process* procs[32];
-    int n_procs = 0;
+        if (NULL == end) end = text + len;
 
-    if (NULL != strstr(input, _PIPE_)) {
-        char* end_str;
-        char* token = strtok_r(input, _PIPE_, &end_str);
+        // The newline is dropped, the text has a terminator after the last line
+        *end = _NULL_TERMINATOR_;
 
-        while(NULL != token) {
-            Command* cmd = command_init(token);
-            if (NULL == cmd) _FAILURE_EXIT_("Command init failed!\n")
+        Job* job = parse_command(start);
+        start = end + 1;
 
-            procs[n_procs] = process_init(cmd);
+        if (NULL == job) continue;
 
-            if (NULL == procs[n_procs]) _FAILURE_EXIT_("Process init failed!\n")
+        ScriptLine line = {
+            .cmd = strings.len,
+            .first_stage = header.n_stages,
+            .n_stages = job->n_process,
+            .bg = job->bg,
+        };
 
-            n_procs++;
+        buffer_append(&lines, &line, sizeof(line));
+        buffer_append(&strings, job->cmd, strlen(job->cmd) + 1);
+        header.n_lines++;
 
-            token = strtok_r(NULL, _PIPE_, &end_str);
-        }
-    } else {
-        Command* cmd = command_init(input);
-        if (NULL == cmd) _FAILURE_EXIT_("Command init failed!\n")
+        for (int i = 0; i < job->n_process; i++) {
+            Command* cmd = job->processes[i]->cmd;
+            ScriptStage stage = { .first_arg = header.n_args, .argc = cmd->argc };
 
-        procs[n_procs] = process_init(cmd);
+            buffer_append(&stages, &stage, sizeof(stage));
+            header.n_stages++;
 
-        if (NULL == procs[n_procs]) _FAILURE_EXIT_("Process init failed!\n")
+            for (int j = 0; j < cmd->argc; j++) {
+                uint32_t offset = strings.len;
 
-        n_procs++;
-    }
+                buffer_append(&args, &offset, sizeof(offset));
+                buffer_append(&strings, cmd->argv[j], strlen(cmd->argv[j]) + 1);
+                header.n_args++;
+            }
+        }
 
-    Job* job = job_init(cmd_cpy, procs, n_procs, bg);
+        job_destroy(job);
+    }
 
-    free(cmd_cpy);
+    header.strings_size = strings.len;
 
-    if (NULL == job) _FAILURE_EXIT_("Job init failed!\n")
+    buffer_append(image, &header, sizeof(header));
+    buffer_append(image, lines.data, lines.len);
+    buffer_append(image, stages.data, stages.len);
+    buffer_append(image, args.data, args.len);
+    buffer_append(image, strings.data, strings.len);
 
-    return job;
+    free(lines.data);
+    free(stages.data);
+    free(args.data);
+    free(strings.data);
 }
 
-void dispatch_job(Job* job) {
+// Replaces the cache with the image, a script in a read-only directory is not cached
+static void script_save(const char* path, const ByteBuffer* image) {
+    size_t len = strlen(path) + sizeof(".XXXXXX");
+    char* tmp = malloc(len);
+    _MALLOC_CHECK_(tmp)
 
-    pid_t cpid = fork();
+    snprintf(tmp, len, "%s.XXXXXX", path);
 
-    if (cpid < 0) _FAILURE_EXIT_("fork failed!\n")
+    // Created with O_EXCL and mode 0600, then renamed over the cache
+    int fd = mkostemp(tmp, O_CLOEXEC);
 
-    char** argv = job->processes[0]->cmd->argv;
-    switch (cpid) {
-        case 0: // child
-            if (job->bg == true) {
-                close(STDIN_FILENO);
-            }
+    if (fd >= 0) {
+        bool written = write(fd, image->data, image->len) == (ssize_t) image->len;
 
+        if (close(fd) < 0 || !written || rename(tmp, path) < 0) {
+            unlink(tmp);
+        }
+    }
 
-            reset_signal_handlers();
+    free(tmp);
+}
 
-            execvp(argv[0], argv);
+// Loads the compiled script from its cache, compiling it if the script changed
+bool script_load(const char* script_file, Script* script) {
+    int fd = open(script_file, O_RDONLY | O_CLOEXEC);
 
-            _FAILURE_EXIT_("execvp failed!\n")
+    if (fd < 0) return false;
 
-            break;
-        default: // parent
-            job->processes[0]->pid = cpid;
-            job->processes[0]->state = RUNNING;
-
-            job->pgid = cpid;
-
-            if (job->bg == false) {
-                foreground_job = job;
-                waitpid(cpid, NULL, 0);
-                job_destroy(job);
-            } else {
-                job->p_state = BACKGROUND;
-            }
+    struct stat st;
 
-            break;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
     }
-}
-
-void dispatch_piped_jobs(Job* job) {
-    int n_pipes = job->n_process - 1;
 
-    int pipes[n_pipes][2];
+    // Pipes like <(...) can't be cached
+    char* cache_path = S_ISREG(st.st_mode) ? script_cache_path(script_file) : NULL;
+    bool cached = NULL != cache_path && script_map(cache_path, script);
 
-    for (int i = 0; i < n_pipes; i++) {
-        if (pipe(pipes[i]) < 0) _FAILURE_EXIT_("pipe failed!\n")
+    if (cached && script->header->mtime_sec == st.st_mtim.tv_sec &&
+        script->header->mtime_nsec == st.st_mtim.tv_nsec &&
+        script->header->size == st.st_size) {
+        close(fd);
+        free(cache_path);
+        return true;
     }
 
-    pid_t first;
-    for (int i = 0; i < job->n_process; i++) {
-        pid_t cpid = fork();
+    ByteBuffer text = {0};
+    bool read_ok = read_all(fd, &text);
+    close(fd);
 
-        if (cpid < 0) _FAILURE_EXIT_("Fork failure\n")
+    if (!read_ok) {
+        if (cached) script_unload(script);
+        free(text.data);
+        free(cache_path);
+        return false;
+    }
 
-        if (i == 0) {
-            first = cpid;
-        }
+    uint64_t hash = hash_bytes(text.data, text.len);
 
-        if (0 == cpid) {
-            // close write ends of pipes for previous processes
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
+    // A script that was only touched keeps its cache, with the new mtime
+    if (cached && script->header->size == (int64_t) text.len && script->header->hash == hash) {
+        // The mapping is private, the cache is replaced like a new one
+        header_set_source((ScriptHeader*) script->data, &st, hash);
 
-            // close read ends of pipes for following processes
-            if (i < n_pipes) {
-                dup2(pipes[i][1], STDOUT_FILENO);
-            }
+        ByteBuffer image = { .data = script->data, .len = script->size };
+        script_save(cache_path, &image);
 
-            // Close all remaining pipe file descriptors
-            for (int j = 0; j < n_pipes; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            char** argv = job->processes[i]->cmd->argv;
+        free(text.data);
+        free(cache_path);
+        return true;
+    }
 
+    if (cached) script_unload(script);
 
-            reset_signal_handlers();
+    // Offsets in the image are 32 bits
+    if (text.len > UINT32_MAX / 4) {
+        errno = EFBIG;
+        free(text.data);
+        free(cache_path);
+        return false;
+    }
 
-            execvp(argv[0], argv);
+    buffer_append(&text, "", 1);
 
-            _FAILURE_EXIT_("execvp failed!\n");
-        } else {
-            job->processes[i]->pid = cpid;
-            job->processes[i]->state = RUNNING;
+    ByteBuffer image = {0};
+    script_compile(text.data, text.len - 1, &image);
+    free(text.data);
 
-            // Close all remaining pipe file descriptors in parent as well
-            if (i > 0) {
-                close(pipes[i-1][0]);
-            }
-            if (i < n_pipes) {
-                close(pipes[i][1]);
-            }
+    header_set_source((ScriptHeader*) image.data, &st, hash);
 
-        }
+    if (NULL != cache_path) {
+        script_save(cache_path, &image);
+        free(cache_path);
     }
 
-    job->pgid = first;
+    script->data = image.data;
+    script->size = image.len;
+    script->mapped = false;
 
-    if (job->bg == false) {
-        foreground_job = job;
-        for (int i = 0; i < job->n_process; i++) {
-            waitpid(job->processes[i]->pid, NULL, 0);
-        }
-        job_destroy(job);
-    } else {
-        job->p_state = BACKGROUND;
-    }
+    if (!script_index(script)) _FAILURE_EXIT_("Script compile failed!\n")
+
+    return true;
 }
 
-/////////////////////////// END MAIN LOOP FUNCTIONS ////////////////////////////
+// Builds the job of a line from the offsets in the image, without parsing it
+Job* script_job(const Script* script, uint32_t n) {
+    const ScriptLine* line = &script->lines[n];
+    char* strings = (char*) script->strings;
 
+    Arena* arena = arena_acquire();
+    Process** procs = arena_alloc(arena, sizeof(Process*) * line->n_stages);
 
-///////////////////////// BUILT-IN COMMANDS FUNCTIONS //////////////////////////
+    for (uint32_t i = 0; i < line->n_stages; i++) {
+        const ScriptStage* stage = &script->stages[line->first_stage + i];
+        const uint32_t* args = &script->args[stage->first_arg];
 
-int check_builtin(Job* job) {
-    if (job->n_process != 1) {
-        return 0;
-    }
+        Command* cmd = arena_alloc(arena, sizeof(Command));
+        cmd->argc = stage->argc;
+        cmd->argv = arena_alloc(arena, sizeof(char*) * (stage->argc + 1));
 
-    char* command = job->processes[0]->cmd->argv[0];
+        for (uint32_t j = 0; j < stage->argc; j++) {
+            cmd->argv[j] = strings + args[j];
+        }
 
-    if (strncmp(command, _BUILTINS_BG_, strlen(_BUILTINS_BG_)) == 0) {
-        builtins_bg(job->processes[0]->cmd);
-    }
-    else if (strncmp(command, _BUILTINS_CD_, strlen(_BUILTINS_CD_)) == 0) {
-        builtins_cd(job->processes[0]->cmd);
-    }
-    else if (strncmp(command, _BUILTINS_EXIT_, strlen(_BUILTINS_EXIT_)) == 0) {
-        builtins_exit(job->processes[0]->cmd);
-    }
-    else if (strncmp(command, _BUILTINS_FG_, strlen(_BUILTINS_FG_)) == 0) {
-        builtins_fg(job->processes[0]->cmd);
+        cmd->argv[stage->argc] = NULL;
+        procs[i] = process_init(arena, cmd);
     }
-    else if (strncmp(command, _BUILTINS_JOBS_, strlen(_BUILTINS_JOBS_)) == 0) {
-        builtins_jobs(job->processes[0]->cmd);
+
+    return job_init(arena, strings + line->cmd, procs, line->n_stages, line->bg);
+}
+
+void script_unload(Script* script) {
+    if (script->mapped) {
+        munmap(script->data, script->size);
     } else {
-        return 0;
+        free(script->data);
     }
-    return 1;
-}
 
-void builtins_bg(Command* cmd) {
-    printf("builtins_bg has not been implemented yet!\n");
-    exit(0);
+    script->data = NULL;
+    script->size = 0;
 }
-void builtins_cd(Command* cmd) {
-    if (cmd->argc != 2) {
-        printf("`cd` takes exactly 1 argument, the path to a directory to switch to\n");
+
+///////////////////////// END SCRIPT CACHE FUNCTIONS ///////////////////////////
+
+
+//////////////////////////// APPLICATION FUNCTIONS /////////////////////////////
+
+void run_command(char* command) {
+    if (strlen(command) == 0) {
         return;
     }
 
-    if(chdir(cmd->argv[1]) < 0) {
-        printf("cd failed!");
-    }
-}
+    // Jobs that finished since the last line give up their IDs
+    reap_children();
 
-void builtins_exit(Command* cmd) {
-    if (cmd->argc != 1) {
-        printf("`exit` does not accept any arguments\n");
+    Job* job = parse_command(command);
+
+    if (NULL == job) {
         return;
     }
-    exit(_EXIT_SUCCESS_);
-}
 
-void builtins_fg(Command* cmd) {
-    printf("builtins_fg has not been implemented yet!\n");
-    exit(0);
+    job_register(job);
+    run_job(job);
 }
 
-void builtins_jobs(Command* cmd) {
-    Job* job;
-    for (int i = 1; i < MAX_JOBS; i++) {
-        if (NULL == (job = all_jobs[i])) {
-            continue;
-        }
+void run_job(Job* job) {
+    Command* first = job->processes[0]->cmd;
 
-        printf("%i: %s\n", i, job->cmd);
+    // `time <command>` profiles this job only
+    if (first->argc > 1 && 0 == strcmp(first->argv[0], _TIME_PREFIX_)) {
+        first->argv++;
+        first->argc--;
+        job->profiled = true;
     }
-}
-
-/////////////////////// END BUILT-IN COMMANDS FUNCTIONS ////////////////////////
 
+    job->profiled |= settings.profile;
 
-//////////////////////////// APPLICATION FUNCTIONS /////////////////////////////
+    // `memo <command>` replays the output of a foreground job that ran before
+    bool memoized = false;
 
-void run_command(char* command) {
-    if (strlen(command) == 0) {
-        return;
+    if (first->argc > 1 && 0 == strcmp(first->argv[0], _MEMO_PREFIX_)) {
+        first->argv++;
+        first->argc--;
+        memoized = !job->bg && settings.memo_ttl > 0;
     }
 
-    Job* job = parse_command(command);
-
     if(check_builtin(job)) {
         // Release Memory
         job_destroy(job);
+
+        // Before any child writes after the built-in's output
+        fflush(stdout);
+        return;
+    }
+
+    // pin, nice and ioprio in front of the stages
+    parse_controls(job);
+
+    // Under `set maxjobs`, a background job starts once another one is done
+    if (job->bg && settings.max_jobs > 0) {
+        wait_for_slot();
+        job->scheduled = true;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+    if (memoized && memo_replay(job)) {
+        finish_job(job);
         return;
     }
 
@@ -542,34 +3023,84 @@ void run_command(char* command) {
 }
 
 void run_script_file(const char* script_file) {
-    FILE* handle;
+    Script script;
 
-    if (NULL == (handle = fopen(script_file, "r"))) {
-        _FAILURE_EXIT_("fopen failed!\n")
+    if (!script_load(script_file, &script)) {
+        _FAILURE_EXIT_("open failed!\n")
     }
 
-    size_t size = 0;
+    for (uint32_t i = 0; i < script.header->n_lines; i++) {
+        // Jobs that finished since the last line give up their IDs
+        reap_children();
 
-    char* command = NULL;
+        Job* job = script_job(&script, i);
 
-    while (getline(&command, &size, handle) > 0) {
-      command[strlen(command) - 1] = '\0';
+        job_register(job);
+        run_job(job);
+    }
 
-      run_command(command);
+    // Scheduled jobs are reported before the script ends
+    if (settings.max_jobs > 0) {
+        while (job_table.n_background > 0 && reap_one());
     }
-    if (NULL != command) {
-        free(command);
+
+    // Jobs still running point into the script, it is only unmapped on exit
+}
+
+// Runs every complete line of the input, keeping an incomplete last line
+static void run_input_lines(InputBuffer* input) {
+    size_t start = 0;
+    char* newline;
+
+    while (NULL != (newline = memchr(input->data + start, '\n', input->len - start))) {
+        *newline = _NULL_TERMINATOR_;
+        run_command(input->data + start);
+        start = newline - input->data + 1;
+
+        display_prompt();
     }
+
+    memmove(input->data, input->data + start, input->len - start);
+    input->len -= start;
 }
 
-void run_cli() {
+/*
+ * Waits for input and for children in one loop, so background jobs are
+ * reaped as soon as they exit, even while the shell waits at the prompt.
+ */
+void run_cli(int child_fd) {
+    InputBuffer input = { .data = NULL, .len = 0, .capacity = 0 };
+
+    display_prompt();
+
     while (true) {
-        display_prompt();
-        char* command = get_command();
-        command[strlen(command) - 1] = '\0';
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = child_fd, .events = POLLIN },
+        };
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            _FAILURE_EXIT_("poll failed!\n")
+        }
+
+        if (fds[1].revents & POLLIN) {
+            handle_child_signals(child_fd);
+        }
 
-        run_command(command);
-        free(command);
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+        if (read_input(&input) == 0) {
+            // EOF, run an incomplete last line before exiting
+            if (input.len > 0) {
+                input.data[input.len] = _NULL_TERMINATOR_;
+                run_command(input.data);
+            }
+
+            exit(_EXIT_SUCCESS_);
+        }
+
+        run_input_lines(&input);
     }
 }
 
@@ -581,18 +3112,8 @@ void run_cli() {
 int main(int argc, char const *argv[]) {
     // shell_pgid = getpid();
 
-    // set up SIGCHLD
-    /*{
-        struct sigaction chld_handler = { .sa_handler = NULL,
-                                          .sa_flags = SA_RESTART | SA_NOCLDSTOP};
-
-        chld_handler.sa_handler = sigchld_handler;
-
-        // ensure the handler is bound properly
-        if (sigaction(SIGCHLD, &chld_handler, NULL) < 0) {
-            _FAILURE_EXIT_("FATAL ERROR: Couldn't bind SIGCHLD!\n");
-        }
-    }*/
+    // SIGCHLD is read from a signalfd in the main loop
+    int child_fd = setup_child_signals();
 
     // // set up SIGTSTP
     // {
@@ -610,7 +3131,7 @@ int main(int argc, char const *argv[]) {
 
     switch (argc - 1) {
         case 0:
-            run_cli();
+            run_cli(child_fd);
             break;
         case 1:
             run_script_file(argv[1]);
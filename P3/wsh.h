@@ -1,7 +1,12 @@
 #ifndef _MK_WSH_
 #define _MK_WSH_
 
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <time.h>
 
 /* Exit codes */
 #define _EXIT_FAILURE_ 1
@@ -12,17 +17,40 @@
 #define _BUILTINS_CD_    "cd"
 #define _BUILTINS_EXIT_  "exit"
 #define _BUILTINS_FG_    "fg"
+#define _BUILTINS_HASH_  "hash"
 #define _BUILTINS_JOBS_  "jobs"
+#define _BUILTINS_SET_   "set"
+#define _BUILTINS_WAIT_  "wait"
 
-#define _N_BUILTINS_ 5
+#define _N_BUILTINS_ 8
 static char* _builtins_[_N_BUILTINS_] = {
     _BUILTINS_BG_,
     _BUILTINS_CD_,
     _BUILTINS_EXIT_,
     _BUILTINS_FG_,
+    _BUILTINS_HASH_,
     _BUILTINS_JOBS_,
+    _BUILTINS_SET_,
+    _BUILTINS_WAIT_,
 };
 
+/* Commands run inside the shell instead of spawning a process */
+#define _INPROC_ECHO_    "echo"
+#define _INPROC_FALSE_   "false"
+#define _INPROC_PRINTF_  "printf"
+#define _INPROC_PWD_     "pwd"
+#define _INPROC_TEST_    "test"
+#define _INPROC_TRUE_    "true"
+
+/* `test` with more arguments than this runs the external command */
+#define TEST_MAX_ARGS 4
+
+/* printf conversions handled in the shell, others run the external command */
+#define PRINTF_CONVERSIONS "diouxXcsbeEfFgGaA"
+
+/* Flag of `hash` to forget every command */
+#define _HASH_RESET_FLAG_ "-r"
+
 /* Token delimiter */
 #define _DELIMITER_ " "
 
@@ -30,15 +58,82 @@ static char* _builtins_[_N_BUILTINS_] = {
 #define _PIPE_ "|"
 #define _AMPERSAND_ '&'
 
+/* Bytes read from stdin at once */
+#define INPUT_READ_SIZE 4096
+
 /* Shell Prompt */
 #define _PROMPT_ "wsh> "
 
 /* String Terminator */
 #define _NULL_TERMINATOR_ '\0'
 
-/* Maximum number of jobs */
-#define MAX_JOBS 128
+/* Job table sizes */
 #define JOB_START_IDX 1
+#define JOB_TABLE_INITIAL_CAPACITY 64
+#define PID_MAP_INITIAL_CAPACITY 64
+
+/* Settings changed with `set` */
+#define _SET_PIPESIZE_ "pipesize"
+#define _SET_MAXJOBS_  "maxjobs"
+#define _SET_PROFILE_  "profile"
+#define _PROFILE_ON_   "on"
+#define _PROFILE_OFF_  "off"
+
+/* Prefix profiling the job it is in front of */
+#define _TIME_PREFIX_ "time"
+
+/* Prefix replaying the output of a foreground job that ran before */
+#define _MEMO_PREFIX_ "memo"
+#define _SET_MEMOTTL_ "memottl"
+#define _SET_MEMOENV_ "memoenv"
+#define _MEMOENV_NONE_ "none"
+#define _MEMOENV_SEPARATOR_ ','
+#define MEMO_DEFAULT_TTL 60
+#define MEMO_MAX_OUTPUT (1 << 20)
+#define MEMO_MAX_BYTES (16 << 20)
+#define MEMO_MAX_ENTRIES 1024
+#define MEMO_CACHE_INITIAL_CAPACITY 64
+
+/* Prefixes setting the scheduling of a stage, the ones of the first stage apply to every stage */
+#define _PIN_PREFIX_    "pin"
+#define _NICE_PREFIX_   "nice"
+#define _NICE_FLAG_     "-n"
+#define _IOPRIO_PREFIX_ "ioprio"
+#define NICE_RANGE 40
+
+/* I/O priority classes of ioprio_set, as in linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_LEVELS 8
+#define IOPRIO_DEFAULT_LEVEL 4
+#define _IOPRIO_IDLE_ "idle"
+#define _IOPRIO_BE_   "be"
+#define _IOPRIO_RT_   "rt"
+
+/* Shell running executables without a #! line, as execvp does */
+#define _SHELL_PATH_ "/bin/sh"
+
+/* Search path used by execvp when PATH is not set */
+#define _DEFAULT_PATH_ "/bin:/usr/bin"
+#define _PATH_SEPARATOR_ ':'
+
+/* Command hash table sizes */
+#define PATH_CACHE_INITIAL_CAPACITY 64
+#define PATH_CACHE_LOAD_FACTOR 1
+
+/* Compiled scripts, cached next to the script as .<name>.wshc */
+#define SCRIPT_CACHE_PREFIX "."
+#define SCRIPT_CACHE_SUFFIX ".wshc"
+#define SCRIPT_CACHE_MAGIC 0x43485357u
+#define SCRIPT_CACHE_VERSION 1
+
+/* Arena sizes */
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_POOL_MAX 16
+#define ARENA_ALIGN (sizeof(max_align_t))
 
 /* Malloc Check */
 #define _MALLOC_CHECK_(x) if (NULL == x) {perror("malloc failed!\n"); exit(1);}
@@ -66,15 +161,122 @@ typedef enum {
     DONE,
 } ProcessState;
 
+/* Input read from stdin that was not run yet */
+typedef struct {
+    char* data;        /* Bytes read, the last line may be incomplete */
+    size_t len;        /* Number of bytes in data */
+    size_t capacity;   /* Size of data */
+} InputBuffer;
+
+/* Shell settings */
+typedef struct {
+    int pipe_size;     /* Capacity of the pipes between stages, 0 keeps the default */
+    int max_jobs;      /* Most background jobs running at once, 0 for no limit */
+    bool profile;      /* Profile every job */
+    char* profile_log; /* File profiles are appended to as JSON lines, NULL for stderr */
+    int memo_ttl;      /* Seconds a memoized output is replayed for, 0 to never memoize */
+    char* memo_env;    /* Variables that are part of memo keys, separated by commas, NULL for none */
+} Settings;
+
+/* Chunk of an arena, blocks are kept for reuse when the arena is released */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;  /* Next block in the arena */
+    size_t size;              /* Usable bytes in data */
+    size_t used;              /* Bytes handed out from data */
+    char data[];
+} ArenaBlock;
+
+/* Bump allocator holding everything parsed from one line */
+typedef struct Arena {
+    ArenaBlock* head;         /* First block */
+    ArenaBlock* current;      /* Block being allocated from */
+    struct Arena* next_free;  /* Next arena in the pool of released arenas */
+} Arena;
+
+/* Command name resolved through PATH */
+typedef struct PathEntry {
+    char* name;              /* Name the command was run with */
+    char* path;              /* Absolute path of the executable */
+    unsigned long hash;      /* Hash of the name */
+    unsigned hits;           /* Number of times the command was run */
+    struct PathEntry* next;  /* Next entry in the same bucket */
+} PathEntry;
+
+/* Hash table from command names to executables, valid for one value of PATH */
+typedef struct {
+    PathEntry** buckets;     /* Chains of entries */
+    size_t capacity;         /* Number of buckets, a power of 2 */
+    size_t n;                /* Number of entries */
+    char* path_env;          /* PATH the entries were resolved with */
+} PathCache;
+
 typedef struct {
     int argc;     /* Number of arguments in the args array */
-    char** argv;  /* Array of command arguments (ex. ["ls", "-l", NULL]). Terminated by NULL */
+    char** argv;  /* Array of command arguments (ex. ["ls", "-l", NULL]). Terminated by NULL.
+                     The arguments point into the job's copy of the input line */
 } Command;
 
+/* Growable array of bytes */
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} ByteBuffer;
+
+/* Output of a job run under `memo`, captured to be replayed */
+typedef struct {
+    char* key;             /* Arguments of every stage, working directory and selected variables */
+    size_t key_len;        /* Bytes in key */
+    uint64_t hash;         /* Hash of the key */
+    int capture_fd;        /* Read end of the pipe the last stage writes to, -1 if closed */
+    ByteBuffer output;     /* Output of the job so far */
+    bool overflow;         /* Output was larger than MEMO_MAX_OUTPUT, and is not kept */
+} MemoCapture;
+
+/* Output of a job that is replayed when the same job runs again */
+typedef struct MemoEntry {
+    char* key;               /* Key of the job, as in MemoCapture */
+    size_t key_len;
+    uint64_t hash;
+    char* output;            /* What the job wrote to stdout */
+    size_t output_len;
+    int* statuses;           /* Wait status of every stage */
+    int n_statuses;
+    struct timespec expires; /* When the entry stops being replayed */
+    struct MemoEntry* next;  /* Next entry in the same bucket */
+    struct MemoEntry* newer; /* Entry replayed or stored after this one */
+    struct MemoEntry* older; /* Entry replayed or stored before this one */
+} MemoEntry;
+
+/* Hash table of memoized outputs */
+typedef struct {
+    MemoEntry** buckets;     /* Chains of entries */
+    size_t capacity;         /* Number of buckets, a power of 2 */
+    size_t n;                /* Number of entries */
+    size_t bytes;            /* Memory used by the entries */
+    MemoEntry* newest;       /* Most recently used entry */
+    MemoEntry* oldest;       /* Least recently used entry, evicted first */
+} MemoCache;
+
+/* Scheduling of a process, set by the prefixes in front of its stage */
+typedef struct {
+    bool pinned;           /* Whether the process is pinned to cpus */
+    cpu_set_t cpus;        /* CPUs the process may run on */
+    bool niced;            /* Whether nice is set */
+    int nice;              /* Added to the niceness of the shell */
+    bool io_prioritized;   /* Whether io_priority is set */
+    int io_priority;       /* Class and level for ioprio_set */
+} Controls;
+
 typedef struct {
     Command* cmd;          /* The Command struct representing the job */
+    Controls* controls;    /* Scheduling set by pin, nice and ioprio, NULL if none */
     pid_t pid;             /* Process ID of the job */
     ProcessState state;    /* Is the process running */
+    int status;            /* Wait status, once the process is DONE */
+    struct timespec start; /* When the process was launched */
+    double wall;           /* Seconds from launch until it was reaped */
+    struct rusage usage;   /* Resources used, once the process is DONE */
 } Process;
 
 typedef struct {
@@ -84,25 +286,125 @@ typedef struct {
     bool bg;               /* Flag indicating if this command run in the background */
     JobState p_state;      /* State of the job */
     pid_t pgid;            /* Process Group ID */
+    Arena* arena;          /* Arena the job, its processes and commands live in */
+    int id;                /* Job ID, 0 if the job is not in the job table */
+    int n_running;         /* Number of processes not reaped yet */
+    bool scheduled;        /* Background job started under `set maxjobs`, reported when done */
+    bool profiled;         /* Resources of every process are reported when done */
+    struct timespec start; /* When the job was dispatched */
+    MemoCapture* memo;     /* Output captured for `memo`, NULL if the job is not memoized */
 } Job;
 
+/* Slot of the pid map, a pid of 0 is an empty slot */
+typedef struct {
+    pid_t pid;             /* Process ID of a child that was not reaped yet */
+    Job* job;              /* Job of the child */
+    int proc;              /* Index of the child in the job's processes */
+} PidEntry;
+
+/* Jobs by ID, and their running processes by pid */
+typedef struct {
+    Job** jobs;            /* Jobs by ID, NULL for unused IDs */
+    int capacity;          /* Length of jobs */
+    int next_id;           /* Smallest ID never handed out */
+    int* free_ids;         /* Min-heap of the released IDs below next_id */
+    int n_free;            /* Number of IDs in free_ids */
+    PidEntry* pids;        /* Open addressing table, linearly probed */
+    size_t pid_capacity;   /* Number of slots in pids, a power of 2 */
+    size_t n_pids;         /* Number of children not reaped yet */
+    int n_background;      /* Number of background jobs still running */
+} JobTable;
+
+/* Start of a compiled script, followed by its lines, stages, arguments and strings */
+typedef struct {
+    uint32_t magic;        /* SCRIPT_CACHE_MAGIC */
+    uint32_t version;      /* SCRIPT_CACHE_VERSION */
+    int64_t mtime_sec;     /* Modification time of the script it was compiled from */
+    int64_t mtime_nsec;
+    int64_t size;          /* Size of the script */
+    uint64_t hash;         /* Hash of the contents of the script */
+    uint32_t n_lines;      /* Number of lines with a job */
+    uint32_t n_stages;     /* Number of stages of all the lines */
+    uint32_t n_args;       /* Number of arguments of all the stages */
+    uint32_t strings_size; /* Bytes in the string table */
+} ScriptHeader;
+
+/* Line of a script, a job */
+typedef struct {
+    uint32_t cmd;          /* Offset of the line in the string table, shown in `jobs` */
+    uint32_t first_stage;  /* Index of its first stage */
+    uint32_t n_stages;     /* Number of stages */
+    uint32_t bg;           /* Whether the line ends with & */
+} ScriptLine;
+
+/* Stage of a line, a process */
+typedef struct {
+    uint32_t first_arg;    /* Index of its first argument */
+    uint32_t argc;         /* Number of arguments */
+} ScriptStage;
+
+/* Compiled script, mapped from the cache or compiled in memory */
+typedef struct {
+    void* data;                /* Start of the image */
+    size_t size;               /* Bytes in the image */
+    bool mapped;               /* Whether data is mapped, or allocated */
+    const ScriptHeader* header;
+    const ScriptLine* lines;
+    const ScriptStage* stages;
+    const uint32_t* args;      /* Offsets of the arguments in the string table */
+    const char* strings;       /* NUL terminated strings */
+} Script;
+
+/* Arena Functions */
+Arena* arena_acquire();
+void arena_release(Arena*);
+void* arena_alloc(Arena*, size_t);
+char* arena_strdup(Arena*, const char*, size_t);
+
+/* Job Table Functions */
+int job_table_add(Job*);
+void job_table_remove(Job*);
+void pid_map_add(Job*, int);
+PidEntry* pid_map_find(pid_t);
+void pid_map_remove(pid_t);
+void job_register(Job*);
+
 /* Initializer Functions */
-Command* command_init(char*);
-Process* process_init(Command*);
-Job* job_init(char*, Process**, int, bool);
+Command* command_init(Arena*, char*);
+Process* process_init(Arena*, Command*);
+Job* job_init(Arena*, char*, Process**, int, bool);
 
 /* Destructor Functions */
-void command_destroy(Command*);
-void process_destroy(Process*);
 void job_destroy(Job*);
 
 /* Signal Handlers */
-void sigchld_handler(int);
+int setup_child_signals();
+void handle_child_signals(int);
+void reap_children();
+void wait_for_job(Job*);
+void wait_for_slot();
+void finish_job(Job*);
 void sigtstp_handler(int);
 
+/* Command Hash Table Functions */
+void path_cache_clear();
+const char* path_cache_lookup(const char*, bool);
+void path_cache_forget(const char*);
+
+/* Memo Functions */
+bool memo_replay(Job*);
+int memo_pipe(Job*);
+void memo_capture(Job*);
+void memo_store(Job*);
+void memo_release(MemoCapture*);
+void memo_clear();
+
+/* Process Launch Functions */
+void parse_controls(Job*);
+
 /* Main Loop Functions */
 void display_prompt();
-char* get_command();
+ssize_t read_input(InputBuffer*);
 Job* parse_command(char*);
 void dispatch_job(Job*);
 void dispatch_piped_jobs(Job*);
@@ -113,10 +415,48 @@ void builtins_bg(Command*);
 void builtins_cd(Command*);
 void builtins_exit(Command*);
 void builtins_fg(Command*);
+void builtins_hash(Command*);
 void builtins_jobs(Command*);
+void builtins_set(Command*);
+void builtins_wait(Command*);
+
+/* In-process Commands */
+typedef int (*InprocFunction)(Command*);
+typedef bool (*InprocCheck)(Command*);
+
+typedef struct {
+    const char* name;     /* Name of the command */
+    InprocFunction run;   /* Runs the command, returns its exit code */
+    InprocCheck handles;  /* Whether the shell handles these arguments, NULL if always */
+} InprocCommand;
+
+int inproc_echo(Command*);
+int inproc_false(Command*);
+int inproc_printf(Command*);
+int inproc_pwd(Command*);
+int inproc_test(Command*);
+int inproc_true(Command*);
+bool inproc_printf_handles(Command*);
+bool inproc_test_handles(Command*);
+
+#define _N_INPROCS_ 6
+static InprocCommand _inprocs_[_N_INPROCS_] = {
+    { _INPROC_ECHO_,   inproc_echo,   NULL },
+    { _INPROC_FALSE_,  inproc_false,  NULL },
+    { _INPROC_PRINTF_, inproc_printf, inproc_printf_handles },
+    { _INPROC_PWD_,    inproc_pwd,    NULL },
+    { _INPROC_TEST_,   inproc_test,   inproc_test_handles },
+    { _INPROC_TRUE_,   inproc_true,   NULL },
+};
+
+/* Script Cache Functions */
+bool script_load(const char*, Script*);
+Job* script_job(const Script*, uint32_t);
+void script_unload(Script*);
 
 /* Application Functions */
-void run_script(char*);
-void run_cli();
+void run_job(Job*);
+void run_script_file(const char*);
+void run_cli(int);
 
 #endif